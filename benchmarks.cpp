@@ -0,0 +1,859 @@
+#include "benchmarks.h"
+#include "listing_parser.h"
+#include "dependency_scan.h"
+#include "changes.h"
+#include "optimizer.h"
+#include "move_elimination.h"
+#include "simulator.h"
+#include "jit_harness.h"
+#include "encoder.h"
+#include "control_flow.h"
+#include "project_file.h"
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include <filesystem>
+
+unsigned long long random_operand(OperandFootprint ofp, std::mt19937& random) {
+	unsigned char kinds = accepted_operand_kinds(ofp);
+	unsigned char options[8];
+	int nr_options = 0;
+	for (unsigned char kind = 1; kind != 64; kind <<= 1) if (kinds & kind) options[nr_options++] = kind;
+	if (!nr_options) return 0;
+	switch (options[random() % nr_options]) {
+	case OK_REGISTER: return 0x10 | (random() % 16);
+	case OK_HIGH_BYTE: return 0x4 | (random() % 4);
+	case OK_LOW_SIMD: return 0x20 | (random() % 16);
+	case OK_HIGH_SIMD: return 0x20 | (16 + random() % 16);
+	case OK_IMMEDIATE: {
+		int size = ofp.head & OF_IMMEDIATE_SIZE;
+		unsigned long long value = (size >= 4) ? random() : random() & ((1u << (8 * size)) - 1);
+		return 0x200000000ull | value;
+	}
+	case OK_MEMORY: {
+		unsigned long long offset = (unsigned int)(int(random() % 4096) - 2048);
+		if (random() % 8 == 0) return 0x300000000ull | offset;
+		unsigned long long result = 0x400000000000ull | offset;
+		result |= (unsigned long long)(random() % 16) << 41;
+		if (random() % 2) result |= (unsigned long long)(1 << (random() % 3)) << 32 | (unsigned long long)(random() % 16) << 36;
+		else result |= 0x10ull << 36;
+		return result;
+	}
+	}
+	return 0;
+}
+
+std::string generate_random_listing(const std::vector<InstructionSetExtension>& extensions, int lines, unsigned int seed) {
+	std::mt19937 random(seed);
+	std::string result{};
+	for (int line = 0; line != lines; ) {
+		Instruction inst{ .extension = (unsigned char)(random() % extensions.size()) };
+		if (!extensions[inst.extension].instructions.size()) continue;
+		inst.index = random() % extensions[inst.extension].instructions.size();
+		auto& footprint = extensions[inst.extension].instructions[inst.index];
+		for (int i = 0; i != 4; i++)
+			inst.operands[i] = ((footprint.operands[i].head & OF_TYPE) == OF_DEREF) ? 0 : random_operand(footprint.operands[i], random);
+		if (!instruction_is_valid(inst, extensions)) continue;
+		std::string text = print_instruction(inst, extensions);
+		// a quarter of the lines leave the mnemonic lookup to the parser
+		if (random() % 4 == 0) text.resize(text.rfind(" ("));
+		result += text;
+		result += "\n";
+		line++;
+	}
+	return result;
+}
+
+void benchmark_listing_parser(MainState& main_state) {
+	const int lines = 1000000;
+	// the regex version rescans the rest of the source for every line, so it only gets a prefix
+	const int regex_lines = 20000;
+	std::string source = generate_random_listing(main_state.extensions, lines, 1);
+	size_t regex_bytes = 0;
+	for (int i = 0; i != regex_lines; i++) regex_bytes = source.find('\n', regex_bytes) + 1;
+	std::string_view regex_source{ source.data(), regex_bytes };
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<Instruction> parsed{};
+	ListingError error{};
+	bool ok = parse_listing(source, parsed, main_state.extensions, &main_state.mnemonics, error);
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+	if (!ok) std::cout << "parse_listing failed on line " << error.line << ", column " << error.column << ": " << error.message << "\n";
+	std::cout << "parse_listing: " << parsed.size() << " lines in " << seconds << "s, "
+		<< source.size() / seconds / 1e6 << " MB/s\n";
+
+	for (int threads : { 2, 4, 8, 0 }) {
+		start = std::chrono::steady_clock::now();
+		std::vector<Instruction> parsed_parallel{};
+		parse_listing_parallel(source, parsed_parallel, main_state.extensions, &main_state.mnemonics, error, threads);
+		end = std::chrono::steady_clock::now();
+		seconds = std::chrono::duration<double>(end - start).count();
+		std::cout << "parse_listing_parallel (" << (threads ? threads : std::thread::hardware_concurrency()) << " threads): "
+			<< source.size() / seconds / 1e6 << " MB/s" << (parsed_parallel.size() == parsed.size() ? "\n" : ", wrong number of instructions\n");
+	}
+
+	start = std::chrono::steady_clock::now();
+	auto parsed_regex = load_instructions_regex(regex_source, main_state.extensions, &main_state.mnemonics);
+	end = std::chrono::steady_clock::now();
+	seconds = std::chrono::duration<double>(end - start).count();
+	std::cout << "load_instructions_regex: " << parsed_regex.size() << " lines in " << seconds << "s, "
+		<< regex_source.size() / seconds / 1e6 << " MB/s\n";
+
+	for (size_t i = 0; i != parsed_regex.size(); i++)
+		if (parsed[i].extension != parsed_regex[i].extension || parsed[i].index != parsed_regex[i].index
+			|| !std::equal(parsed[i].operands, parsed[i].operands + 4, parsed_regex[i].operands)) {
+			std::cout << "parsers disagree on line " << i + 1 << "\n";
+			break;
+		}
+}
+
+void check_listing_parser_errors(MainState& main_state) {
+	std::vector<Instruction> instructions{};
+	ListingError error{};
+	if (!parse_listing("ADD64 RAX RBX\n", instructions, main_state.extensions, &main_state.mnemonics, error)) {
+		std::cout << "could not parse the add for the listing parser check\n";
+		return;
+	}
+	// the suffix of a line that parses is taken as it is. cut off or malformed ones are rejected, even at the end of
+	// the listing where nothing comes after them
+	std::string ext = std::to_string(instructions[0].extension), idx = std::to_string(instructions[0].index);
+	std::string malformed[] = { "(", "(" + ext, "(" + ext + ",", "(" + ext + "," + idx, "(x," + idx + ")", "(" + ext + " " + idx + ")" };
+	int accepted = 0;
+	for (auto& suffix : malformed) {
+		std::vector<Instruction> parsed{};
+		accepted += parse_listing("ADD64 RAX RBX " + suffix, parsed, main_state.extensions, &main_state.mnemonics, error);
+	}
+	std::vector<Instruction> parsed{};
+	bool complete = parse_listing("ADD64 RAX RBX (" + ext + ", " + idx + ")", parsed, main_state.extensions, &main_state.mnemonics, error)
+		&& parsed.size() == 1 && parsed[0].extension == instructions[0].extension && parsed[0].index == instructions[0].index;
+	std::cout << "listing parser: " << accepted << " of " << std::size(malformed) << " malformed (ext,idx) suffixes accepted, a complete one "
+		<< (complete ? "is" : "isn't") << " read back\n";
+}
+
+void benchmark_dependency_scan(MainState& main_state) {
+	const int lines = 1000000;
+	const int repeats = 20;
+	std::string source = generate_random_listing(main_state.extensions, lines, 2);
+	std::vector<Instruction> parsed{};
+	ListingError error{};
+	parse_listing(source, parsed, main_state.extensions, &main_state.mnemonics, error);
+	InstructionBuffer instructions{};
+	instructions.insert(0, std::span<const Instruction>(parsed));
+	PlaceMasks masks{};
+	place_masks_build(masks, instructions, main_state.extensions);
+	// the moving instruction only touches an unused place, so every search runs over the whole range.
+	// it goes at the end of the masks for can_swap_instructions
+	const unsigned long long unused_place = 1ull << 9;
+	int moving = int(masks.read.size());
+	masks.read.push_back(unused_place);
+	masks.written.push_back(unused_place);
+	int size = moving;
+
+	auto report = [&](const char* name, auto scan) {
+		auto start = std::chrono::steady_clock::now();
+		long long found = 0;
+		for (int repeat = 0; repeat != repeats; repeat++) found += scan();
+		auto end = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+		std::cout << name << ": " << seconds / repeats * 1e3 << " ms per scan, "
+			<< double(size) * repeats / seconds / 1e9 << " G instructions/s" << (found == (long long)size * repeats ? "\n" : ", wrong result\n");
+	};
+	report("can_swap_instructions loop", [&]() {
+		int i = 0;
+		while (i != size && can_swap_instructions(masks, moving, i)) i++;
+		return i;
+	});
+	report("first_conflict_scalar", [&]() { return first_conflict_scalar(masks.read.data(), masks.written.data(), 0, size, unused_place, unused_place); });
+	report("last_conflict_scalar", [&]() { return size - 1 - last_conflict_scalar(masks.read.data(), masks.written.data(), 0, size, unused_place, unused_place); });
+#if HAS_AVX2_SCAN
+	if (cpu_supports_avx2()) {
+		report("first_conflict_avx2", [&]() { return first_conflict_avx2(masks.read.data(), masks.written.data(), 0, size, unused_place, unused_place); });
+		report("last_conflict_avx2", [&]() { return size - 1 - last_conflict_avx2(masks.read.data(), masks.written.data(), 0, size, unused_place, unused_place); });
+	}
+	else std::cout << "no AVX2 on this cpu\n";
+#endif
+}
+
+void benchmark_liveness_solver(MainState& main_state) {
+	const int lines = 200000;
+	const int changes = 200;
+	auto jne = main_state.mnemonics.candidates.find("JNE");
+	auto jmp = main_state.mnemonics.candidates.find("JMP_rel");
+	if (jne == main_state.mnemonics.candidates.end() || jmp == main_state.mnemonics.candidates.end()) {
+		std::cout << "no relative jumps in the instruction set, skipping the liveness benchmark\n";
+		return;
+	}
+	std::vector<Instruction> instructions{};
+	ListingError error{};
+	parse_listing(generate_random_listing(main_state.extensions, lines, 3), instructions, main_state.extensions, &main_state.mnemonics, error);
+	// about one jump in 20 instructions, mostly backwards so there are plenty of loops
+	std::mt19937 random(3);
+	for (int i = 0; i < int(instructions.size()); i += 10 + random() % 20) {
+		auto& candidate = (random() % 4 ? jne : jmp)->second[0];
+		int displacement = int(random() % 2500) - 2000;
+		instructions[i] = { candidate.extension, candidate.index, { 0x200000000ull | (unsigned int)displacement, 0, 0, 0 } };
+	}
+	MainState state{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+	main_state_set_instructions(state, std::move(instructions));
+
+	auto start = std::chrono::steady_clock::now();
+	USE_MASK use_mask = USE_MASK_END_OF_PROGRAM;
+	for (int i = int(state.instructions.size()) - 1; i >= 0; i--)
+		use_mask = use_mask_above(state.instructions[i], state.extensions[state.instructions[i].extension].instructions[state.instructions[i].index], use_mask);
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "linear liveness pass over " << state.instructions.size() << " instructions: " << std::chrono::duration<double>(end - start).count() * 1e3 << " ms\n";
+
+	LivenessSolution full{};
+	std::vector<int> changed_blocks{};
+	start = std::chrono::steady_clock::now();
+	liveness_solve(full, state.cfg, state.instructions, state.extensions, 0, -1, changed_blocks);
+	end = std::chrono::steady_clock::now();
+	std::cout << "liveness_solve from scratch, " << state.cfg.blocks.size() << " blocks: " << std::chrono::duration<double>(end - start).count() * 1e3 << " ms\n";
+
+	// the same steps as main_state_apply_change, only the liveness part is timed
+	double seconds = 0;
+	int applied = 0;
+	for (int i = 0; i != changes; i++) {
+		unsigned long long pos1 = 0x10 | (random() % 16), pos2 = 0x10 | (random() % 16);
+		if (pos1 == pos2) continue;
+		Change change = build_horizontal_change(state.instructions, state.extensions, state.def_use, state.live_ranges, state.cfg, random() % state.instructions.size(), pos1, pos2);
+		if (!change.type) continue;
+		apply_change(state.instructions, state.extensions, &change);
+		place_masks_apply_change(state.places, state.instructions, state.extensions, change);
+		def_use_apply_change(state.def_use, state.places, change);
+		cfg_apply_change(state.cfg, state.instructions, state.extensions, state.places, change);
+		start = std::chrono::steady_clock::now();
+		liveness_apply_change(state.liveness, state.live_ranges, state.instructions, state.extensions, state.cfg, change);
+		end = std::chrono::steady_clock::now();
+		seconds += std::chrono::duration<double>(end - start).count();
+		main_state_undo_last_change(state, &change);
+		applied++;
+	}
+	std::cout << "liveness_apply_change after one register swap: " << seconds / applied * 1e6 << " us on average\n";
+
+	liveness_solve(full, state.cfg, state.instructions, state.extensions, 0, -1, changed_blocks);
+	bool agree = full.blocks.size() == state.liveness.blocks.size();
+	for (size_t b = 0; agree && b != full.blocks.size(); b++)
+		agree = full.blocks[b].live_in == state.liveness.blocks[b].live_in && full.blocks[b].live_out == state.liveness.blocks[b].live_out;
+	if (!agree) std::cout << "incremental and full liveness disagree\n";
+}
+
+// loops of four chains of adds, each starting with a load into its own register, written one chain after the other
+// and counting down RDI. on an in-order core they run one instruction per cycle until they are interleaved, which needs
+// moving the adds across each other's flags. in the random listings nearly every instruction waits for memory,
+// no reorder shortens that
+std::string generate_chain_listing(int loops) {
+	const char* registers[] = { "RAX", "RBX", "RCX", "RDX" };
+	std::string result = "";
+	for (int loop = 0; loop != loops; loop++) {
+		for (int chain = 0; chain != 4; chain++) {
+			result += std::format("MOV64 *RSI[{}] {}\n", 8 * chain, registers[chain]);
+			for (int i = 0; i != 7; i++) result += std::format("ADD64 R{} {}\n", 8 + chain, registers[chain]);
+		}
+		// back to the first load
+		result += "ADD64 0xffffffff RDI\nJNE 0xffffffde\n";
+	}
+	return result;
+}
+
+void benchmark_optimizer(MainState& main_state) {
+	const int loops = 60;
+	std::vector<Instruction> instructions{};
+	ListingError error{};
+	if (!parse_listing(generate_chain_listing(loops), instructions, main_state.extensions, &main_state.mnemonics, error)) {
+		std::cout << "could not parse the chains for the optimizer: " << error.message << "\n";
+		return;
+	}
+	MainState state{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+	main_state_set_instructions(state, std::move(instructions));
+
+	OptimizerSettings settings = default_optimizer_settings();
+	settings.iterations = 20000;
+	for (int threads : { 1, 0 }) {
+		settings.threads = threads;
+		auto start = std::chrono::steady_clock::now();
+		OptimizerResult result = optimize(state, settings);
+		auto end = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+		std::cout << "optimize (" << (threads ? threads : std::thread::hardware_concurrency()) << " threads): "
+			<< result.tried / seconds << " changes/s, cost " << result.start_cost << " -> " << result.cost << " with " << result.changes.size() << " changes\n";
+	}
+}
+
+void benchmark_move_elimination(MainState& main_state) {
+	const int lines = 200000, changes = 200;
+	std::vector<Instruction> instructions{};
+	ListingError error{};
+	parse_listing(generate_random_listing(main_state.extensions, lines, 5), instructions, main_state.extensions, &main_state.mnemonics, error);
+	MainState state{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+	main_state_set_instructions(state, std::move(instructions));
+
+	std::mt19937 random(5);
+	double seconds = 0;
+	int applied = 0, inserted = 0, removed = 0;
+	for (int i = 0; i != changes; i++) {
+		unsigned long long kind = random() % 4 ? 0x10 : 0x20;
+		unsigned long long pos1 = kind | (random() % 16), pos2 = kind | (random() % 16);
+		if (pos1 == pos2) continue;
+		Change change = build_horizontal_change(state.instructions, state.extensions, state.def_use, state.live_ranges, state.cfg, random() % state.instructions.size(), pos1, pos2);
+		if (!change.type) continue;
+		main_state_apply_change(state, &change);
+		main_state_record_change(state, change);
+		inserted += instructions_inserted(change);
+		auto start = std::chrono::steady_clock::now();
+		removed += main_state_eliminate_moves(state);
+		auto end = std::chrono::steady_clock::now();
+		seconds += std::chrono::duration<double>(end - start).count();
+		applied++;
+	}
+	std::cout << "main_state_eliminate_moves after a register swap: " << seconds / applied * 1e3 << " ms on average, "
+		<< removed << " of " << inserted << " inserted instructions removed\n";
+
+	// the removals of a pass are made all at once, so one removing hundreds of instructions still takes milliseconds
+	inserted = 0;
+	for (int i = 0; i != 10 * changes; i++) {
+		unsigned long long pos1 = 0x10 | (random() % 16), pos2 = 0x10 | (random() % 16);
+		if (pos1 == pos2) continue;
+		Change change = build_horizontal_change(state.instructions, state.extensions, state.def_use, state.live_ranges, state.cfg, random() % state.instructions.size(), pos1, pos2);
+		if (!change.type) continue;
+		main_state_apply_change(state, &change);
+		main_state_record_change(state, change);
+		inserted += instructions_inserted(change);
+	}
+	auto start = std::chrono::steady_clock::now();
+	removed = main_state_eliminate_moves(state);
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "main_state_eliminate_moves after " << 10 * changes << " register swaps: " << std::chrono::duration<double>(end - start).count() * 1e3
+		<< " ms, " << removed << " of " << inserted << " inserted instructions removed\n";
+}
+
+bool same_instructions(const std::vector<Instruction>& expected, const InstructionBuffer& instructions) {
+	if (expected.size() != instructions.size()) return false;
+	size_t i = 0;
+	for (const Instruction& instruction : instructions) {
+		const Instruction& other = expected[i++];
+		if (instruction.extension != other.extension || instruction.index != other.index || !std::equal(instruction.operands, instruction.operands + 4, other.operands)) return false;
+	}
+	return true;
+}
+
+// runs a listing of MOV64, ADD64, XCHG64, JNE and JMP_rel between registers, false if it has others or doesn't end
+bool interpret_listing(const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, unsigned long long registers[16], bool zero) {
+	int steps = 0;
+	for (long long i = 0, size = (long long)instructions.size(); i != size; i++) {
+		if (i < 0 || i > size || ++steps > 10000) return false;
+		const Instruction& instruction = instructions[i];
+		std::string_view name = &extensions[instruction.extension].names[extensions[instruction.extension].instructions[instruction.index].name];
+		unsigned long long source = instruction.operands[0], target = instruction.operands[1];
+		unsigned long long value = OP_IS_IMMEDIATE(source) ? (unsigned long long)(long long)int(OP_IMMEDIATE(source))
+			: OP_IS_REGISTER(source) ? registers[OP_REGISTER(source)] : 0;
+		if (name == "JNE" || name == "JMP_rel") {
+			if (name == "JMP_rel" || !zero) i += (long long)value;
+			if (i + 1 > size) return false;
+			continue;
+		}
+		if ((!OP_IS_REGISTER(source) && !OP_IS_IMMEDIATE(source)) || !OP_IS_REGISTER(target)) return false;
+		unsigned long long& result = registers[OP_REGISTER(target)];
+		if (name == "MOV64") result = value;
+		else if (name == "ADD64") zero = (result += value) == 0;
+		else if (name == "XCHG64" && OP_IS_REGISTER(source)) std::swap(registers[OP_REGISTER(source)], result);
+		else return false;
+	}
+	return true;
+}
+
+void check_register_swap_jumps(MainState& main_state) {
+	const char* listings[] = {
+		// out of the instructions renamed for a swap at 1
+		"MOV64 RBX RAX\nJNE 0x3\nADD64 RAX RCX\nMOV64 RDX RAX\nMOV64 RDX RSI\nADD64 RAX RDI\n",
+		// into the middle of them
+		"JNE 0x2\nMOV64 RAX RBX\nADD64 RBX RCX\nADD64 RAX RCX\nMOV64 RCX RDX\n",
+		// a loop counting down RBX
+		"MOV64 RSI RAX\nADD64 RAX RCX\nADD64 RCX RDX\nADD64 0xffffffff RBX\nJNE 0xfffffffc\nADD64 RDI RAX\n",
+	};
+	std::mt19937 random(8);
+	int checked = 0, wrong = 0;
+	for (const char* listing : listings) {
+		std::vector<Instruction> instructions{};
+		ListingError error{};
+		if (!parse_listing(listing, instructions, main_state.extensions, &main_state.mnemonics, error)) {
+			std::cout << "could not parse the listings for the register swap check\n";
+			return;
+		}
+		for (int index = 0; index <= int(instructions.size()); index++) for (unsigned long long pos1 = 0x10; pos1 != 0x19; pos1++) for (unsigned long long pos2 = pos1 + 1; pos2 != 0x19; pos2++) {
+			if (pos1 == 0x16 || pos2 == 0x16) continue; // RSP
+			MainState state{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+			main_state_set_instructions(state, std::vector<Instruction>(instructions));
+			Change change = build_horizontal_change(state.instructions, state.extensions, state.def_use, state.live_ranges, state.cfg, index, pos1, pos2);
+			if (!change.type) continue;
+			InstructionBuffer before = state.instructions;
+			main_state_apply_change(state, &change);
+			for (int run = 0; run != 8; run++) {
+				unsigned long long expected[16], registers[16];
+				for (int r = 0; r != 16; r++) expected[r] = registers[r] = r == 1 ? 1 + random() % 4 : random();
+				bool ends = interpret_listing(before, state.extensions, expected, run % 2) && interpret_listing(state.instructions, state.extensions, registers, run % 2);
+				wrong += !ends || !std::equal(expected, expected + 16, registers);
+				checked++;
+			}
+			main_state_undo_last_change(state, &change);
+			wrong += !same_instructions(instructions, state.instructions);
+		}
+	}
+	std::cout << "register swaps around jumps: " << wrong << " of " << checked << " runs differ from the listing\n";
+}
+
+void check_instruction_reorders(MainState& main_state) {
+	const char* listings[] = {
+		// the flags of the first two adds are overwritten before anything reads them, the third one's go to the jump
+		"ADD64 RAX RCX\nADD64 RBX RDX\nADD64 RSI RDI\nJNE 0x1\nMOV64 RDX RAX\nADD64 RDI RBX\nADD64 RCX RDX\nMOV64 RAX RCX\nADD64 RSI RAX\n",
+		// a loop counting down RBX, the flags of the adds inside are alive around the back edge only from the last one
+		"MOV64 RSI RAX\nADD64 RAX RCX\nADD64 RCX RDX\nADD64 0xffffffff RBX\nJNE 0xfffffffc\nADD64 RDI RAX\n",
+	};
+	std::mt19937 random(9);
+	int checked = 0, wrong = 0, moved = 0;
+	for (const char* listing : listings) {
+		std::vector<Instruction> instructions{};
+		ListingError error{};
+		if (!parse_listing(listing, instructions, main_state.extensions, &main_state.mnemonics, error)) {
+			std::cout << "could not parse the listings for the reorder check\n";
+			return;
+		}
+		MainState state{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+		main_state_set_instructions(state, std::vector<Instruction>(instructions));
+		for (int index = 0; index != int(instructions.size()); index++) for (int distance = -8; distance <= 8; distance++) {
+			Change change = build_vertical_change(state.places, state.live_ranges, state.cfg, index, distance);
+			if (!change.vertical.number_places_down) continue;
+			moved++;
+			InstructionBuffer before = state.instructions;
+			main_state_apply_change(state, &change);
+			for (int run = 0; run != 8; run++) {
+				unsigned long long expected[16], registers[16];
+				for (int r = 0; r != 16; r++) expected[r] = registers[r] = r == 1 ? 1 + random() % 4 : random();
+				bool ends = interpret_listing(before, state.extensions, expected, run % 2) && interpret_listing(state.instructions, state.extensions, registers, run % 2);
+				wrong += !ends || !std::equal(expected, expected + 16, registers);
+				checked++;
+			}
+			main_state_undo_last_change(state, &change);
+			wrong += !same_instructions(instructions, state.instructions);
+		}
+	}
+	std::cout << "instruction reorders across dead flags: " << moved << " moves, " << wrong << " of " << checked << " runs differ from the listing\n";
+}
+
+void benchmark_change_log(MainState& main_state) {
+	const int lines = 2000, changes = 50000, undos = 5000;
+	std::vector<Instruction> instructions{};
+	ListingError error{};
+	parse_listing(generate_random_listing(main_state.extensions, lines, 6), instructions, main_state.extensions, &main_state.mnemonics, error);
+	MainState state{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+	main_state_set_instructions(state, std::move(instructions));
+	state.change_log.memory_budget = ~size_t(0); // nothing is trimmed, so the start can still be checked out
+	std::vector<Instruction> original = state.instructions.to_vector();
+
+	std::mt19937 random(6);
+	while (state.change_log.current.index != changes) {
+		Change change;
+		if (random() % 2) {
+			unsigned long long pos1 = 0x10 | (random() % 16), pos2 = 0x10 | (random() % 16);
+			if (pos1 == pos2) continue;
+			change = build_horizontal_change(state.instructions, state.extensions, state.def_use, state.live_ranges, state.cfg, random() % (state.instructions.size() + 1), pos1, pos2);
+		}
+		else change = build_vertical_change(state.places, state.live_ranges, state.cfg, random() % state.instructions.size(), int(random() % 17) - 8);
+		if (!change.type || (change.type == INSTRUCTION_REORDER && !change.vertical.number_places_down)) continue;
+		main_state_apply_change(state, &change);
+		main_state_record_change(state, change);
+	}
+	std::vector<Instruction> last = state.instructions.to_vector();
+	const ChangeLog& log = state.change_log;
+	std::cout << "change log: " << double(log.branches[0].bytes.size()) / changes << " bytes per change instead of " << sizeof(Change)
+		<< ", " << log.snapshots.size() << " snapshots, " << change_log_memory(log) / 1e6 << " MB in total\n";
+
+	auto start = std::chrono::steady_clock::now();
+	main_state_checkout(state, 0, 0);
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "main_state_checkout back to the start: " << std::chrono::duration<double>(end - start).count() * 1e3 << " ms\n";
+	bool agree = same_instructions(original, state.instructions);
+	start = std::chrono::steady_clock::now();
+	main_state_checkout(state, 0, changes / 2 + 100);
+	end = std::chrono::steady_clock::now();
+	std::cout << "main_state_checkout to the middle: " << std::chrono::duration<double>(end - start).count() * 1e3 << " ms\n";
+	main_state_checkout(state, 0, changes);
+	agree &= same_instructions(last, state.instructions);
+	if (!agree) std::cout << "the change log did not restore the instructions\n";
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i != undos; i++) main_state_undo(state);
+	end = std::chrono::steady_clock::now();
+	std::cout << "undoing " << undos << " changes one by one: " << std::chrono::duration<double>(end - start).count() * 1e3 << " ms\n";
+}
+
+// a random register swap or reorder starting in [first, first + count), applied and recorded
+void record_random_change(MainState& state, std::mt19937& random, int first, int count) {
+	for (;;) {
+		Change change;
+		if (random() % 2) {
+			unsigned long long pos1 = 0x10 | (random() % 16), pos2 = 0x10 | (random() % 16);
+			if (pos1 == pos2) continue;
+			change = build_horizontal_change(state.instructions, state.extensions, state.def_use, state.live_ranges, state.cfg, first + random() % count, pos1, pos2);
+		}
+		else change = build_vertical_change(state.places, state.live_ranges, state.cfg, first + random() % count, int(random() % 17) - 8);
+		if (!change.type || (change.type == INSTRUCTION_REORDER && !change.vertical.number_places_down)) continue;
+		main_state_apply_change(state, &change);
+		main_state_record_change(state, change);
+		return;
+	}
+}
+
+void check_control_flow_returns(MainState& main_state) {
+	const char* listings[] = {
+		// a loop behind the return, only entered by its own jump
+		"ADD64 RAX RBX\nRET\nADD64 RCX RDX\nJNE 0xfffffffe\n",
+		// the one popping more, then a block nothing jumps to
+		"MOV64 RAX RBX\nJNE 0x1\nRETP 0x8\nADD64 RCX RDX\n",
+	};
+	int returns = 0, wrong = 0;
+	for (const char* listing : listings) {
+		std::vector<Instruction> instructions{};
+		ListingError error{};
+		if (!parse_listing(listing, instructions, main_state.extensions, &main_state.mnemonics, error)) {
+			std::cout << "could not parse the listings for the return check\n";
+			return;
+		}
+		MainState state{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+		main_state_set_instructions(state, std::move(instructions));
+		for (int b = 0; b != int(state.cfg.blocks.size()); b++) {
+			const BasicBlock& block = state.cfg.blocks[b];
+			const Instruction& last = state.instructions[block.last];
+			std::string_view name = &state.extensions[last.extension].names[state.extensions[last.extension].instructions[last.index].name];
+			if (name != "RET" && name != "RETP") continue;
+			returns++;
+			// it leaves the listing and the block after it is only reached by jumps
+			wrong += block.successors[0] != CFG_NO_SUCCESSOR || block.successors[1] != CFG_EXIT || block.last + 1 == int(state.instructions.size())
+				|| std::count(state.cfg.blocks[b + 1].predecessors.begin(), state.cfg.blocks[b + 1].predecessors.end(), b) != 0;
+		}
+	}
+	std::cout << "returns in the middle of listings: " << wrong << " of " << returns << " fall through into the next block\n";
+}
+
+void check_project_positions(MainState& main_state) {
+	std::vector<Instruction> instructions{};
+	ListingError error{};
+	parse_listing(generate_random_listing(main_state.extensions, 40, 11), instructions, main_state.extensions, &main_state.mnemonics, error);
+	MainState valid{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+	main_state_set_instructions(valid, std::move(instructions));
+	std::mt19937 random(11);
+	for (int i = 0; i != 20; i++) record_random_change(valid, random, 0, int(valid.instructions.size()));
+	int size = int(valid.instructions.size());
+	std::string path = (std::filesystem::temp_directory_path() / "check_project_positions.asmproj").string();
+	auto loads = [&](const MainState& state) {
+		MainState loaded{};
+		return save_project(path.c_str(), state) && load_project(path.c_str(), loaded);
+	};
+	auto recorded = [&](Change change) {
+		MainState state = valid;
+		main_state_record_change(state, change);
+		return state;
+	};
+
+	std::vector<MainState> broken{};
+	broken.push_back(recorded({ .vertical = { .type = INSTRUCTION_REORDER, .instruction = size - 1, .number_places_down = 3 } }));
+	broken.push_back(recorded({ .vertical = { .type = INSTRUCTION_REORDER, .instruction = 2, .number_places_down = -5 } }));
+	broken.push_back(recorded({ .horizontal = { .type = REGISTER_SWAP, .explicit_swap_at_start = 3, .explicit_swap_at_end = 3,
+		.first_instruction_affected = size - 2, .last_instruction_affected = size, .pos1 = 0x10, .pos2 = 0x11 } }));
+	// removing the instruction at size would only mean there was one more before
+	MainState removal = valid;
+	removal.elimination_steps = { { .kind = ELIMINATION_REMOVE, .first = size + 1, .last = size + 1, .pos1 = 0, .pos2 = 0, .removed = valid.instructions[0] } };
+	main_state_record_change(removal, { .elimination = { .type = MOVE_ELIMINATION, .first_step = 0, .nr_steps = 1 } });
+	broken.push_back(std::move(removal));
+	// removals out of order, the instructions are removed in one pass from the front
+	MainState unsorted = valid;
+	unsorted.elimination_steps = { { .kind = ELIMINATION_REMOVE, .first = 5, .last = 5, .pos1 = 0, .pos2 = 0, .removed = valid.instructions[0] },
+		{ .kind = ELIMINATION_REMOVE, .first = 2, .last = 2, .pos1 = 0, .pos2 = 0, .removed = valid.instructions[0] } };
+	main_state_record_change(unsorted, { .elimination = { .type = MOVE_ELIMINATION, .first_step = 0, .nr_steps = 2 } });
+	broken.push_back(std::move(unsorted));
+	// only in the redo history
+	MainState redo = recorded({ .vertical = { .type = INSTRUCTION_REORDER, .instruction = size + 4, .number_places_down = -1 } });
+	Change change;
+	change_log_step_back(redo.change_log, change, redo.elimination_steps);
+	broken.push_back(std::move(redo));
+	// a file cut off after the last change moved the last instruction
+	MainState truncated = valid;
+	change = { .vertical = { .type = INSTRUCTION_REORDER, .instruction = size - 1, .number_places_down = -1 } };
+	main_state_apply_change(truncated, &change);
+	main_state_record_change(truncated, change);
+	truncated.instructions.erase(size - 2, 2);
+	broken.push_back(std::move(truncated));
+
+	int rejected = 0;
+	for (auto& state : broken) rejected += !loads(state);
+	std::cout << "project positions: the recorded changes " << (loads(valid) ? "load" : "don't load") << ", " << rejected << " of " << broken.size()
+		<< " projects with a change outside the instructions or out of order are rejected\n";
+	std::filesystem::remove(path);
+}
+
+// generate_random_listing with its jumps replaced by short conditional ones every 10 to 30 instructions, like the
+// loops of a real kernel: the blocks stay small and no displacement outgrows its immediate. empty without JNE
+std::vector<Instruction> generate_short_jump_listing(const MainState& main_state, int lines, unsigned int seed, std::mt19937& random) {
+	auto jne = main_state.mnemonics.candidates.find("JNE");
+	if (jne == main_state.mnemonics.candidates.end()) return {};
+	std::vector<Instruction> parsed{};
+	ListingError error{};
+	parse_listing(generate_random_listing(main_state.extensions, lines, seed), parsed, main_state.extensions, &main_state.mnemonics, error);
+	PlaceMasks places{};
+	place_masks_build(places, InstructionBuffer(parsed), main_state.extensions);
+	std::vector<Instruction> instructions{};
+	for (size_t i = 0; i != parsed.size(); i++) if (!(places.written[i] & PLACE_CONTROL_FLOW)) instructions.push_back(parsed[i]);
+	for (size_t i = 0; i < instructions.size(); i += 10 + random() % 20) {
+		int displacement = int(random() % 80) - 50;
+		instructions[i] = { jne->second[0].extension, jne->second[0].index, { 0x200000000ull | (unsigned int)displacement, 0, 0, 0 } };
+	}
+	return instructions;
+}
+
+void benchmark_change_tree(MainState& main_state) {
+	const int lines = 200000, window = 4000, trunk = 300, branches = 24, branch_length = 600, checkouts = 20;
+	std::mt19937 random(7);
+	std::vector<Instruction> instructions = generate_short_jump_listing(main_state, lines, 7, random);
+	if (instructions.empty()) {
+		std::cout << "no relative jumps in the instruction set, skipping the change tree benchmark\n";
+		return;
+	}
+	MainState state{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+	main_state_set_instructions(state, std::move(instructions));
+
+	// sibling branches all leaving the trunk at its end, each one working on a different part of the listing
+	for (int i = 0; i != trunk; i++) record_random_change(state, random, 0, window);
+	std::vector<std::vector<Instruction>> tips{};
+	for (int b = 0; b != branches; b++) {
+		main_state_checkout(state, 0, trunk);
+		int first = random() % (state.instructions.size() - window);
+		for (int i = 0; i != branch_length; i++) record_random_change(state, random, first, window);
+		tips.push_back(state.instructions.to_vector());
+	}
+	const ChangeLog& log = state.change_log;
+	size_t records = 0;
+	for (auto& branch : log.branches) records += branch.bytes.size();
+	std::cout << "change tree: " << log.branches.size() << " branches, " << log.snapshots.size() << " snapshots in "
+		<< (change_log_memory(log) - records) / 1e6 << " MB instead of " << log.snapshots.size() * state.instructions.size() * sizeof(Instruction) / 1e6 << " MB as full copies\n";
+
+	bool agree = true;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i != checkouts; i++) {
+		int b = random() % branches;
+		main_state_checkout(state, b, log.branches[b].count);
+		agree &= same_instructions(tips[b], state.instructions);
+	}
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "main_state_checkout between sibling tips: " << std::chrono::duration<double>(end - start).count() * 1e3 / checkouts << " ms on average\n";
+	if (!agree) std::cout << "the change tree did not restore the instructions\n";
+}
+
+void benchmark_simulator(MainState& main_state) {
+	const int lines = 200000;
+	std::vector<Instruction> instructions{};
+	ListingError error{};
+	parse_listing(generate_random_listing(main_state.extensions, lines, 8), instructions, main_state.extensions, &main_state.mnemonics, error);
+	MainState state{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+	main_state_set_instructions(state, std::move(instructions));
+
+	SimulationResult result{};
+	auto start = std::chrono::steady_clock::now();
+	simulate(result, state.instructions, state.extensions, state.places, default_simulator_settings());
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+	std::cout << "simulate: " << state.instructions.size() / seconds / 1e6 << "M instructions/s, "
+		<< result.cycles << " cycles, " << result.instructions_per_cycle << " IPC\n";
+	for (auto& profile : timing_profiles(state.extensions)) {
+		SimulatorSettings settings = default_simulator_settings();
+		settings.profile = profile;
+		start = std::chrono::steady_clock::now();
+		simulate(result, state.instructions, state.extensions, state.places, settings);
+		end = std::chrono::steady_clock::now();
+		std::cout << "simulate with " << profile << " timings: " << state.instructions.size() / std::chrono::duration<double>(end - start).count() / 1e6
+			<< "M instructions/s, " << result.cycles << " cycles, " << result.instructions_per_cycle << " IPC\n";
+	}
+	start = std::chrono::steady_clock::now();
+	long long cost = optimizer_cost_in_order_cycles(state);
+	end = std::chrono::steady_clock::now();
+	std::cout << "optimizer_cost_in_order_cycles for comparison: " << state.instructions.size() / std::chrono::duration<double>(end - start).count() / 1e6
+		<< "M instructions/s, " << cost / OPTIMIZER_CYCLE_COST << " cycles\n";
+}
+
+bool same_simulation(const SimulationResult& a, const SimulationResult& b) {
+	if (a.cycles != b.cycles || a.instructions.size() != b.instructions.size()) return false;
+	for (size_t i = 0; i != a.instructions.size(); i++) {
+		const SimulatedInstruction& x = a.instructions[i], & y = b.instructions[i];
+		if (x.dispatch != y.dispatch || x.issue != y.issue || x.complete != y.complete || x.retire != y.retire || x.port != y.port) return false;
+	}
+	return true;
+}
+
+// the previews while dragging: a random change is applied, simulated, undone and simulated again
+void benchmark_simulator_update(MainState& main_state) {
+	const int lines = 200000, previews = 200;
+	std::mt19937 random(8);
+	// far jumps would change a displacement in almost every chunk whenever an instruction is inserted
+	std::vector<Instruction> instructions = generate_short_jump_listing(main_state, lines, 8, random);
+	if (instructions.empty()) {
+		std::cout << "no relative jumps in the instruction set, skipping the simulate_update benchmark\n";
+		return;
+	}
+	MainState state{ .extensions = main_state.extensions, .instructions = {}, .change_log = {} };
+	main_state_set_instructions(state, std::move(instructions));
+	SimulatorSettings settings = default_simulator_settings();
+
+	SimulationResult result{}, expected{};
+	simulate(result, state.instructions, state.extensions, state.places, settings);
+	InstructionBuffer simulated = state.instructions;
+	double seconds = 0;
+	size_t resimulated = 0, updates = 0;
+	bool agree = true;
+	auto update = [&]() {
+		auto start = std::chrono::steady_clock::now();
+		size_t first, end;
+		instruction_buffer_difference(simulated, state.instructions, first, end, same_simulated_instruction);
+		resimulated += simulate_update(result, state.instructions, state.extensions, state.places, settings, first, end);
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		simulated = state.instructions;
+		updates++;
+		simulate(expected, state.instructions, state.extensions, state.places, settings);
+		agree &= same_simulation(result, expected);
+	};
+	for (int p = 0; p != previews; ) {
+		Change change;
+		if (random() % 2) {
+			unsigned long long pos1 = 0x10 | (random() % 16), pos2 = 0x10 | (random() % 16);
+			if (pos1 == pos2) continue;
+			change = build_horizontal_change(state.instructions, state.extensions, state.def_use, state.live_ranges, state.cfg, random() % state.instructions.size(), pos1, pos2);
+		}
+		else change = build_vertical_change(state.places, state.live_ranges, state.cfg, random() % state.instructions.size(), int(random() % 17) - 8);
+		if (!change.type || (change.type == INSTRUCTION_REORDER && !change.vertical.number_places_down)) continue;
+		main_state_apply_change(state, &change);
+		update();
+		main_state_undo_last_change(state, &change);
+		update();
+		p++;
+	}
+	std::cout << "simulate_update: " << seconds * 1e3 / updates << " ms on average, " << double(resimulated) / updates << " of "
+		<< state.instructions.size() << " instructions simulated again\n";
+	if (!agree) std::cout << "simulate_update did not match simulate\n";
+}
+
+void benchmark_jit_harness(MainState&) {
+	const int adds = 1000;
+	// add rax, rbx, then add rcx, rbx / add rdx, rbx / add rsi, rbx / add rdi, rbx
+	const unsigned char dependent[] = { 0x48, 0x01, 0xd8 };
+	const unsigned char independent[4][3] = { { 0x48, 0x01, 0xd9 }, { 0x48, 0x01, 0xda }, { 0x48, 0x01, 0xde }, { 0x48, 0x01, 0xdf } };
+	std::vector<unsigned char> chains[2];
+	for (int i = 0; i != adds; i++) {
+		chains[0].insert(chains[0].end(), std::begin(dependent), std::end(dependent));
+		chains[1].insert(chains[1].end(), std::begin(independent[i % 4]), std::end(independent[i % 4]));
+	}
+	const char* names[2] = { "dependent", "independent" };
+	for (int c = 0; c != 2; c++) {
+		JitMeasurement measurement{};
+		if (!jit_measure(chains[c], default_jit_settings(), measurement)) {
+			std::cout << "jit_measure " << names[c] << " adds: " << measurement.failure << "\n";
+			continue;
+		}
+		std::cout << "jit_measure " << adds << " " << names[c] << " adds: " << measurement.median_ticks << " ticks median, "
+			<< double(measurement.min_ticks) / adds << " ticks/add best";
+		if (measurement.min_cycles >= 0)
+			std::cout << ", " << measurement.median_cycles << " cycles median, " << double(adds) / std::max(measurement.min_cycles, 1ll) << " IPC best";
+		else std::cout << ", no cycle counter";
+		std::cout << "\n";
+	}
+	// faults and endless loops end the run, not the program
+	const unsigned char faulting[] = { 0x48, 0x8b, 0x04, 0x25, 0x00, 0x00, 0x00, 0x00 }, endless[] = { 0xeb, 0xfe };
+	JitSettings settings = default_jit_settings();
+	settings.runs = 1;
+	settings.timeout_ms = 100;
+	JitMeasurement measurement{};
+	jit_measure(faulting, settings, measurement);
+	std::cout << "jit_measure mov rax, [0]: " << measurement.failure << "\n";
+	jit_measure(endless, settings, measurement);
+	std::cout << "jit_measure jmp $: " << measurement.failure << "\n";
+}
+
+void benchmark_encoder(MainState& main_state) {
+	const int lines = 200000, repeats = 10;
+	std::mt19937 random(9);
+	std::vector<Instruction> generated = generate_short_jump_listing(main_state, lines, 9, random);
+	if (generated.empty()) {
+		std::cout << "no relative jumps in the instruction set, skipping the encoder benchmark\n";
+		return;
+	}
+	// a few against the bytes from the manual, the far return with its 64 bit operand size
+	const std::pair<const char*, std::vector<unsigned char>> known[] = {
+		{ "RET", { 0xc3 } }, { "RETF", { 0x48, 0xcb } }, { "RETP 0x8", { 0xc2, 0x08, 0x00 } }, { "ADD64 RBX RAX", { 0x48, 0x01, 0xd8 } }
+	};
+	int wrong = 0;
+	for (auto& [line, bytes] : known) {
+		Instruction instruction{};
+		ListingError listing_error{};
+		unsigned char code[ENCODER_MAX_INSTRUCTION_SIZE];
+		const char* message;
+		int size = parse_instruction(line, instruction, main_state.extensions, &main_state.mnemonics, listing_error) ? encode_instruction(instruction, main_state.extensions, 0, code, message) : 0;
+		wrong += !std::equal(code, code + size, bytes.begin(), bytes.end());
+	}
+	std::cout << "encode_instruction: " << wrong << " of " << std::size(known) << " known encodings differ\n";
+
+	// without the ones that have no encoding or mix AH to DH with a REX prefix, and the jumps leaving the listing
+	std::vector<Instruction> instructions{};
+	for (size_t i = 0; i != generated.size(); i++) {
+		const Instruction& instruction = generated[i];
+		unsigned char code[ENCODER_MAX_INSTRUCTION_SIZE];
+		const char* message;
+		if (!encode_instruction(instruction, main_state.extensions, 0, code, message)) continue;
+		const InstructionFootprint& footprint = main_state.extensions[instruction.extension].instructions[instruction.index];
+		int op = jump_displacement_operand(instruction, footprint);
+		if (op >= 0 && (instructions.size() < 50 || generated.size() - i < 50)) continue;
+		instructions.push_back(instruction);
+	}
+	InstructionBuffer buffer(instructions);
+	MachineCode code{};
+	EncodingError error{};
+	auto start = std::chrono::steady_clock::now();
+	bool encoded = true;
+	for (int i = 0; i != repeats && encoded; i++) encoded = encode_listing(buffer, main_state.extensions, code, error);
+	auto end = std::chrono::steady_clock::now();
+	if (!encoded) {
+		std::cout << "encode_listing failed at instruction " << error.instruction << ": " << error.message << "\n";
+		return;
+	}
+	std::cout << "encode_listing: " << double(instructions.size()) * repeats / std::chrono::duration<double>(end - start).count() / 1e6
+		<< "M instructions/s, " << double(code.bytes.size()) / instructions.size() << " bytes per instruction\n";
+
+	// the dependent adds of benchmark_jit_harness, this time from a listing
+	const int adds = 1000;
+	std::string listing{};
+	for (int i = 0; i != adds; i++) listing += "ADD64 RBX RAX\n";
+	std::vector<Instruction> chain{};
+	ListingError listing_error{};
+	JitMeasurement measurement{};
+	if (!parse_listing(listing, chain, main_state.extensions, &main_state.mnemonics, listing_error)) std::cout << "could not parse the adds\n";
+	else if (!encode_listing(InstructionBuffer(chain), main_state.extensions, code, error)) std::cout << "could not encode the adds: " << error.message << "\n";
+	else if (!jit_measure(code.bytes, default_jit_settings(), measurement)) std::cout << "jit_measure encoded adds: " << measurement.failure << "\n";
+	else std::cout << "jit_measure " << adds << " encoded dependent adds: " << double(measurement.min_ticks) / adds << " ticks/add best\n";
+}
+
+void run_benchmarks(MainState& main_state) {
+	check_register_swap_jumps(main_state);
+	check_instruction_reorders(main_state);
+	check_project_positions(main_state);
+	check_control_flow_returns(main_state);
+	check_listing_parser_errors(main_state);
+	benchmark_listing_parser(main_state);
+	benchmark_dependency_scan(main_state);
+	benchmark_liveness_solver(main_state);
+	benchmark_optimizer(main_state);
+	benchmark_move_elimination(main_state);
+	benchmark_change_log(main_state);
+	benchmark_change_tree(main_state);
+	benchmark_simulator(main_state);
+	benchmark_simulator_update(main_state);
+	benchmark_jit_harness(main_state);
+	benchmark_encoder(main_state);
+}
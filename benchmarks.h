@@ -0,0 +1,44 @@
+#pragma once
+#include "main_state.h"
+
+// started with "hello --benchmark", results are printed to stdout
+void run_benchmarks(MainState& main_state);
+
+// random but valid instructions, printed one per line
+std::string generate_random_listing(const std::vector<InstructionSetExtension>& extensions, int lines, unsigned int seed);
+void benchmark_listing_parser(MainState& main_state);
+// lines ending in a cut off or malformed (ext,idx) suffix have to be rejected, not taken with half of it
+void check_listing_parser_errors(MainState& main_state);
+// first-conflict search of build_vertical_change: pairwise loop, scalar kernel and AVX2 kernel over 1M instructions
+void benchmark_dependency_scan(MainState& main_state);
+// global liveness on a synthetic listing with thousands of blocks and back edges: full solve against re-solving after one change
+void benchmark_liveness_solver(MainState& main_state);
+// register swaps at every point of small listings with forward jumps and a loop, each run before and after
+// by interpreting the moves and adds, and undone again. not timed
+void check_register_swap_jumps(MainState& main_state);
+// every reorder build_vertical_change allows in small listings whose adds overwrite each other's flags, checked the same way
+void check_instruction_reorders(MainState& main_state);
+// blocks ending in a return in the middle of small listings: they have to leave the listing without falling through
+void check_control_flow_returns(MainState& main_state);
+// a project with random changes saved and loaded back, then with a change recorded past the end of the instructions,
+// removals out of order, one only in the redo history and one cut off after its last change, which all have to be rejected
+void check_project_positions(MainState& main_state);
+// simulated annealing on 2040 instructions of small loops of interleavable chains of adds, on one thread and on all of them
+void benchmark_optimizer(MainState& main_state);
+// register swaps on a 200k instruction listing, each followed by main_state_eliminate_moves as after a drag,
+// then one pass after 2000 swaps
+void benchmark_move_elimination(MainState& main_state);
+// 50k recorded changes: size of the log, jumping to the start and the middle against undoing changes one by one
+void benchmark_change_log(MainState& main_state);
+// two dozen sibling branches on a 200k instruction listing: checking out one tip after another and
+// the memory of the snapshots sharing chunks against copying the instructions for each
+void benchmark_change_tree(MainState& main_state);
+// out-of-order simulation of a 200k instruction listing against the in-order cost of the optimizer
+void benchmark_simulator(MainState& main_state);
+// random changes on a 200k instruction listing simulated again from the checkpoint before them, checked against simulating everything
+void benchmark_simulator_update(MainState& main_state);
+// hand encoded chains of 64-bit adds run on this machine: dependent against spread over four registers
+void benchmark_jit_harness(MainState& main_state);
+// a few instructions against their bytes from the manual, a 200k instruction listing with short jumps encoded to machine code,
+// then a chain of adds from a listing run with jit_measure
+void benchmark_encoder(MainState& main_state);
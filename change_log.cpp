@@ -0,0 +1,425 @@
+#include "change_log.h"
+#include <algorithm>
+#include <cassert>
+
+unsigned long long zigzag_encode(long long value) { return (unsigned long long)value << 1 ^ (unsigned long long)(value >> 63); }
+long long zigzag_decode(unsigned long long value) { return (long long)(value >> 1) ^ -(long long)(value & 1); }
+
+void write_varint(std::vector<unsigned char>& bytes, unsigned long long value) {
+	for (; value >= 0x80; value >>= 7) bytes.push_back((unsigned char)(value | 0x80));
+	bytes.push_back((unsigned char)value);
+}
+bool read_varint(const std::vector<unsigned char>& bytes, size_t& offset, unsigned long long& value) {
+	value = 0;
+	for (int shift = 0; offset < bytes.size() && shift < 64; shift += 7) {
+		unsigned char byte = bytes[offset++];
+		value |= (unsigned long long)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) return true;
+	}
+	return false;
+}
+// the trailer: the highest 7 bits first, every byte but the first has the top bit set
+void write_trailer(std::vector<unsigned char>& bytes, size_t value) {
+	unsigned char groups[10];
+	int count = 0;
+	do groups[count++] = value & 0x7f; while (value >>= 7);
+	for (int i = count; i--; ) bytes.push_back(groups[i] | (i + 1 < count ? 0x80 : 0));
+}
+// reads the trailer ending at <end>
+bool read_trailer(const std::vector<unsigned char>& bytes, size_t end, size_t& value, size_t& length) {
+	value = 0;
+	for (length = 0; length < end && length < 10; ) {
+		unsigned char byte = bytes[end - ++length];
+		value |= size_t(byte & 0x7f) << 7 * (length - 1);
+		if (!(byte & 0x80)) return true;
+	}
+	return false;
+}
+size_t trailer_length(size_t value) {
+	size_t result = 1;
+	while (value >>= 7) result++;
+	return result;
+}
+
+// appends the record of <change>, relative to base and updating it
+void write_change_record(std::vector<unsigned char>& bytes, const Change& change, int& base, const std::vector<EliminationStep>& elimination_steps) {
+	size_t start = bytes.size();
+	switch (change.type) {
+	case REGISTER_SWAP: {
+		const RegisterSwap& swap = change.horizontal;
+		bytes.push_back((unsigned char)(REGISTER_SWAP | swap.explicit_swap_at_start << 2 | swap.explicit_swap_at_end << 5));
+		write_varint(bytes, zigzag_encode((long long)swap.first_instruction_affected - base));
+		write_varint(bytes, zigzag_encode((long long)swap.last_instruction_affected - swap.first_instruction_affected));
+		write_varint(bytes, swap.pos1);
+		write_varint(bytes, swap.pos2);
+		base = swap.first_instruction_affected;
+		break;
+	}
+	case INSTRUCTION_REORDER:
+		bytes.push_back(INSTRUCTION_REORDER);
+		write_varint(bytes, zigzag_encode((long long)change.vertical.instruction - base));
+		write_varint(bytes, zigzag_encode(change.vertical.number_places_down));
+		base = change.vertical.instruction;
+		break;
+	case MOVE_ELIMINATION:
+		bytes.push_back(MOVE_ELIMINATION);
+		write_varint(bytes, change.elimination.nr_steps);
+		for (int i = change.elimination.first_step; i != change.elimination.first_step + change.elimination.nr_steps; i++) {
+			const EliminationStep& step = elimination_steps[i];
+			write_varint(bytes, step.kind);
+			write_varint(bytes, step.first);
+			if (step.kind == ELIMINATION_REMOVE) {
+				write_varint(bytes, step.removed.extension);
+				write_varint(bytes, step.removed.index);
+				for (unsigned long long operand : step.removed.operands) write_varint(bytes, operand);
+			}
+			else {
+				write_varint(bytes, step.last - step.first);
+				write_varint(bytes, step.pos1);
+				write_varint(bytes, step.pos2);
+			}
+		}
+		break;
+	default: assert(false);
+	}
+	write_trailer(bytes, bytes.size() - start);
+}
+// the record starting at offset as if base were 0, delta is its position relative to base.
+// the steps of a MOVE_ELIMINATION replace elimination_steps, if it is given. false if it is cut off or malformed
+bool read_change_record(const std::vector<unsigned char>& bytes, size_t offset, Change& change, long long& delta, size_t& size, std::vector<EliminationStep>* elimination_steps) {
+	if (offset >= bytes.size()) return false;
+	size_t start = offset;
+	unsigned char head = bytes[offset++];
+	unsigned long long fields[4];
+	delta = 0;
+	change = { .type = char(head & 3) };
+	switch (change.type) {
+	case REGISTER_SWAP:
+		for (auto& field : fields) if (!read_varint(bytes, offset, field)) return false;
+		if ((head >> 2 & 7) > 4 || (head >> 5) > 4) return false;
+		delta = zigzag_decode(fields[0]);
+		change.horizontal = {
+			.type = REGISTER_SWAP,
+			.explicit_swap_at_start = char(head >> 2 & 7),
+			.explicit_swap_at_end = char(head >> 5),
+			.first_instruction_affected = int(delta),
+			.last_instruction_affected = int(delta + zigzag_decode(fields[1])),
+			.pos1 = fields[2],
+			.pos2 = fields[3]
+		};
+		break;
+	case INSTRUCTION_REORDER:
+		if (head != INSTRUCTION_REORDER || !read_varint(bytes, offset, fields[0]) || !read_varint(bytes, offset, fields[1])) return false;
+		delta = zigzag_decode(fields[0]);
+		change.vertical = { .type = INSTRUCTION_REORDER, .instruction = int(delta), .number_places_down = int(zigzag_decode(fields[1])) };
+		break;
+	case MOVE_ELIMINATION: {
+		unsigned long long nr_steps;
+		if (head != MOVE_ELIMINATION || !read_varint(bytes, offset, nr_steps) || nr_steps > bytes.size()) return false;
+		change.elimination = { .type = MOVE_ELIMINATION, .first_step = 0, .nr_steps = int(nr_steps) };
+		if (elimination_steps) elimination_steps->clear();
+		for (unsigned long long i = 0; i != nr_steps; i++) {
+			EliminationStep step{};
+			unsigned long long kind, first, values[6];
+			if (!read_varint(bytes, offset, kind) || !read_varint(bytes, offset, first) || kind > ELIMINATION_RENAME || first > 0x7fffffff) return false;
+			int nr_values = kind == ELIMINATION_REMOVE ? 6 : 3;
+			for (int v = 0; v != nr_values; v++) if (!read_varint(bytes, offset, values[v])) return false;
+			step.kind = int(kind);
+			step.first = int(first);
+			if (kind == ELIMINATION_REMOVE) {
+				if (values[0] > 0xff || values[1] > 0xffffffff) return false;
+				step.last = step.first;
+				step.removed = { (unsigned char)values[0], (unsigned int)values[1], { values[2], values[3], values[4], values[5] } };
+			}
+			else {
+				if (values[0] > 0x7fffffff - first) return false;
+				step.last = step.first + int(values[0]);
+				step.pos1 = values[1];
+				step.pos2 = values[2];
+			}
+			if (elimination_steps) elimination_steps->push_back(step);
+		}
+		break;
+	}
+	default: return false;
+	}
+	size_t body = offset - start, value, length;
+	size = body + trailer_length(body);
+	return start + size <= bytes.size() && read_trailer(bytes, start + size, value, length) && value == body && length == size - body;
+}
+void shift_change(Change& change, int base) {
+	if (change.type == REGISTER_SWAP) {
+		change.horizontal.first_instruction_affected += base;
+		change.horizontal.last_instruction_affected += base;
+	}
+	if (change.type == INSTRUCTION_REORDER) change.vertical.instruction += base;
+}
+int change_position(const Change& change, int base) {
+	if (change.type == REGISTER_SWAP) return change.horizontal.first_instruction_affected;
+	if (change.type == INSTRUCTION_REORDER) return change.vertical.instruction;
+	return base;
+}
+
+void change_log_record(ChangeLog& log, const Change& change, const std::vector<EliminationStep>& elimination_steps) {
+	ChangeLogPosition& current = log.current;
+	if (current.index != log.branches[current.branch].count) {
+		// the changes after current stay on the branch they are on
+		ChangeBranch branch{
+			.parent = current.branch,
+			.parent_offset = current.offset,
+			.start = { .branch = int(log.branches.size()), .index = current.index, .offset = 0, .base = current.base },
+			.count = current.index,
+			.last_visit = 0,
+			.bytes = {}
+		};
+		current = branch.start;
+		log.branches.push_back(std::move(branch));
+	}
+	ChangeBranch& branch = log.branches[current.branch];
+	write_change_record(branch.bytes, change, current.base, elimination_steps);
+	current.index++;
+	current.offset = branch.bytes.size();
+	branch.count++;
+	branch.last_visit = ++log.visits;
+}
+
+bool change_log_step_back(ChangeLog& log, Change& change, std::vector<EliminationStep>& elimination_steps) {
+	ChangeLogPosition& current = log.current;
+	const ChangeBranch& branch = log.branches[current.branch];
+	if (current.index == branch.start.index) return false;
+	size_t body, length, size;
+	long long delta;
+	read_trailer(branch.bytes, current.offset, body, length);
+	current.offset -= body + length;
+	read_change_record(branch.bytes, current.offset, change, delta, size, &elimination_steps);
+	// the position of this change is the base of the one after it
+	if (change.type != MOVE_ELIMINATION) current.base -= int(delta);
+	shift_change(change, current.base);
+	current.index--;
+	// the start of a branch is the same point as where it leaves its parent
+	if (current.index == branch.start.index && branch.parent >= 0) current = { .branch = branch.parent, .index = current.index, .offset = branch.parent_offset, .base = current.base };
+	return true;
+}
+bool change_log_step_forward(ChangeLog& log, Change& change, std::vector<EliminationStep>& elimination_steps) {
+	ChangeLogPosition& current = log.current;
+	ChangeBranch& branch = log.branches[current.branch];
+	if (current.index == branch.count) return false;
+	size_t size;
+	long long delta;
+	read_change_record(branch.bytes, current.offset, change, delta, size, &elimination_steps);
+	shift_change(change, current.base);
+	current.index++;
+	current.offset += size;
+	current.base = change_position(change, current.base);
+	branch.last_visit = ++log.visits;
+	return true;
+}
+int change_log_redo_branch(const ChangeLog& log) {
+	const ChangeLogPosition& current = log.current;
+	int result = current.index != log.branches[current.branch].count ? current.branch : -1;
+	for (int b = 0; b != int(log.branches.size()); b++) {
+		const ChangeBranch& branch = log.branches[b];
+		if (branch.parent == current.branch && branch.start.index == current.index && branch.count != branch.start.index
+			&& (result < 0 || branch.last_visit > log.branches[result].last_visit)) result = b;
+	}
+	return result;
+}
+void change_log_enter_branch(ChangeLog& log, int branch) {
+	assert(log.branches[branch].parent == log.current.branch && log.branches[branch].start.index == log.current.index);
+	log.current = log.branches[branch].start;
+}
+
+std::vector<int> change_log_path(const ChangeLog& log, int branch) {
+	std::vector<int> result{};
+	for (int b = branch; b >= 0; b = log.branches[b].parent) result.push_back(b);
+	std::reverse(result.begin(), result.end());
+	return result;
+}
+int change_log_path_index(const ChangeLog& log, const std::vector<int>& path, int index, int on) {
+	for (size_t i = 0; i != path.size(); i++)
+		if (path[i] == on) return i + 1 == path.size() ? index : log.branches[path[i + 1]].start.index;
+	return -1;
+}
+
+bool snapshot_before(const ChangeLogSnapshot& snapshot, const ChangeLogPosition& position) {
+	return snapshot.position.branch != position.branch ? snapshot.position.branch < position.branch : snapshot.position.index < position.index;
+}
+const ChangeLogSnapshot* change_log_snapshot_on_path(const ChangeLog& log, const std::vector<int>& path, int index) {
+	// the ones on a deeper branch always have a higher index
+	for (size_t i = path.size(); i--; ) {
+		ChangeLogPosition end{ .branch = path[i], .index = change_log_path_index(log, path, index, path[i]) + 1, .offset = 0, .base = 0 };
+		auto snapshot = std::lower_bound(log.snapshots.begin(), log.snapshots.end(), end, snapshot_before);
+		if (snapshot != log.snapshots.begin() && (snapshot - 1)->position.branch == path[i]) return &*(snapshot - 1);
+	}
+	return nullptr;
+}
+void change_log_add_snapshot(ChangeLog& log, const InstructionBuffer& instructions) {
+	auto snapshot = std::lower_bound(log.snapshots.begin(), log.snapshots.end(), log.current, snapshot_before);
+	if (snapshot != log.snapshots.end() && snapshot->position.branch == log.current.branch && snapshot->position.index == log.current.index) return;
+	log.snapshots.insert(snapshot, { log.current, instructions });
+}
+
+size_t change_log_memory(const ChangeLog& log) {
+	size_t result = 0;
+	for (auto& branch : log.branches) result += branch.bytes.size();
+	std::vector<const std::vector<Instruction>*> chunks{};
+	for (auto& snapshot : log.snapshots)
+		for (auto& chunk : snapshot.instructions.chunks) chunks.push_back(chunk.get());
+	std::sort(chunks.begin(), chunks.end());
+	chunks.erase(std::unique(chunks.begin(), chunks.end()), chunks.end());
+	for (auto chunk : chunks) result += chunk->size() * sizeof(Instruction);
+	return result;
+}
+
+// decodes <branch> from its start up to change <index>
+ChangeLogPosition change_log_seek(const ChangeLog& log, int branch, int index) {
+	ChangeLogPosition result = log.branches[branch].start;
+	Change change;
+	long long delta;
+	size_t size;
+	for (; result.index != index; result.index++) {
+		read_change_record(log.branches[branch].bytes, result.offset, change, delta, size, nullptr);
+		shift_change(change, result.base);
+		result.offset += size;
+		result.base = change_position(change, result.base);
+	}
+	return result;
+}
+// drops the changes of branch 0 before the oldest snapshot on it, or before the first point anything depends on
+bool trim_first_branch(ChangeLog& log, const std::vector<int>& path) {
+	ChangeBranch& first = log.branches[0];
+	int limit = change_log_path_index(log, path, log.current.index, 0);
+	for (auto& branch : log.branches) if (branch.parent == 0) limit = std::min(limit, branch.start.index);
+	if (limit == first.start.index) return false;
+	ChangeLogPosition cut{};
+	auto snapshot = std::find_if(log.snapshots.begin(), log.snapshots.end(), [&](const ChangeLogSnapshot& snapshot) {
+		return snapshot.position.branch == 0 && snapshot.position.index > first.start.index && snapshot.position.index <= limit;
+	});
+	cut = snapshot != log.snapshots.end() ? snapshot->position : change_log_seek(log, 0, limit);
+
+	first.bytes.erase(first.bytes.begin(), first.bytes.begin() + cut.offset);
+	first.start = { .branch = 0, .index = cut.index, .offset = 0, .base = cut.base };
+	log.snapshots.erase(std::remove_if(log.snapshots.begin(), log.snapshots.end(), [&](const ChangeLogSnapshot& snapshot) {
+		return snapshot.position.branch == 0 && snapshot.position.index < cut.index;
+	}), log.snapshots.end());
+	for (auto& snapshot : log.snapshots) if (snapshot.position.branch == 0) snapshot.position.offset -= cut.offset;
+	for (auto& branch : log.branches) if (branch.parent == 0) branch.parent_offset -= cut.offset;
+	if (log.current.branch == 0) log.current.offset -= cut.offset;
+	return true;
+}
+void change_log_trim(ChangeLog& log) {
+	while (change_log_memory(log) > log.memory_budget) {
+		std::vector<int> path = change_log_path(log, log.current.branch);
+		std::vector<bool> has_branches(log.branches.size());
+		for (auto& branch : log.branches) if (branch.parent >= 0) has_branches[branch.parent] = true;
+		int drop = -1;
+		for (int b = 1; b != int(log.branches.size()); b++) {
+			const ChangeBranch& branch = log.branches[b];
+			if (branch.parent >= 0 && !has_branches[b] && std::find(path.begin(), path.end(), b) == path.end()
+				&& (drop < 0 || branch.last_visit < log.branches[drop].last_visit)) drop = b;
+		}
+		if (drop < 0) {
+			if (!trim_first_branch(log, path)) return;
+			continue;
+		}
+		// the branch number stays taken, so the other branches keep theirs
+		ChangeBranch& branch = log.branches[drop];
+		branch.parent = CHANGE_BRANCH_DROPPED;
+		branch.count = branch.start.index;
+		branch.bytes = {};
+		log.snapshots.erase(std::remove_if(log.snapshots.begin(), log.snapshots.end(),
+			[&](const ChangeLogSnapshot& snapshot) { return snapshot.position.branch == drop; }), log.snapshots.end());
+	}
+}
+
+// whether <change> fits into the instructions there are before it, <count> relative to the start of branch 0.
+// it is moved over the change, and <needed> is raised to the count at that start the positions of the change require
+bool change_fits(const Change& change, const std::vector<EliminationStep>& steps, long long& count, long long& needed) {
+	auto touches = [&](long long first, long long last) {
+		needed = std::max(needed, last + 1 - count);
+		return first >= 0 && first <= last;
+	};
+	// both general purpose or both SIMD registers, like the swaps and renames are built
+	auto swappable = [](unsigned long long pos1, unsigned long long pos2) {
+		return (OP_IS_REGISTER(pos1) && OP_IS_REGISTER(pos2)) || (OP_IS_SIMD_REGISTER(pos1) && OP_IS_SIMD_REGISTER(pos2));
+	};
+	switch (change.type) {
+	case REGISTER_SWAP: {
+		const RegisterSwap& swap = change.horizontal;
+		if (!swappable(swap.pos1, swap.pos2) || !touches(swap.first_instruction_affected, swap.last_instruction_affected)) return false;
+		count += instructions_inserted(change);
+		return true;
+	}
+	case INSTRUCTION_REORDER: {
+		const InstructionReorder& reorder = change.vertical;
+		long long other = (long long)reorder.instruction + reorder.number_places_down;
+		return touches(std::min<long long>(reorder.instruction, other), std::max<long long>(reorder.instruction, other));
+	}
+	case MOVE_ELIMINATION:
+		// each step's positions are the ones after the removals before it. the removals are made in one pass from
+		// the front, so none of them can lie before the one before it
+		for (long long removed = 0; auto& step : steps) {
+			if (step.kind == ELIMINATION_REMOVE) {
+				if (step.first < removed || !touches(step.first, step.first)) return false;
+				removed = step.first;
+				count--;
+			}
+			else if (!swappable(step.pos1, step.pos2) || !touches(step.first, step.last)) return false;
+		}
+		return true;
+	}
+	return false;
+}
+bool change_log_valid(const ChangeLog& log, const std::vector<InstructionSetExtension>& extensions, size_t nr_instructions) {
+	if (log.branches.empty() || log.branches[0].parent != CHANGE_BRANCH_ROOT) return false;
+	// every point between two records of every branch, with the number of instructions there relative to the start of branch 0
+	std::vector<std::vector<ChangeLogPosition>> points(log.branches.size());
+	std::vector<std::vector<long long>> counts(log.branches.size());
+	std::vector<EliminationStep> steps{};
+	long long needed = 0; // at the start of branch 0
+	for (int b = 0; b != int(log.branches.size()); b++) {
+		const ChangeBranch& branch = log.branches[b];
+		if (branch.start.branch != b || branch.start.offset != 0 || branch.start.index < 0 || branch.count < branch.start.index) return false;
+		if (branch.parent == CHANGE_BRANCH_DROPPED) {
+			if (!branch.bytes.empty() || branch.count != branch.start.index) return false;
+			continue;
+		}
+		if (b && (branch.parent < 0 || branch.parent >= b || log.branches[branch.parent].parent == CHANGE_BRANCH_DROPPED)) return false;
+		long long count = 0;
+		if (b) {
+			const ChangeBranch& parent = log.branches[branch.parent];
+			if (branch.start.index < parent.start.index || branch.start.index > parent.count) return false;
+			const ChangeLogPosition& fork = points[branch.parent][branch.start.index - parent.start.index];
+			if (fork.offset != branch.parent_offset || fork.base != branch.start.base) return false;
+			count = counts[branch.parent][branch.start.index - parent.start.index];
+		}
+		ChangeLogPosition point = branch.start;
+		points[b].push_back(point);
+		counts[b].push_back(count);
+		while (point.offset != branch.bytes.size()) {
+			Change change;
+			long long delta;
+			size_t size;
+			steps.clear();
+			if (point.index == branch.count || !read_change_record(branch.bytes, point.offset, change, delta, size, &steps)) return false;
+			for (auto& step : steps) if (step.kind == ELIMINATION_REMOVE
+				&& (step.removed.extension >= extensions.size() || step.removed.index >= extensions[step.removed.extension].instructions.size())) return false;
+			shift_change(change, point.base);
+			if (!change_fits(change, steps, count, needed)) return false;
+			point.index++;
+			point.offset += size;
+			point.base = change_position(change, point.base);
+			points[b].push_back(point);
+			counts[b].push_back(count);
+		}
+		if (point.index != branch.count) return false;
+	}
+	const ChangeLogPosition& current = log.current;
+	if (current.branch < 0 || current.branch >= int(log.branches.size()) || log.branches[current.branch].parent == CHANGE_BRANCH_DROPPED) return false;
+	const ChangeBranch& branch = log.branches[current.branch];
+	if (current.index < branch.start.index || current.index > branch.count) return false;
+	const ChangeLogPosition& point = points[current.branch][current.index - branch.start.index];
+	// the instructions are the ones at current, so every record has to fit the count that gives at the start
+	long long start_count = (long long)nr_instructions - counts[current.branch][current.index - branch.start.index];
+	return point.offset == current.offset && point.base == current.base && start_count >= needed;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+#include "changes.h"
+
+// the undo/redo history, a tree of branches. a branch is a run of changes, each a variable length record:
+//	a byte with the type, for a REGISTER_SWAP also both explicit swaps (type | at_start << 2 | at_end << 5)
+//	varints, signed ones zigzag encoded:
+//		REGISTER_SWAP first_instruction_affected - base, last - first, pos1, pos2
+//		INSTRUCTION_REORDER instruction - base, number_places_down
+//		MOVE_ELIMINATION nr_steps, then per step its kind and first, followed by
+//			extension, index and the operands of the removed instruction or last - first, pos1 and pos2
+//	the size of the record without this trailer, a varint stored back to front so a branch can be read backwards
+// base is the first_instruction_affected/instruction of the REGISTER_SWAP/INSTRUCTION_REORDER before it.
+// recording a change anywhere but at the end of a branch starts a new branch there, so nothing is lost by undoing.
+// at every multiple of CHANGE_LOG_SNAPSHOT_INTERVAL changes the instructions are kept, sharing all chunks that did
+// not change since, so a checkout replays at most about that many changes after restoring one
+#define CHANGE_LOG_SNAPSHOT_INTERVAL 64
+// restoring a snapshot builds the blocks again, which takes about as long as applying CHANGE_LOG_RESTORE_COST changes,
+// and updates the other indices where the instructions differ, as long as a change for every CHANGE_LOG_RESTORED_PER_CHANGE of them
+#define CHANGE_LOG_RESTORE_COST 32
+#define CHANGE_LOG_RESTORED_PER_CHANGE 64
+#define CHANGE_LOG_DEFAULT_MEMORY_BUDGET (256ull << 20)
+#define CHANGE_BRANCH_ROOT -1
+#define CHANGE_BRANCH_DROPPED -2
+
+// a point in the history, with what is needed to read on in both directions
+struct ChangeLogPosition {
+	int branch;
+	int index; // number of changes applied since the start of the history
+	size_t offset; // in the bytes of the branch, where the record of change <index> starts
+	int base;
+};
+struct ChangeBranch {
+	int parent; // a lower branch, CHANGE_BRANCH_ROOT for branch 0 and CHANGE_BRANCH_DROPPED once it was dropped
+	size_t parent_offset; // where the branch leaves its parent, at start.index
+	ChangeLogPosition start; // before its first change, offset 0
+	int count; // index after its last change
+	long long last_visit; // last time a change on it was recorded or redone, redo follows the latest branch
+	std::vector<unsigned char> bytes;
+};
+struct ChangeLogSnapshot {
+	ChangeLogPosition position;
+	InstructionBuffer instructions; // with position.index changes applied
+};
+struct ChangeLog {
+	std::vector<ChangeBranch> branches{ { .parent = CHANGE_BRANCH_ROOT, .parent_offset = 0, .start = { 0, 0, 0, 0 }, .count = 0, .last_visit = 0, .bytes = {} } };
+	ChangeLogPosition current{ .branch = 0, .index = 0, .offset = 0, .base = 0 };
+	std::vector<ChangeLogSnapshot> snapshots{}; // ordered by branch, then by index
+	long long visits = 0;
+	size_t memory_budget = CHANGE_LOG_DEFAULT_MEMORY_BUDGET;
+};
+
+// appends <change>, which was just applied, to the current branch or starts a new one if current is not at its end.
+// the steps of a MOVE_ELIMINATION are elimination_steps[first_step, first_step + nr_steps)
+void change_log_record(ChangeLog& log, const Change& change, const std::vector<EliminationStep>& elimination_steps);
+// reads the change before current and moves current over it, continuing in the parent at the start of a branch.
+// the steps of a MOVE_ELIMINATION replace elimination_steps. false at the start of the history
+bool change_log_step_back(ChangeLog& log, Change& change, std::vector<EliminationStep>& elimination_steps);
+// the same forwards, staying on the current branch. false at its end
+bool change_log_step_forward(ChangeLog& log, Change& change, std::vector<EliminationStep>& elimination_steps);
+// the branch a redo continues on: the current one or one starting at current, whichever was visited last. -1 if there is none
+int change_log_redo_branch(const ChangeLog& log);
+// moves current to the start of <branch>, which has to start at current
+void change_log_enter_branch(ChangeLog& log, int branch);
+// the branches from branch 0 down to <branch>
+std::vector<int> change_log_path(const ChangeLog& log, int branch);
+// the index where the history from the start to change <index> on <branch> leaves <on>, -1 if it does not pass it
+int change_log_path_index(const ChangeLog& log, const std::vector<int>& path, int index, int on);
+// the deepest snapshot on the way to change <index> on the end of <path>, nullptr if there is none
+const ChangeLogSnapshot* change_log_snapshot_on_path(const ChangeLog& log, const std::vector<int>& path, int index);
+// a copy of <instructions>, which have to be the ones with current.index changes applied
+void change_log_add_snapshot(ChangeLog& log, const InstructionBuffer& instructions);
+// the records, and the snapshots counting every shared chunk once
+size_t change_log_memory(const ChangeLog& log);
+// drops the branches nothing starts from that were visited least recently, then the oldest changes of branch 0 up to
+// where the first branch leaves it, until the log fits into memory_budget. the path from the start to current is kept
+void change_log_trim(ChangeLog& log);
+// whether all branches can be read, fit together and only remove instructions of <extensions>, and whether every change
+// stays inside the instructions there are before it, counted from the <nr_instructions> at current
+bool change_log_valid(const ChangeLog& log, const std::vector<InstructionSetExtension>& extensions, size_t nr_instructions);
@@ -1,7 +1,8 @@
 #include <cassert>
 #include "changes.h"
+#include "dependency_scan.h"
 #include <algorithm>
-const InstructionFootprint& footprint(const std::vector<InstructionSetExtension> extensions, const Instruction& instruction) {
+const InstructionFootprint& footprint(const std::vector<InstructionSetExtension>& extensions, const Instruction& instruction) {
 	return extensions[instruction.extension].instructions[instruction.index];
 }
 
@@ -13,7 +14,7 @@ struct TwoRegisterMove {
 	unsigned long long pos2;
 };
 
-bool move_swap_up_through(std::vector<InstructionSetExtension>& extensions, Instruction& instruction, TwoRegisterMove& move) {
+bool move_swap_up_through(const std::vector<InstructionSetExtension>& extensions, const Instruction& instruction, TwoRegisterMove& move) {
 	// TODO if this itself is a swap/mov between the positions
 	// TODO what about high bytes
 
@@ -34,12 +35,11 @@ bool move_swap_up_through(std::vector<InstructionSetExtension>& extensions, Inst
 		unsigned char op_head = footprint(extensions, instruction).operands[i].head;
 		unsigned long long op = instruction.operands[i];
 		if (op_head && (op_head & OF_TYPE) == OF_DEREF &&
-			(op_head & OF_PTR_REGISTER | 0x10) == move.pos1 ||
-				(op_head & OF_PTR_REGISTER | 0x10) == move.pos2) return false;
+			(((op_head & OF_PTR_REGISTER) | 0x10) == move.pos1 || ((op_head & OF_PTR_REGISTER) | 0x10) == move.pos2)) return false;
 		
 		if (!op) continue;
 
-		if (op == move.pos1 || op < 8 && op + 12 == move.pos1) {
+		if (op == move.pos1 || (op < 8 && op + 12 == move.pos1)) {
 			if ((op_head & OF_TYPE) == OF_OUT) pos1_is_written = true;
 			if ((op_head & OF_TYPE) == OF_IN) pos1_is_read = true;
 			if ((op_head & OF_TYPE) == OF_IO) pos1_io = true;
@@ -49,7 +49,7 @@ bool move_swap_up_through(std::vector<InstructionSetExtension>& extensions, Inst
 			if (OP_IS_SIMD_REGISTER(move.pos2) && OP_SIMD_REGISTER(move.pos2) < 16 && (!(op_head & OF_SIMD_REGISTER) || !(op_head & OF_CAN_BE_LOW_SIMD))) return false;
 			if (OP_IS_SIMD_REGISTER(move.pos2) && OP_SIMD_REGISTER(move.pos2) > 15 && (!(op_head & OF_SIMD_REGISTER) || !(op_head & OF_CAN_BE_HIGH_SIMD))) return false;
 		}
-		if (op == move.pos2 || op < 8 && op + 12 == move.pos2) {
+		if (op == move.pos2 || (op < 8 && op + 12 == move.pos2)) {
 			if ((op_head & OF_TYPE) == OF_OUT) pos2_is_written = true;
 			if ((op_head & OF_TYPE) == OF_IN) pos2_is_read = true;
 			if ((op_head & OF_TYPE) == OF_IO) pos2_io = true;
@@ -76,8 +76,9 @@ bool move_swap_up_through(std::vector<InstructionSetExtension>& extensions, Inst
 			}
 		}
 	}
-	pos1_is_written = pos1_is_written || !move.pos1_moves_to_pos2 && !pos1_io;
-	pos2_is_written = pos2_is_written || !move.pos2_moves_to_pos1 && !pos2_io;
+	// a position read here has to be moved above it, even if nothing below needs it
+	pos1_is_written = (pos1_is_written || !move.pos1_moves_to_pos2) && !pos1_io && !pos1_is_read;
+	pos2_is_written = (pos2_is_written || !move.pos2_moves_to_pos1) && !pos2_io && !pos2_is_read;
 	if (pos1_is_written && pos2_is_written) { // B
 		move.pos1_moves_to_pos2 = false;
 		move.pos2_moves_to_pos1 = false;
@@ -96,6 +97,10 @@ bool move_swap_up_through(std::vector<InstructionSetExtension>& extensions, Inst
 	}
 	return true;
 }
+bool can_swap_registers(const std::vector<InstructionSetExtension>& extensions, const Instruction& instruction, unsigned long long pos1, unsigned long long pos2) {
+	TwoRegisterMove move = { .pos1_moves_to_pos2 = true, .pos2_moves_to_pos1 = true, .pos1 = pos1, .pos2 = pos2 };
+	return move_swap_up_through(extensions, instruction, move);
+}
 struct DownState {
 	bool pos1_must_be_dead;
 	bool pos2_must_be_dead;
@@ -103,10 +108,10 @@ struct DownState {
 	unsigned long long pos1;
 	unsigned long long pos2;
 };
-bool update_down_state(std::vector<InstructionSetExtension>& extensions, std::span<Instruction> instructions, int instruction_index, DownState& move) {
+bool update_down_state(std::vector<InstructionSetExtension>& extensions, const InstructionBuffer& instructions, int instruction_index, DownState& move) {
 	// TODO if this itself is a swap/mov between the positions
 	// TODO what about high bytes
-	Instruction& instruction = instructions[instruction_index];
+	const Instruction& instruction = instructions[instruction_index];
 
 	bool pos1_is_read = false;
 	bool pos2_is_read = false;
@@ -125,12 +130,11 @@ bool update_down_state(std::vector<InstructionSetExtension>& extensions, std::sp
 		unsigned char op_head = footprint(extensions, instruction).operands[i].head;
 		unsigned long long op = instruction.operands[i];
 		if (op_head && (op_head & OF_TYPE) == OF_DEREF &&
-			(op_head & OF_PTR_REGISTER | 0x10) == move.pos1 ||
-			(op_head & OF_PTR_REGISTER | 0x10) == move.pos2) return false;
+			(((op_head & OF_PTR_REGISTER) | 0x10) == move.pos1 || ((op_head & OF_PTR_REGISTER) | 0x10) == move.pos2)) return false;
 
 		if (!op) continue;
 
-		if (op == move.pos1 || op < 8 && op + 12 == move.pos1) {
+		if (op == move.pos1 || (op < 8 && op + 12 == move.pos1)) {
 			if ((op_head & OF_TYPE) == OF_OUT) pos1_is_written = true;
 			if ((op_head & OF_TYPE) == OF_IN) pos1_is_read = true;
 			if ((op_head & OF_TYPE) == OF_IO) pos1_io = true;
@@ -140,7 +144,7 @@ bool update_down_state(std::vector<InstructionSetExtension>& extensions, std::sp
 			if (OP_IS_SIMD_REGISTER(move.pos2) && OP_SIMD_REGISTER(move.pos2) < 16 && (!(op_head & OF_SIMD_REGISTER) || !(op_head & OF_CAN_BE_LOW_SIMD))) return false;
 			if (OP_IS_SIMD_REGISTER(move.pos2) && OP_SIMD_REGISTER(move.pos2) > 15 && (!(op_head & OF_SIMD_REGISTER) || !(op_head & OF_CAN_BE_HIGH_SIMD))) return false;
 		}
-		if (op == move.pos2 || op < 8 && op + 12 == move.pos2) {
+		if (op == move.pos2 || (op < 8 && op + 12 == move.pos2)) {
 			if ((op_head & OF_TYPE) == OF_OUT) pos2_is_written = true;
 			if ((op_head & OF_TYPE) == OF_IN) pos2_is_read = true;
 			if ((op_head & OF_TYPE) == OF_IO) pos2_io = true;
@@ -183,15 +187,25 @@ bool update_down_state(std::vector<InstructionSetExtension>& extensions, std::sp
 	return true;
 }
 
-Change build_horizontal_change(std::span<Instruction> instructions, std::vector<InstructionSetExtension>& extensions, int index, unsigned long long pos1, unsigned long long pos2) {
+Change build_horizontal_change(InstructionBuffer& instructions, std::vector<InstructionSetExtension>& extensions, const DefUse& def_use, const LiveRanges& live_ranges, const ControlFlowGraph& cfg, int index, unsigned long long pos1, unsigned long long pos2) {
+	int size = (int)instructions.size();
+	// jumps only come in at the start of a block and leave at its end, so the affected instructions stay between them.
+	// the explicit swaps then run on every way into and out of them
+	int block_first = 0, block_end = size - 1;
+	if (!cfg.blocks.empty()) {
+		const BasicBlock& block = cfg.blocks[cfg_block_of(cfg, std::clamp(index, 0, size - 1))];
+		block_first = block.first;
+		block_end = std::binary_search(cfg.jumps.begin(), cfg.jumps.end(), block.last) ? block.last - 1 : block.last;
+		index = std::min(index, block_end + 1);
+	}
 	Change result_change {};
 	RegisterSwap& result = result_change.horizontal;
 	result = {
 		.type = REGISTER_SWAP,
-		.explicit_swap_at_start = 3, // 0 means no, 1 means mov pos1 -> pos2, 2 means mov pos2 -> pos1, 3 means swap
+		.explicit_swap_at_start = 3, // 0 means no, 1 means mov pos1 -> pos2, 2 means mov pos2 -> pos1, 3 means swap, 4 means nothing to move
 		.explicit_swap_at_end = 3,
-		.first_instruction_affected = 0,
-		.last_instruction_affected = (int)instructions.size()-1,
+		.first_instruction_affected = block_first,
+		.last_instruction_affected = block_end,
 		.pos1 = pos1,
 		.pos2 = pos2
 	};
@@ -201,9 +215,11 @@ Change build_horizontal_change(std::span<Instruction> instructions, std::vector<
 		.pos1 = pos1,
 		.pos2 = pos2
 	};
-	for (int i = index - 1; i != -1; i--) {
-		if (!move_swap_up_through(extensions, instructions[i], up_state)) {
-			result.first_instruction_affected = i + 1;
+	// only the instructions using either position change the state, the others are skipped
+	for (int i = index; ; ) {
+		i = std::max(def_use_previous(def_use, pos1, i), def_use_previous(def_use, pos2, i));
+		if (i < block_first || !move_swap_up_through(extensions, instructions[i], up_state)) {
+			result.first_instruction_affected = std::max(i + 1, block_first);
 			result.explicit_swap_at_start = (int)up_state.pos1_moves_to_pos2 + 2 * (int)up_state.pos2_moves_to_pos1;
 			break;
 		}
@@ -220,8 +236,11 @@ Change build_horizontal_change(std::span<Instruction> instructions, std::vector<
 		.pos1 = pos1,
 		.pos2 = pos2
 	};
-	for (int i = index; i != instructions.size(); i++) {
-		if (!update_down_state(extensions, instructions, i, down_state)) {
+	for (int i = index; ; i++) {
+		i = std::min({ def_use_next(def_use, pos1, i, size), def_use_next(def_use, pos2, i, size), block_end + 1 });
+		// same as update_down_state for the skipped instructions
+		if (down_state.pos1_must_be_dead && down_state.pos2_must_be_dead) down_state.change_pos_if_dead = i - 1;
+		if (i > block_end || !update_down_state(extensions, instructions, i, down_state)) {
 			result.explicit_swap_at_end = 3;
 			result.last_instruction_affected = down_state.change_pos_if_dead;
 			break;
@@ -232,6 +251,32 @@ Change build_horizontal_change(std::span<Instruction> instructions, std::vector<
 			break;
 		}
 	}
+	// a value that is dead where the explicit swap would go does not have to be moved
+	if (result.explicit_swap_at_start) {
+		USE_MASK alive = live_ranges_at(live_ranges, result.first_instruction_affected);
+		if (!(alive & USE_MASK_OF_POSITION(pos1))) result.explicit_swap_at_start &= ~1;
+		if (!(alive & USE_MASK_OF_POSITION(pos2))) result.explicit_swap_at_start &= ~2;
+		if (!result.explicit_swap_at_start) result.explicit_swap_at_start = 4;
+	}
+	if (result.explicit_swap_at_end) {
+		// after the change, pos1 holds what was in pos2 and the other way around
+		USE_MASK alive = live_ranges_at(live_ranges, result.last_instruction_affected + 1);
+		result.explicit_swap_at_end = (alive & USE_MASK_OF_POSITION(pos2) ? 1 : 0) + (alive & USE_MASK_OF_POSITION(pos1) ? 2 : 0);
+		if (!result.explicit_swap_at_end) result.explicit_swap_at_end = 4;
+	}
+	// nothing renamed, only swapping and swapping back
+	if (result.first_instruction_affected > result.last_instruction_affected) return { .type = 0 };
+	// jumps over the explicit swaps need a larger displacement, which may not fit
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int nr_insertions = change_insertions(result_change, insertions);
+	if (nr_insertions) for (int jump : cfg.jumps) {
+		const Instruction& instruction = instructions[jump];
+		auto& footprint = extensions[instruction.extension].instructions[instruction.index];
+		int operand = jump_displacement_operand(instruction, footprint);
+		if (operand < 0) continue;
+		long long target = relocated_target(insertions, nr_insertions, jump, jump + 1 + jump_displacement(instruction, footprint, operand), result.first_instruction_affected, result.last_instruction_affected);
+		if (!jump_reaches(instruction, footprint, position_after_insertions(insertions, nr_insertions, jump), target)) return { .type = 0 };
+	}
 	return result_change;
 }
 
@@ -252,11 +297,12 @@ void swap_registers(Instruction& instruction, unsigned long long pos1, unsigned
 		else if (OP_IS_REGISTER(op) && OP_REGISTER(op) == pos2_reg) op = pos1_reg | 0x10ull;
 		else if (OP_IS_MEMORY_LOCATION(op)) {
 			// memory location	00000000 00000000 01rrrrri iiiissss oooooooo oooooooo oooooooo oooooooo
-			if (OP_MEMORY_BASE_REGISTER(op) == pos1) op = op & ~0x00003e0000000000ull | (pos2 << 41);
-			else if (OP_MEMORY_BASE_REGISTER(op) == pos2) op = op & ~0x00003e0000000000ull | (pos1 << 41);
+			if (!(pos1 & 0x10ull)) continue; // high bytes can't be used in addresses
+			if (OP_MEMORY_BASE_REGISTER(op) == pos1_reg) op = (op & ~0x00003e0000000000ull) | (pos2_reg << 41);
+			else if (OP_MEMORY_BASE_REGISTER(op) == pos2_reg) op = (op & ~0x00003e0000000000ull) | (pos1_reg << 41);
 
-			if (OP_MEMORY_INDEX_REGISTER(op) == pos1) op = op & ~0x000001f000000000ull | (pos2 << 36);
-			else if (OP_MEMORY_INDEX_REGISTER(op) == pos2) op = op & 0x000001f000000000ull | (pos1 << 36);
+			if (OP_MEMORY_INDEX_REGISTER(op) == pos1_reg) op = (op & ~0x000001f000000000ull) | (pos2_reg << 36);
+			else if (OP_MEMORY_INDEX_REGISTER(op) == pos2_reg) op = (op & ~0x000001f000000000ull) | (pos1_reg << 36);
 		}
 	}
 }
@@ -277,192 +323,156 @@ void swap_out_registers(Instruction& instruction, InstructionFootprint& footprin
 		else if (OP_IS_REGISTER(op) && OP_REGISTER(op) == pos2_reg) op = pos1_reg | 0x10ull;
 		else if (OP_IS_MEMORY_LOCATION(op)) {
 			// memory location	00000000 00000000 01rrrrri iiiissss oooooooo oooooooo oooooooo oooooooo
-			if (OP_MEMORY_BASE_REGISTER(op) == pos1) op = op & ~0x00003e0000000000ull | (pos2 << 41);
-			else if (OP_MEMORY_BASE_REGISTER(op) == pos2) op = op & ~0x00003e0000000000ull | (pos1 << 41);
+			if (!(pos1 & 0x10ull)) continue; // high bytes can't be used in addresses
+			if (OP_MEMORY_BASE_REGISTER(op) == pos1_reg) op = (op & ~0x00003e0000000000ull) | (pos2_reg << 41);
+			else if (OP_MEMORY_BASE_REGISTER(op) == pos2_reg) op = (op & ~0x00003e0000000000ull) | (pos1_reg << 41);
 
-			if (OP_MEMORY_INDEX_REGISTER(op) == pos1) op = op & ~0x000001f000000000ull | (pos2 << 36);
-			else if (OP_MEMORY_INDEX_REGISTER(op) == pos2) op = op & 0x000001f000000000ull | (pos1 << 36);
+			if (OP_MEMORY_INDEX_REGISTER(op) == pos1_reg) op = (op & ~0x000001f000000000ull) | (pos2_reg << 36);
+			else if (OP_MEMORY_INDEX_REGISTER(op) == pos2_reg) op = (op & ~0x000001f000000000ull) | (pos1_reg << 36);
 		}
 	}
 }
 
-void apply_horizontal_change(std::vector<Instruction>& instructions, std::vector<InstructionSetExtension>& extensions, RegisterSwap& change) {
-	for (int i = change.first_instruction_affected; i <= change.last_instruction_affected; i++) swap_registers(instructions[i], change.pos1, change.pos2);
+// the instructions inserted for explicit_swap_at_start/_at_end, returns their number
+int explicit_swap_instructions(char explicit_swap, unsigned long long pos1, unsigned long long pos2, Instruction result[MAX_INSERTED_INSTRUCTIONS]) {
+	if (!explicit_swap || explicit_swap == 4) return 0;
+	if (pos1 < 0x20ull) {
+		if (explicit_swap == 1) result[0] = { 0,0,{pos1,pos2,0,0} };
+		else if (explicit_swap == 2) result[0] = { 0,0,{pos2,pos1,0,0} };
+		else result[0] = { 0,2,{pos1,pos2,0,0} };
+		return 1;
+	}
+	if (explicit_swap == 1) result[0] = { 0,3,{pos1,pos2,0,0} };
+	else if (explicit_swap == 2) result[0] = { 0,3,{pos2,pos1,0,0} };
+	else {
+		result[0] = { 0,8,{0x200000040ull,0x16ull,0,0} };
+		// SUB64 64 RSP
+		result[1] = { 0,4,{pos1,0x00004d0000000000ull,0,0} };
+		// MOVDQU pos1 -> *RSP
+		result[2] = { 0,3,{pos2, pos1,0,0} };
+		// MOVDQU pos2 -> pos1
+		result[3] = { 0,3,{0x00004d0000000000ull,pos2,0,0} };
+		// MOVDQU *RSP -> pos2
+		result[4] = { 0,6,{0x200000040ull,0x16ull,0,0} };
+		// ADD64 64 RSP
+		return 5;
+	}
+	return 1;
+}
+
+void swap_registers_at(InstructionBuffer& instructions, int index, unsigned long long pos1, unsigned long long pos2) {
+	Instruction swapped = instructions[index];
+	swap_registers(swapped, pos1, pos2);
+	if (!std::equal(swapped.operands, swapped.operands + 4, instructions[index].operands)) instructions.modify(index) = swapped;
+}
+
+// only the changes to existing instructions, the explicit swaps are inserted by apply_change
+void apply_horizontal_change(InstructionBuffer& instructions, std::vector<InstructionSetExtension>& extensions, RegisterSwap& change) {
+	for (int i = change.first_instruction_affected; i <= change.last_instruction_affected; i++) swap_registers_at(instructions, i, change.pos1, change.pos2);
 	if (!change.explicit_swap_at_end) {
-		Instruction& i = instructions[change.last_instruction_affected];
+		Instruction& i = instructions.modify(change.last_instruction_affected);
 		swap_out_registers(i, extensions[i.extension].instructions[i.index], change.pos1, change.pos2);
 	}
-	else if (change.pos1 < 0x20ull) {
-		if (change.explicit_swap_at_end == 1)
-			instructions.insert(instructions.cbegin() + change.last_instruction_affected + 1, { 0,0,{change.pos1,change.pos2,0,0} });
-		else if (change.explicit_swap_at_end == 2)
-			instructions.insert(instructions.cbegin() + change.last_instruction_affected + 1, { 0,0,{change.pos2,change.pos1,0,0} });
-		else instructions.insert(instructions.cbegin() + change.last_instruction_affected + 1, { 0,2,{change.pos1,change.pos2,0,0} });
-	}
-	else {
-		if (change.explicit_swap_at_end == 1)
-			instructions.insert(instructions.cbegin() + change.last_instruction_affected + 1, { 0,3,{change.pos1,change.pos2,0,0} });
-		else if (change.explicit_swap_at_end == 2)
-			instructions.insert(instructions.cbegin() + change.last_instruction_affected + 1, { 0,3,{change.pos2,change.pos1,0,0} });
-		else {
-			instructions.insert(instructions.cbegin() + change.last_instruction_affected + 1, { 0,8,{0x200000040ull,0x16ull,0,0} });
-			// SUB64 64 RSP
-			instructions.insert(instructions.cbegin() + change.last_instruction_affected + 2, { 0,4,{change.pos1,0x00004c0000000000ull,0,0} });
-			// MOVDQU pos1 -> *RSP
-			instructions.insert(instructions.cbegin() + change.last_instruction_affected + 3, { 0,3,{change.pos2, change.pos1,0,0} });
-			// MOVDQU pos2 -> pos1
-			instructions.insert(instructions.cbegin() + change.last_instruction_affected + 4, { 0,3,{0x00004c0000000000ull,change.pos2,0,0} });
-			// MOVDQU *RSP -> pos2
-			instructions.insert(instructions.cbegin() + change.last_instruction_affected + 5, { 0,6,{0x200000040ull,0x16ull,0,0} });
-			// ADD64 64 RSP
-		}
-	}
 	if (!change.explicit_swap_at_start) {
-		Instruction& i = instructions[change.first_instruction_affected];
+		Instruction& i = instructions.modify(change.first_instruction_affected);
 		swap_registers(i, change.pos1, change.pos2);
 		swap_out_registers(i, extensions[i.extension].instructions[i.index], change.pos1, change.pos2);
 	}
-	else if (change.pos1 < 0x20ull) {
-		if (change.explicit_swap_at_start == 1)
-			instructions.insert(instructions.cbegin() + change.first_instruction_affected, { 0,0,{change.pos1,change.pos2,0,0} });
-		else if (change.explicit_swap_at_start == 2)
-			instructions.insert(instructions.cbegin() + change.first_instruction_affected, { 0,0,{change.pos2,change.pos1,0,0} });
-		else instructions.insert(instructions.cbegin() + change.first_instruction_affected, { 0,2,{change.pos1,change.pos2,0,0} });
-	}
-	else {
-		if (change.explicit_swap_at_start == 1)
-			instructions.insert(instructions.cbegin() + change.first_instruction_affected, { 0,3,{change.pos1,change.pos2,0,0} });
-		else if (change.explicit_swap_at_start == 2)
-			instructions.insert(instructions.cbegin() + change.first_instruction_affected, { 0,3,{change.pos2,change.pos1,0,0} });
-		else {
-			instructions.insert(instructions.cbegin() + change.first_instruction_affected, { 0,8,{0x200000040ull,0x16ull,0,0} });
-			// SUB64 64 RSP
-			instructions.insert(instructions.cbegin() + change.first_instruction_affected + 1, { 0,4,{change.pos1,0x00004c0000000000ull,0,0} });
-			// MOVDQU pos1 -> *RSP
-			instructions.insert(instructions.cbegin() + change.first_instruction_affected + 2, { 0,3,{change.pos2, change.pos1,0,0} });
-			// MOVDQU pos2 -> pos1
-			instructions.insert(instructions.cbegin() + change.first_instruction_affected + 3, { 0,3,{0x00004c0000000000ull,change.pos2,0,0} });
-			// MOVDQU *RSP -> pos2
-			instructions.insert(instructions.cbegin() + change.first_instruction_affected + 4, { 0,6,{0x200000040ull,0x16ull,0,0} });
-			// ADD64 64 RSP
-		}
-	}
-
 }
-void undo_last_horizontal_change(std::vector<Instruction>& instructions, std::vector<InstructionSetExtension>& extensions, RegisterSwap& change) {
-
-	if (change.pos1 >= 0x20ull && change.explicit_swap_at_start == 3)
-		for (int i = 0;i != 4;i++) instructions.erase(instructions.cbegin() + change.first_instruction_affected);
-	if (change.explicit_swap_at_start) instructions.erase(instructions.cbegin() + change.first_instruction_affected);
-	else {
-		Instruction& i = instructions[change.first_instruction_affected];
+// called after undo_last_change removed the explicit swaps again
+void undo_last_horizontal_change(InstructionBuffer& instructions, std::vector<InstructionSetExtension>& extensions, RegisterSwap& change) {
+	if (!change.explicit_swap_at_start) {
+		Instruction& i = instructions.modify(change.first_instruction_affected);
 		swap_out_registers(i, extensions[i.extension].instructions[i.index], change.pos1, change.pos2);
 		swap_registers(i, change.pos1, change.pos2);
 	}
-
-	if (change.pos1 >= 0x20ull && change.explicit_swap_at_end == 3)
-		for (int i = 0;i != 4;i++) instructions.erase(instructions.cbegin() + change.last_instruction_affected + 1);
-	if (change.explicit_swap_at_end) instructions.erase(instructions.cbegin() + change.last_instruction_affected + 1);
-	else {
-		Instruction& i = instructions[change.first_instruction_affected];
+	if (!change.explicit_swap_at_end) {
+		Instruction& i = instructions.modify(change.last_instruction_affected);
 		swap_out_registers(i, extensions[i.extension].instructions[i.index], change.pos1, change.pos2);
 	}
-	for (int i = change.first_instruction_affected; i <= change.last_instruction_affected; i++) swap_registers(instructions[i], change.pos1, change.pos2);
+	for (int i = change.first_instruction_affected; i <= change.last_instruction_affected; i++) swap_registers_at(instructions, i, change.pos1, change.pos2);
 }
-unsigned long long read_places(InstructionFootprint& footprint, Instruction& instruction) {
-	unsigned long long result = footprint.always_read_flags | (unsigned long long(footprint.always_read_registers) << 16);
-	for (int i = 0; i != 4; i++) if (footprint.operands[i].head) {
-		if ((footprint.operands[i].head & OF_TYPE) == OF_DEREF) {
-			result |= 1ull << ((footprint.operands[i].head & OF_PTR_REGISTER) + 16);
-			if ((footprint.operands[i].head & OF_DEREF_TYPE) != OF_OUT_DEREF) result |= 1 << 8;
-		}
-		if (OP_IS_REGISTER(instruction.operands[i]) && (footprint.operands[i].head & OF_TYPE) != OF_OUT)
-			result |= 1ull << (OP_REGISTER(instruction.operands[i]) + 16);
-		else if (OP_IS_HIGH_BYTE(instruction.operands[i]) && (footprint.operands[i].head & OF_TYPE) != OF_OUT)
-			result |= 1ull << (OP_HIGH_BYTE(instruction.operands[i]) + 16);
-		else if (OP_IS_SIMD_REGISTER(instruction.operands[i]) && (footprint.operands[i].head & OF_TYPE) != OF_OUT)
-			result |= 1ull << (OP_SIMD_REGISTER(instruction.operands[i]) + 32);
-		else if (OP_IS_RIP_RELATIVE(instruction.operands[i]) && (footprint.operands[i].head & OF_TYPE) != OF_OUT)
-			result |= 1 << 8;
-		else if (OP_IS_MEMORY_LOCATION(instruction.operands[i])) {
-			if (OP_MEMORY_BASE_REGISTER(instruction.operands[i]) < 16) result |= 1ull << (OP_MEMORY_BASE_REGISTER(instruction.operands[i]) + 16);
-			if (OP_MEMORY_INDEX_REGISTER(instruction.operands[i]) < 16) result |= 1ull << (OP_MEMORY_INDEX_REGISTER(instruction.operands[i]) + 16);
-			if ((footprint.operands[i].head & OF_TYPE) != OF_OUT) result |= 1 << 8;
-		}
-	}
-	return result;
+bool can_swap_instructions(const PlaceMasks& masks, int instruction_1, int instruction_2) {
+	return !((masks.read[instruction_1] | masks.written[instruction_1]) & masks.written[instruction_2])
+		&& !(masks.read[instruction_2] & masks.written[instruction_1]);
 }
-unsigned long long written_places(InstructionFootprint& footprint, Instruction& instruction) {
-	unsigned long long result = footprint.always_read_flags | (unsigned long long(footprint.always_read_registers) << 16);
-	for (int i = 0; i != 4; i++) if (footprint.operands[i].head && (footprint.operands[i].head & OF_TYPE) != OF_IN) {
-		if ((footprint.operands[i].head & OF_TYPE) == OF_DEREF && (footprint.operands[i].head & OF_DEREF_TYPE) != OF_IN_DEREF) result |= 1 << 8;
-		else if (OP_IS_REGISTER(instruction.operands[i])) result |= 1ull << (OP_REGISTER(instruction.operands[i]) + 16);
-		else if (OP_IS_HIGH_BYTE(instruction.operands[i])) result |= 1ull << (OP_HIGH_BYTE(instruction.operands[i]) + 16);
-		else if (OP_IS_SIMD_REGISTER(instruction.operands[i])) result |= 1ull << (OP_SIMD_REGISTER(instruction.operands[i]) + 32);
-		else if (OP_IS_RIP_RELATIVE(instruction.operands[i])) result |= 1 << 8;
-		else if (OP_IS_MEMORY_LOCATION(instruction.operands[i])) result |= 1 << 8;
-	}
-	return result;
-}
-bool can_swap_instructions(std::vector<InstructionSetExtension>& extensions, Instruction& instruction_1, Instruction& instruction_2) {
-	auto& footprint_1 = extensions[instruction_1.extension].instructions[instruction_1.index];
-	auto& footprint_2 = extensions[instruction_2.extension].instructions[instruction_2.index];
-
-	if (footprint_1.jump_type || footprint_2.jump_type) return false;
-	if ((read_places(footprint_1, instruction_1) & written_places(footprint_2, instruction_2)) ||
-		(read_places(footprint_2, instruction_2) & written_places(footprint_1, instruction_1))) return false;
-	return true;
-}
-Change build_vertical_change(std::span<Instruction> instructions, std::vector<InstructionSetExtension>& extensions, int instruction, int number_places_down) {
+Change build_vertical_change(const PlaceMasks& masks, const LiveRanges& live_ranges, const ControlFlowGraph& cfg, int instruction, int number_places_down) {
 	Change result_change{};
 	InstructionReorder& result = result_change.vertical;
 	result.type = INSTRUCTION_REORDER;
 	result.instruction = instruction;
+	// jumps can come in at the start of the block, so nothing leaves it
+	auto& block = cfg.blocks[cfg_block_of(cfg, instruction)];
+	number_places_down = std::clamp(number_places_down, block.first - instruction, block.last - instruction);
 	result.number_places_down = number_places_down;
+	// the moving instruction stops right before the first one it cannot be swapped with
+	unsigned long long read = masks.read[instruction], written = masks.written[instruction];
+	// dead in every gap of the range means none of the instructions in it reads the place,
+	// so only the order of the writes to it changes and what is left in it afterwards is never read
+	int first_gap = std::min(instruction, instruction + number_places_down), last_gap = std::max(instruction, instruction + number_places_down) + 1;
+	written &= ~places_of_use_mask(use_mask_of_places(written) & ~live_ranges_alive_anywhere(live_ranges, first_gap, last_gap, use_mask_of_places(written)));
 	if (number_places_down >= 0) {
-		for (int i = 0; i != number_places_down; i++) {
-			if (!can_swap_instructions(extensions, instructions[instruction], instructions[instruction + i + 1])) {
-				result.number_places_down = i;
-				break;
-			}
-		}
+		int conflict = first_conflict(masks, instruction + 1, instruction + number_places_down + 1, read, written);
+		if (conflict <= instruction + number_places_down) result.number_places_down = conflict - instruction - 1;
 	}
 	else {
-		for (int i = 0; i != number_places_down; i--) {
-			if (!can_swap_instructions(extensions, instructions[instruction], instructions[instruction + i - 1])) {
-				result.number_places_down = i;
-				break;
-			}
-		}
+		int conflict = last_conflict(masks, instruction + number_places_down, instruction, read, written);
+		if (conflict >= instruction + number_places_down) result.number_places_down = conflict - instruction + 1;
 	}
 	return result_change;
 }
-void apply_vertical_change(std::vector<Instruction>& instructions, std::vector<InstructionSetExtension>& extensions, InstructionReorder& change) {
+void apply_vertical_change(InstructionBuffer& instructions, std::vector<InstructionSetExtension>& extensions, InstructionReorder& change) {
 	if (change.number_places_down >= 0) {
-		std::rotate(instructions.begin() + change.instruction, instructions.begin() + change.instruction + 1, instructions.begin() + change.instruction + change.number_places_down + 1);
+		instructions.rotate(change.instruction, change.instruction + 1, change.instruction + change.number_places_down + 1);
 	}
 	else {
-		std::rotate(instructions.begin() + change.instruction + change.number_places_down, instructions.begin() + change.instruction, instructions.begin() + change.instruction + 1);
+		instructions.rotate(change.instruction + change.number_places_down, change.instruction, change.instruction + 1);
 	}
 }
-void undo_last_vertical_change(std::vector<Instruction>& instructions, std::vector<InstructionSetExtension>& extensions, InstructionReorder& change) {
+void undo_last_vertical_change(InstructionBuffer& instructions, std::vector<InstructionSetExtension>& extensions, InstructionReorder& change) {
 	if (change.number_places_down >= 0) {
-		std::rotate(instructions.begin() + change.instruction, instructions.begin() + change.instruction + change.number_places_down, instructions.begin() + change.instruction + change.number_places_down + 1);
+		instructions.rotate(change.instruction, change.instruction + change.number_places_down, change.instruction + change.number_places_down + 1);
 	}
 	else {
-		std::rotate(instructions.begin() + change.instruction + change.number_places_down, instructions.begin() + change.instruction + change.number_places_down + 1, instructions.begin() + change.instruction + 1);
+		instructions.rotate(change.instruction + change.number_places_down, change.instruction + change.number_places_down + 1, change.instruction + 1);
 	}
 }
 
 
-void apply_change(std::vector<Instruction>& instructions, std::vector<InstructionSetExtension>& extensions, Change* change) {
+int change_insertions(const Change& change, InstructionInsertion result[MAX_INSERTIONS_PER_CHANGE]) {
+	int count = 0;
+	if (change.type == REGISTER_SWAP) {
+		auto& swap = change.horizontal;
+		result[count].position = swap.first_instruction_affected;
+		result[count].count = explicit_swap_instructions(swap.explicit_swap_at_start, swap.pos1, swap.pos2, result[count].instructions);
+		if (result[count].count) count++;
+		result[count].position = swap.last_instruction_affected + 1;
+		result[count].count = explicit_swap_instructions(swap.explicit_swap_at_end, swap.pos1, swap.pos2, result[count].instructions);
+		if (result[count].count) count++;
+	}
+	return count;
+}
+
+void apply_change(InstructionBuffer& instructions, std::vector<InstructionSetExtension>& extensions, Change* change) {
 	switch (change->type) {
 	case REGISTER_SWAP: apply_horizontal_change(instructions, extensions, change->horizontal); break;
 	case INSTRUCTION_REORDER: apply_vertical_change(instructions, extensions, change->vertical); break;
 	default: assert(false);
 	}
+	// from the back, so the positions of the earlier insertions stay valid
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	for (int i = change_insertions(*change, insertions); i--; )
+		instructions.insert(insertions[i].position, std::span<const Instruction>(insertions[i].instructions, insertions[i].count));
 }
-void undo_last_change(std::vector<Instruction>& instructions, std::vector<InstructionSetExtension>& extensions, Change* change) {
+void undo_last_change(InstructionBuffer& instructions, std::vector<InstructionSetExtension>& extensions, Change* change) {
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int nr_insertions = change_insertions(*change, insertions);
+	int inserted_before = 0;
+	for (int i = 0; i != nr_insertions; i++) inserted_before += insertions[i].count;
+	for (int i = nr_insertions; i--; ) {
+		inserted_before -= insertions[i].count;
+		instructions.erase(insertions[i].position + inserted_before, insertions[i].count);
+	}
 	switch (change->type) {
 	case REGISTER_SWAP: undo_last_horizontal_change(instructions, extensions, change->horizontal); break;
 	case INSTRUCTION_REORDER: undo_last_vertical_change(instructions, extensions, change->vertical); break;
@@ -470,8 +480,224 @@ void undo_last_change(std::vector<Instruction>& instructions, std::vector<Instru
 	}
 }
 
+int instructions_inserted(const Change& change) {
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int result = 0;
+	for (int i = change_insertions(change, insertions); i--; ) result += insertions[i].count;
+	return result;
+}
+int first_instruction_touched(const Change& change) {
+	switch (change.type) {
+	case REGISTER_SWAP: return change.horizontal.first_instruction_affected;
+	case INSTRUCTION_REORDER: return std::min(change.vertical.instruction, change.vertical.instruction + change.vertical.number_places_down);
+	default: assert(false); return 0;
+	}
+}
+int last_instruction_touched(const Change& change) {
+	switch (change.type) {
+	case REGISTER_SWAP: return change.horizontal.last_instruction_affected + instructions_inserted(change);
+	case INSTRUCTION_REORDER: return std::max(change.vertical.instruction, change.vertical.instruction + change.vertical.number_places_down);
+	default: assert(false); return 0;
+	}
+}
 
 
 
 
-// walk upwards from <index>, keeping track which of the two values are still alive
\ No newline at end of file
+
+// walk upwards from <index>, keeping track which of the two values are still alive
+void place_masks_apply_change(PlaceMasks& masks, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const Change& change) {
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int nr_insertions = change_insertions(change, insertions);
+	for (int i = 0, inserted_before = 0; i != nr_insertions; i++) {
+		place_masks_insert(masks, extensions, insertions[i].position + inserted_before, std::span<const Instruction>(insertions[i].instructions, insertions[i].count));
+		inserted_before += insertions[i].count;
+	}
+	if (change.type == REGISTER_SWAP) {
+		int shift = (nr_insertions && insertions[0].position == change.horizontal.first_instruction_affected) ? insertions[0].count : 0;
+		place_masks_update(masks, instructions, extensions, change.horizontal.first_instruction_affected + shift, change.horizontal.last_instruction_affected + shift);
+	}
+	if (change.type == INSTRUCTION_REORDER) {
+		auto& reorder = change.vertical;
+		if (reorder.number_places_down >= 0) place_masks_rotate(masks, reorder.instruction, reorder.instruction + 1, reorder.instruction + reorder.number_places_down + 1);
+		else place_masks_rotate(masks, reorder.instruction + reorder.number_places_down, reorder.instruction, reorder.instruction + 1);
+	}
+}
+void def_use_apply_change(DefUse& def_use, const PlaceMasks& masks, const Change& change) {
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int nr_insertions = change_insertions(change, insertions);
+	for (int i = 0, inserted_before = 0; i != nr_insertions; i++) {
+		def_use_insert(def_use, masks, insertions[i].position + inserted_before, insertions[i].count);
+		inserted_before += insertions[i].count;
+	}
+	if (change.type == REGISTER_SWAP) {
+		int shift = (nr_insertions && insertions[0].position == change.horizontal.first_instruction_affected) ? insertions[0].count : 0;
+		def_use_update(def_use, masks, change.horizontal.first_instruction_affected + shift, change.horizontal.last_instruction_affected + shift);
+	}
+	if (change.type == INSTRUCTION_REORDER) {
+		auto& reorder = change.vertical;
+		if (reorder.number_places_down >= 0) def_use_rotate(def_use, reorder.instruction, reorder.instruction + 1, reorder.instruction + reorder.number_places_down + 1);
+		else def_use_rotate(def_use, reorder.instruction + reorder.number_places_down, reorder.instruction, reorder.instruction + 1);
+	}
+}
+void place_masks_undo_change(PlaceMasks& masks, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const Change& change) {
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int nr_insertions = change_insertions(change, insertions);
+	int inserted_before = 0;
+	for (int i = 0; i != nr_insertions; i++) inserted_before += insertions[i].count;
+	for (int i = nr_insertions; i--; ) {
+		inserted_before -= insertions[i].count;
+		place_masks_erase(masks, insertions[i].position + inserted_before, insertions[i].count);
+	}
+	if (change.type == REGISTER_SWAP)
+		place_masks_update(masks, instructions, extensions, change.horizontal.first_instruction_affected, change.horizontal.last_instruction_affected);
+	if (change.type == INSTRUCTION_REORDER) {
+		auto& reorder = change.vertical;
+		if (reorder.number_places_down >= 0) place_masks_rotate(masks, reorder.instruction, reorder.instruction + reorder.number_places_down, reorder.instruction + reorder.number_places_down + 1);
+		else place_masks_rotate(masks, reorder.instruction + reorder.number_places_down, reorder.instruction + reorder.number_places_down + 1, reorder.instruction + 1);
+	}
+}
+void def_use_undo_change(DefUse& def_use, const PlaceMasks& masks, const Change& change) {
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int nr_insertions = change_insertions(change, insertions);
+	int inserted_before = 0;
+	for (int i = 0; i != nr_insertions; i++) inserted_before += insertions[i].count;
+	for (int i = nr_insertions; i--; ) {
+		inserted_before -= insertions[i].count;
+		def_use_erase(def_use, insertions[i].position + inserted_before, insertions[i].count);
+	}
+	if (change.type == REGISTER_SWAP)
+		def_use_update(def_use, masks, change.horizontal.first_instruction_affected, change.horizontal.last_instruction_affected);
+	if (change.type == INSTRUCTION_REORDER) {
+		auto& reorder = change.vertical;
+		if (reorder.number_places_down >= 0) def_use_rotate(def_use, reorder.instruction, reorder.instruction + reorder.number_places_down, reorder.instruction + reorder.number_places_down + 1);
+		else def_use_rotate(def_use, reorder.instruction + reorder.number_places_down, reorder.instruction + reorder.number_places_down + 1, reorder.instruction + 1);
+	}
+}
+void liveness_apply_change(LivenessSolution& solution, LiveRanges& live_ranges, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const ControlFlowGraph& cfg, const Change& change) {
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int nr_insertions = change_insertions(change, insertions);
+	for (int i = 0, inserted_before = 0; i != nr_insertions; i++) {
+		live_ranges_insert(live_ranges, insertions[i].position + inserted_before, insertions[i].count);
+		inserted_before += insertions[i].count;
+	}
+	std::vector<int> changed_blocks{};
+	liveness_solve(solution, cfg, instructions, extensions, first_instruction_touched(change), last_instruction_touched(change), changed_blocks);
+	live_ranges_update(live_ranges, instructions, extensions, cfg, solution, changed_blocks);
+}
+void liveness_undo_change(LivenessSolution& solution, LiveRanges& live_ranges, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const ControlFlowGraph& cfg, const Change& change) {
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int nr_insertions = change_insertions(change, insertions);
+	int inserted_before = 0;
+	for (int i = 0; i != nr_insertions; i++) inserted_before += insertions[i].count;
+	for (int i = nr_insertions; i--; ) {
+		inserted_before -= insertions[i].count;
+		live_ranges_erase(live_ranges, insertions[i].position + inserted_before, insertions[i].count);
+	}
+	std::vector<int> changed_blocks{};
+	liveness_solve(solution, cfg, instructions, extensions, first_instruction_touched(change), last_instruction_touched(change) - instructions_inserted(change), changed_blocks);
+	live_ranges_update(live_ranges, instructions, extensions, cfg, solution, changed_blocks);
+}
+// position after the insertions of an instruction at <position> before them
+int position_after_insertions(const InstructionInsertion* insertions, int nr_insertions, long long position) {
+	long long result = position;
+	for (int i = 0; i != nr_insertions; i++) if (insertions[i].position <= position) result += insertions[i].count;
+	return int(result);
+}
+int position_before_insertions(const InstructionInsertion* insertions, int nr_insertions, long long position) {
+	long long result = position;
+	for (int i = 0, inserted_before = 0; i != nr_insertions; i++) {
+		if (insertions[i].position + inserted_before + insertions[i].count <= position) result -= insertions[i].count;
+		inserted_before += insertions[i].count;
+	}
+	return int(result);
+}
+// target after the insertions of a jump from <source> to <target> before them. the insertions in front of the target are
+// jumped over, the ones at the target only if the jump doesn't enter or leave [first, last] through them
+long long relocated_target(const InstructionInsertion* insertions, int nr_insertions, long long source, long long target, int first, int last) {
+	bool inside = first <= source && source <= last;
+	long long result = target;
+	for (int i = 0; i != nr_insertions; i++) {
+		bool enters = first <= last && (insertions[i].position == first ? !inside : insertions[i].position == last + 1 && inside);
+		if (insertions[i].position < target || (insertions[i].position == target && !enters)) result += insertions[i].count;
+	}
+	return result;
+}
+// relative jumps count their displacement in instructions, so jumping over inserted instructions
+// needs a larger displacement to keep reaching the same instruction. cfg.jumps are the positions after <inserted>
+void relocate_jumps(const ControlFlowGraph& cfg, InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const InstructionInsertion* insertions, int nr_insertions, bool inserted, int first, int last) {
+	for (int jump : cfg.jumps) {
+		const Instruction& instruction = instructions[jump];
+		auto& footprint = extensions[instruction.extension].instructions[instruction.index];
+		int operand = jump_displacement_operand(instruction, footprint);
+		if (operand < 0) continue;
+		long long displacement = jump_displacement(instruction, footprint, operand);
+		long long source = inserted ? position_before_insertions(insertions, nr_insertions, jump) : 0;
+		// a jump onto inserted instructions goes to their position when they are removed again
+		long long target = inserted
+			? relocated_target(insertions, nr_insertions, source, source + 1 + displacement, first, last)
+			: position_before_insertions(insertions, nr_insertions, position_after_insertions(insertions, nr_insertions, jump) + 1 + displacement);
+		// build_horizontal_change only makes changes whose jumps still reach
+		if (target != jump + 1 + displacement && !jump_set_target(instructions.modify(jump), footprint, jump, target)) assert(false);
+	}
+}
+void relocate_jumps(const ControlFlowGraph& cfg, InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, std::span<const int> positions, bool inserted) {
+	if (positions.empty()) return;
+	for (int jump : cfg.jumps) {
+		const Instruction& instruction = instructions[jump];
+		auto& footprint = extensions[instruction.extension].instructions[instruction.index];
+		int operand = jump_displacement_operand(instruction, footprint);
+		if (operand < 0) continue;
+		long long displacement = jump_displacement(instruction, footprint, operand);
+		long long target;
+		if (inserted) {
+			long long before = jump - (std::lower_bound(positions.begin(), positions.end(), jump) - positions.begin()) + 1 + displacement;
+			target = before + inserted_in_front(positions, before);
+		}
+		else {
+			long long before = jump + inserted_in_front(positions, jump) + 1 + displacement;
+			target = before - (std::lower_bound(positions.begin(), positions.end(), before) - positions.begin());
+		}
+		// removing moves only shortens jumps, and inserting them again gives back the displacement they had
+		if (target != jump + 1 + displacement && !jump_set_target(instructions.modify(jump), footprint, jump, target)) assert(false);
+	}
+}
+// jumps never move: they conflict with everything, so a reorder only shifts them around inserted instructions
+void cfg_apply_change(ControlFlowGraph& cfg, InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const PlaceMasks& masks, const Change& change) {
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int nr_insertions = change_insertions(change, insertions);
+	if (!nr_insertions) return;
+	// the explicit swaps of a register swap are entered from outside the instructions it renames, and left from inside them.
+	// so they join the block of these if they end before its jump, as build_horizontal_change makes them
+	int first = change.horizontal.first_instruction_affected, last = change.horizontal.last_instruction_affected;
+	int block = cfg.blocks.empty() ? -1 : cfg_block_of(cfg, first);
+	bool same_block = block >= 0 && first <= last
+		&& (last < cfg.blocks[block].last || (last == cfg.blocks[block].last && cfg.blocks[block].successors[1] == CFG_NO_SUCCESSOR));
+	size_t nr_jumps = cfg.jumps.size();
+	int inserted = 0;
+	for (int i = 0; i != nr_insertions; i++) {
+		cfg_insert(cfg, masks, insertions[i].position + inserted, insertions[i].count);
+		inserted += insertions[i].count;
+	}
+	relocate_jumps(cfg, instructions, extensions, insertions, nr_insertions, true, first, last);
+	if (same_block && cfg.jumps.size() == nr_jumps) cfg_resize_block(cfg, block, inserted);
+	else cfg_build_blocks(cfg, instructions, extensions);
+}
+void cfg_undo_change(ControlFlowGraph& cfg, InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const Change& change) {
+	InstructionInsertion insertions[MAX_INSERTIONS_PER_CHANGE];
+	int nr_insertions = change_insertions(change, insertions);
+	if (!nr_insertions) return;
+	int inserted = 0;
+	for (int i = 0; i != nr_insertions; i++) inserted += insertions[i].count;
+	int block = cfg.blocks.empty() ? -1 : cfg_block_of(cfg, insertions[0].position);
+	bool same_block = block >= 0 && change.horizontal.first_instruction_affected <= change.horizontal.last_instruction_affected
+		&& insertions[nr_insertions - 1].position + inserted - 1 <= cfg.blocks[block].last;
+	size_t nr_jumps = cfg.jumps.size();
+	for (int i = nr_insertions, inserted_before = inserted; i--; ) {
+		inserted_before -= insertions[i].count;
+		cfg_erase(cfg, insertions[i].position + inserted_before, insertions[i].count);
+	}
+	relocate_jumps(cfg, instructions, extensions, insertions, nr_insertions, false);
+	if (same_block && cfg.jumps.size() == nr_jumps) cfg_resize_block(cfg, block, -inserted);
+	else cfg_build_blocks(cfg, instructions, extensions);
+}
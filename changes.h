@@ -1,12 +1,18 @@
 #pragma once
 #include <span>
 #include "instructions.h"
+#include "instruction_buffer.h"
+#include "place_masks.h"
+#include "def_use.h"
+#include "liveness.h"
+#include "control_flow.h"
 
 #define REGISTER_SWAP 1
 #define INSTRUCTION_REORDER 2
+#define MOVE_ELIMINATION 3
 struct RegisterSwap {
 	char type; // REGISTER_SWAP
-	char explicit_swap_at_start; // 0 means no, 1 means mov pos1 -> pos2, 2 means mov pos2 -> pos1, 3 means swap
+	char explicit_swap_at_start; // 0 means no, 1 means mov pos1 -> pos2, 2 means mov pos2 -> pos1, 3 means swap, 4 means nothing to move
 	char explicit_swap_at_end;
 	int first_instruction_affected;
 	int last_instruction_affected;
@@ -18,24 +24,97 @@ struct InstructionReorder {
 	int instruction;
 	int number_places_down;
 };
+// the steps are MainState::elimination_steps[first_step, first_step + nr_steps), the change log stores them with it.
+// so it can only be applied and undone by main_state_apply_change/main_state_undo_last_change
+struct MoveElimination {
+	char type; // MOVE_ELIMINATION
+	int first_step;
+	int nr_steps;
+};
+// applied in order and undone in reverse, positions are the ones when the step is applied
+#define ELIMINATION_REMOVE 0 // erases the instruction at first, a copy of it is kept in removed
+#define ELIMINATION_RENAME 1 // swap_registers(pos1, pos2) on [first, last]
+struct EliminationStep {
+	int kind;
+	int first;
+	int last;
+	unsigned long long pos1;
+	unsigned long long pos2;
+	Instruction removed;
+};
 
 
 union Change {
 	char type;
 	RegisterSwap horizontal;
 	InstructionReorder vertical;
+	MoveElimination elimination;
 };
 
-Change build_horizontal_change(std::span<Instruction> instructions, std::vector<InstructionSetExtension>& extensions, int index, unsigned long long pos1, unsigned long long pos2);
+Change build_horizontal_change(InstructionBuffer& instructions, std::vector<InstructionSetExtension>& extensions, const DefUse& def_use, const LiveRanges& live_ranges, const ControlFlowGraph& cfg, int index, unsigned long long pos1, unsigned long long pos2);
+// the affected instructions stay in the basic block of <index>, without the jump ending it
 // pos1, pos2: 0b001xxxxx SIMD, 0b0001rrrr Normal register
 // currently only supports normal registers and xmm registers, can't combine them, obviously
 // index: number of instructions before the point where two swap instructions are inserted
 
-Change build_vertical_change(std::span<Instruction> instructions, std::vector<InstructionSetExtension>& extensions, int instruction, int number_places_down);
+void swap_registers(Instruction& instruction, unsigned long long pos1, unsigned long long pos2);
+// the same on instructions[index], which is only modified if it uses one of them, so a chunk shared with a snapshot stays shared
+void swap_registers_at(InstructionBuffer& instructions, int index, unsigned long long pos1, unsigned long long pos2);
+// whether swap_registers keeps <instruction> valid and does not miss an implicit use, the checks build_horizontal_change makes
+bool can_swap_registers(const std::vector<InstructionSetExtension>& extensions, const Instruction& instruction, unsigned long long pos1, unsigned long long pos2);
+
+bool can_swap_instructions(const PlaceMasks& masks, int instruction_1, int instruction_2);
+// the instruction stays inside its basic block. writing a place no gap it moves through needs is no conflict,
+// the value that ends up in it is never read
+Change build_vertical_change(const PlaceMasks& masks, const LiveRanges& live_ranges, const ControlFlowGraph& cfg, int instruction, int number_places_down);
 
 // void horizontal_change(std::vector<Instruction>& instructions, int instruction, int operand, int new_register);
 
-void apply_change(std::vector<Instruction>& instructions, std::vector<InstructionSetExtension>& extensions, Change* change);
-void undo_last_change(std::vector<Instruction>& instructions, std::vector<InstructionSetExtension>& extensions, Change* change);
+// instructions a change inserts, position is the index in the instructions before the change.
+// apply_change inserts them after modifying the existing instructions, undo_last_change removes them first.
+#define MAX_INSERTED_INSTRUCTIONS 5
+#define MAX_INSERTIONS_PER_CHANGE 2
+struct InstructionInsertion {
+	int position;
+	int count;
+	Instruction instructions[MAX_INSERTED_INSTRUCTIONS];
+};
+// the instructions inserted for RegisterSwap::explicit_swap_at_start/_at_end, returns their number
+int explicit_swap_instructions(char explicit_swap, unsigned long long pos1, unsigned long long pos2, Instruction result[MAX_INSERTED_INSTRUCTIONS]);
+// fills result in ascending order of position, returns the number of insertions
+int change_insertions(const Change& change, InstructionInsertion result[MAX_INSERTIONS_PER_CHANGE]);
+
+void apply_change(InstructionBuffer& instructions, std::vector<InstructionSetExtension>& extensions, Change* change);
+void undo_last_change(InstructionBuffer& instructions, std::vector<InstructionSetExtension>& extensions, Change* change);
+
+// number of instructions apply_change inserts (and undo_last_change removes again)
+int instructions_inserted(const Change& change);
+// lowest instruction index touched by apply_change, the same before and after it
+int first_instruction_touched(const Change& change);
+// highest instruction index touched by apply_change, counted after applying it.
+// all instructions below it are the same before and after the change.
+int last_instruction_touched(const Change& change);
+
 
 
+// keep the PlaceMasks in sync, called after apply_change/undo_last_change
+void place_masks_apply_change(PlaceMasks& masks, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const Change& change);
+void place_masks_undo_change(PlaceMasks& masks, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const Change& change);
+// same for the DefUse, called after the PlaceMasks are up to date
+void def_use_apply_change(DefUse& def_use, const PlaceMasks& masks, const Change& change);
+void def_use_undo_change(DefUse& def_use, const PlaceMasks& masks, const Change& change);
+// and for the LivenessSolution and LiveRanges, after the ControlFlowGraph
+void liveness_apply_change(LivenessSolution& solution, LiveRanges& live_ranges, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const ControlFlowGraph& cfg, const Change& change);
+void liveness_undo_change(LivenessSolution& solution, LiveRanges& live_ranges, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const ControlFlowGraph& cfg, const Change& change);
+// and for the ControlFlowGraph, after the PlaceMasks. relative jumps over inserted instructions get their displacement adjusted
+void cfg_apply_change(ControlFlowGraph& cfg, InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const PlaceMasks& masks, const Change& change);
+void cfg_undo_change(ControlFlowGraph& cfg, InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const Change& change);
+// position after the insertions of an instruction at <position> before them
+int position_after_insertions(const InstructionInsertion* insertions, int nr_insertions, long long position);
+// target after the insertions of a jump from <source> to <target> before them, see relocate_jumps
+long long relocated_target(const InstructionInsertion* insertions, int nr_insertions, long long source, long long target, int first, int last);
+// keeps relative jumps on the same instruction after <insertions> were inserted, or removed again if not <inserted>.
+// jumps into [first, last] from outside land on the insertion at first, the ones out of it from inside on the one at last+1
+void relocate_jumps(const ControlFlowGraph& cfg, InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const InstructionInsertion* insertions, int nr_insertions, bool inserted, int first = 0, int last = -1);
+// the same for single instructions at sorted <positions>, counted with them. none of them is a jump target
+void relocate_jumps(const ControlFlowGraph& cfg, InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, std::span<const int> positions, bool inserted);
@@ -0,0 +1,178 @@
+#include "control_flow.h"
+#include <algorithm>
+
+// calls push the return address, and come back to the next instruction
+bool jump_is_call(const InstructionFootprint& footprint) {
+	for (int i = 0; i != 4; i++) if ((footprint.operands[i].head & OF_DEREF_TYPE) == OF_OUT_DEREF) return true;
+	return false;
+}
+// returns pop where they go from the stack. the extension files give them the conditional jump types 5 and 6,
+// but nothing comes after them
+bool jump_is_return(const InstructionFootprint& footprint) {
+	for (int i = 0; i != 4; i++) if ((footprint.operands[i].head & OF_DEREF_TYPE) == OF_IN_DEREF) return true;
+	return false;
+}
+bool jump_falls_through(const InstructionFootprint& footprint) {
+	return (footprint.jump_type >= CONDITIONAL_RELATIVE && !jump_is_return(footprint)) || jump_is_call(footprint);
+}
+
+int jump_displacement_operand(const Instruction& instruction, const InstructionFootprint& footprint) {
+	if (footprint.jump_type != UNCONDITIONAL_RELATIVE && footprint.jump_type != CONDITIONAL_RELATIVE) return -1;
+	for (int i = 0; i != 4; i++) if (OP_IS_IMMEDIATE(instruction.operands[i])) return i;
+	return -1;
+}
+long long jump_displacement(const Instruction& instruction, const InstructionFootprint& footprint, int operand) {
+	long long displacement = OP_IMMEDIATE(instruction.operands[operand]);
+	switch (footprint.operands[operand].head & OF_IMMEDIATE_SIZE) {
+	case 1: return (signed char)displacement;
+	case 2: return (short)displacement;
+	default: return (int)displacement;
+	}
+}
+int jump_target(const Instruction& instruction, const InstructionFootprint& footprint, int index, int instruction_count) {
+	int operand = jump_displacement_operand(instruction, footprint);
+	if (operand < 0) return CFG_EXIT;
+	long long target = index + 1 + jump_displacement(instruction, footprint, operand);
+	return (target < 0 || target >= instruction_count) ? CFG_EXIT : int(target);
+}
+bool jump_reaches(const Instruction& instruction, const InstructionFootprint& footprint, int index, long long target) {
+	int operand = jump_displacement_operand(instruction, footprint);
+	if (operand < 0) return true;
+	long long displacement = target - index - 1;
+	switch (footprint.operands[operand].head & OF_IMMEDIATE_SIZE) {
+	case 1: return displacement == (signed char)displacement;
+	case 2: return displacement == (short)displacement;
+	default: return displacement == (int)displacement;
+	}
+}
+bool jump_set_target(Instruction& instruction, const InstructionFootprint& footprint, int index, long long target) {
+	int operand = jump_displacement_operand(instruction, footprint);
+	if (operand < 0) return true;
+	if (!jump_reaches(instruction, footprint, index, target)) return false;
+	int size = footprint.operands[operand].head & OF_IMMEDIATE_SIZE;
+	unsigned long long mask = size == 1 ? 0xff : size == 2 ? 0xffff : 0xffffffff;
+	instruction.operands[operand] = 0x200000000ull | ((unsigned long long)(target - index - 1) & mask);
+	return true;
+}
+
+void cfg_build(ControlFlowGraph& cfg, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const PlaceMasks& masks) {
+	cfg.jumps.clear();
+	for (int i = 0; i != int(masks.written.size()); i++) if (masks.written[i] & PLACE_CONTROL_FLOW) cfg.jumps.push_back(i);
+	cfg_build_blocks(cfg, instructions, extensions);
+}
+void cfg_build_blocks(ControlFlowGraph& cfg, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions) {
+	int size = int(instructions.size());
+	cfg.blocks.clear();
+	cfg.generation++;
+	if (!size) return;
+	std::vector<int> leaders{ 0 };
+	std::vector<int> targets(cfg.jumps.size());
+	for (size_t j = 0; j != cfg.jumps.size(); j++) {
+		auto& jump = instructions[cfg.jumps[j]];
+		targets[j] = jump_target(jump, extensions[jump.extension].instructions[jump.index], cfg.jumps[j], size);
+		if (cfg.jumps[j] + 1 < size) leaders.push_back(cfg.jumps[j] + 1);
+		if (targets[j] != CFG_EXIT) leaders.push_back(targets[j]);
+	}
+	std::sort(leaders.begin(), leaders.end());
+	leaders.erase(std::unique(leaders.begin(), leaders.end()), leaders.end());
+	int nr_blocks = int(leaders.size());
+	for (int b = 0; b != nr_blocks; b++) {
+		int last = (b + 1 == nr_blocks ? size : leaders[b + 1]) - 1;
+		int fall_through = (b + 1 == nr_blocks) ? CFG_EXIT : b + 1;
+		cfg.blocks.push_back({ leaders[b], last, { fall_through, CFG_NO_SUCCESSOR }, {} });
+	}
+	for (size_t j = 0; j != cfg.jumps.size(); j++) {
+		int b = cfg_block_of(cfg, cfg.jumps[j]);
+		auto& jump = instructions[cfg.jumps[j]];
+		if (!jump_falls_through(extensions[jump.extension].instructions[jump.index])) cfg.blocks[b].successors[0] = CFG_NO_SUCCESSOR;
+		cfg.blocks[b].successors[1] = targets[j] == CFG_EXIT ? CFG_EXIT : cfg_block_of(cfg, targets[j]);
+	}
+	for (int b = 0; b != int(cfg.blocks.size()); b++)
+		for (int successor : cfg.blocks[b].successors)
+			if (successor >= 0 && (cfg.blocks[successor].predecessors.empty() || cfg.blocks[successor].predecessors.back() != b))
+				cfg.blocks[successor].predecessors.push_back(b);
+}
+void cfg_rebuild_blocks(ControlFlowGraph& cfg, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, std::span<const InstructionRun> runs, std::vector<int>& changed) {
+	changed.clear();
+	std::vector<BasicBlock> old_blocks = std::move(cfg.blocks);
+	int generation = cfg.generation;
+	cfg_build_blocks(cfg, instructions, extensions);
+	if (old_blocks.size() != cfg.blocks.size()) return;
+	for (size_t b = 0; b != cfg.blocks.size(); b++)
+		if (old_blocks[b].successors[0] != cfg.blocks[b].successors[0] || old_blocks[b].successors[1] != cfg.blocks[b].successors[1]) return;
+	cfg.generation = generation;
+	// shift: instructions the runs in front of the block inserted. a run removing instructions overlaps the block behind it
+	size_t r = 0;
+	long long shift = 0;
+	for (int b = 0; b != int(cfg.blocks.size()); b++) {
+		const BasicBlock& block = cfg.blocks[b];
+		for (; r != runs.size() && runs[r].first + std::max<size_t>(runs[r].new_count, 1) <= size_t(block.first); r++)
+			shift += (long long)runs[r].new_count - (long long)runs[r].old_count;
+		bool overlaps = r != runs.size() && runs[r].first <= size_t(block.last);
+		if (overlaps || old_blocks[b].first + shift != block.first || old_blocks[b].last + shift != block.last) changed.push_back(b);
+	}
+}
+
+void cfg_insert(ControlFlowGraph& cfg, const PlaceMasks& masks, int position, int count) {
+	auto at = std::lower_bound(cfg.jumps.begin(), cfg.jumps.end(), position);
+	for (auto it = at; it != cfg.jumps.end(); ++it) *it += count;
+	for (int i = position; i != position + count; i++)
+		if (masks.written[i] & PLACE_CONTROL_FLOW) at = cfg.jumps.insert(at, i) + 1;
+}
+void cfg_erase(ControlFlowGraph& cfg, int position, int count) {
+	auto begin = std::lower_bound(cfg.jumps.begin(), cfg.jumps.end(), position);
+	auto end = std::lower_bound(begin, cfg.jumps.end(), position + count);
+	for (auto it = cfg.jumps.erase(begin, end); it != cfg.jumps.end(); ++it) *it -= count;
+}
+void cfg_resize_block(ControlFlowGraph& cfg, int block, int count) {
+	cfg.blocks[block].last += count;
+	for (int b = block + 1; b < int(cfg.blocks.size()); b++) {
+		cfg.blocks[b].first += count;
+		cfg.blocks[b].last += count;
+	}
+}
+void cfg_insert(ControlFlowGraph& cfg, const PlaceMasks& masks, std::span<const int> positions) {
+	std::vector<int> jumps{};
+	size_t p = 0;
+	for (int jump : cfg.jumps) {
+		for (; p != positions.size() && positions[p] - int(p) <= jump; p++)
+			if (masks.written[positions[p]] & PLACE_CONTROL_FLOW) jumps.push_back(positions[p]);
+		jumps.push_back(jump + int(p));
+	}
+	for (; p != positions.size(); p++) if (masks.written[positions[p]] & PLACE_CONTROL_FLOW) jumps.push_back(positions[p]);
+	cfg.jumps = std::move(jumps);
+	if (cfg.blocks.empty()) return;
+	// one inserted at the start of a block ends the block before it, jumps to the start go past it.
+	// if that block ends with a jump, it starts the block instead
+	int size = cfg.blocks.back().last + 1 + int(positions.size());
+	p = 0;
+	for (size_t b = 0; b != cfg.blocks.size(); b++) {
+		int first = cfg.blocks[b].first;
+		bool joins_previous = b && cfg.blocks[b - 1].successors[1] == CFG_NO_SUCCESSOR;
+		for (; p != positions.size() && (positions[p] - int(p) < first || (positions[p] - int(p) == first && joins_previous)); p++);
+		cfg.blocks[b].first = first + int(p);
+		if (b) cfg.blocks[b - 1].last = cfg.blocks[b].first - 1;
+	}
+	cfg.blocks.back().last = size - 1;
+}
+void cfg_erase(ControlFlowGraph& cfg, std::span<const int> positions) {
+	auto kept = cfg.jumps.begin();
+	size_t p = 0;
+	for (int jump : cfg.jumps) {
+		while (p != positions.size() && positions[p] < jump) p++;
+		if (p != positions.size() && positions[p] == jump) continue;
+		*kept++ = jump - int(p);
+	}
+	cfg.jumps.erase(kept, cfg.jumps.end());
+	p = 0;
+	for (BasicBlock& block : cfg.blocks) {
+		for (; p != positions.size() && positions[p] < block.first; p++);
+		block.first -= int(p);
+		for (; p != positions.size() && positions[p] <= block.last; p++);
+		block.last -= int(p);
+	}
+}
+
+int cfg_block_of(const ControlFlowGraph& cfg, int instruction) {
+	return int(std::upper_bound(cfg.blocks.begin(), cfg.blocks.end(), instruction, [](int instruction, const BasicBlock& block) { return instruction < block.first; }) - cfg.blocks.begin()) - 1;
+}
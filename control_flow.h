@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include "place_masks.h"
+
+// successor of a block that leaves the listing: falling off the end, an absolute or far jump, a return
+#define CFG_EXIT -1
+#define CFG_NO_SUCCESSOR -2
+
+struct BasicBlock {
+	int first; // instructions [first, last]
+	int last;
+	// fall through and jump target, both CFG_NO_SUCCESSOR if there is none
+	int successors[2];
+	std::vector<int> predecessors;
+};
+
+// the listing has no addresses, so the immediate of a relative jump is counted in instructions:
+// "JMP_rel 0" jumps to the next instruction, like a displacement of 0 bytes would.
+// the blocks are built from the jumps once. changes keep every jump and jump target and no block loses all of
+// its instructions, so afterwards only the bounds of the blocks move.
+struct ControlFlowGraph {
+	std::vector<int> jumps{}; // sorted indices of the instructions writing PLACE_CONTROL_FLOW
+	std::vector<BasicBlock> blocks{}; // in program order
+	int generation{}; // counts cfg_build_blocks, the edges and the indices of the blocks only change there
+};
+
+// target of the jump at <index>, CFG_EXIT if it is not a relative jump inside the listing
+int jump_target(const Instruction& instruction, const InstructionFootprint& footprint, int index, int instruction_count);
+// operand holding the displacement, -1 if it is not a relative jump
+int jump_displacement_operand(const Instruction& instruction, const InstructionFootprint& footprint);
+long long jump_displacement(const Instruction& instruction, const InstructionFootprint& footprint, int operand);
+// whether the displacement from <index> to <target> fits the immediate of the jump. LOOP and JRCXZ only have a byte,
+// and there is no longer encoding of them to switch to
+bool jump_reaches(const Instruction& instruction, const InstructionFootprint& footprint, int index, long long target);
+// rewrites the displacement of a relative jump at <index> so it reaches <target>, false and unchanged if it can't
+bool jump_set_target(Instruction& instruction, const InstructionFootprint& footprint, int index, long long target);
+
+void cfg_build(ControlFlowGraph& cfg, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const PlaceMasks& masks);
+// after cfg.jumps changed in a way that moves jump targets or adds blocks
+void cfg_build_blocks(ControlFlowGraph& cfg, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions);
+// the same after <runs> of the instructions were replaced and cfg.jumps shifted for them. if every block keeps its edges,
+// the generation stays and <changed> gets the blocks holding other instructions than before: the ones overlapping a run
+// and the ones whose bounds did not move along with the instructions. otherwise the generation changes as usual
+void cfg_rebuild_blocks(ControlFlowGraph& cfg, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, std::span<const InstructionRun> runs, std::vector<int>& changed);
+// shift cfg.jumps for inserted or removed instructions, the masks are the ones after inserting
+void cfg_insert(ControlFlowGraph& cfg, const PlaceMasks& masks, int position, int count);
+void cfg_erase(ControlFlowGraph& cfg, int position, int count);
+// <count> instructions inserted into <block>, or removed from it if negative. the later blocks move along
+void cfg_resize_block(ControlFlowGraph& cfg, int block, int count);
+// single instructions at sorted <positions>, counted after inserting or before erasing, that are no jump targets.
+// these also move the bounds of the blocks, none of which is emptied
+void cfg_insert(ControlFlowGraph& cfg, const PlaceMasks& masks, std::span<const int> positions);
+void cfg_erase(ControlFlowGraph& cfg, std::span<const int> positions);
+
+// index of the block containing <instruction>
+int cfg_block_of(const ControlFlowGraph& cfg, int instruction);
@@ -0,0 +1,111 @@
+#include "def_use.h"
+#include <algorithm>
+#include <bit>
+
+#define SLOT_PLACE(slot) (1ull << (16 + (slot)))
+
+void def_use_build(DefUse& def_use, const PlaceMasks& masks) {
+	for (auto& occurrences : def_use.occurrences) occurrences.clear();
+	for (int i = 0; i != int(masks.read.size()); i++)
+		for (unsigned long long places = (masks.read[i] | masks.written[i]) >> 16; places; places &= places - 1)
+			def_use.occurrences[std::countr_zero(places)].push_back(i);
+}
+void def_use_update(DefUse& def_use, const PlaceMasks& masks, int first, int last) {
+	unsigned long long touched = 0;
+	for (int i = first; i <= last; i++) touched |= masks.read[i] | masks.written[i];
+	std::vector<int> fresh{};
+	for (int slot = 0; slot != DEF_USE_SLOTS; slot++) {
+		auto& occurrences = def_use.occurrences[slot];
+		auto begin = std::lower_bound(occurrences.begin(), occurrences.end(), first);
+		auto end = std::upper_bound(begin, occurrences.end(), last);
+		if (begin == end && !(touched & SLOT_PLACE(slot))) continue;
+		fresh.clear();
+		for (int i = first; i <= last; i++) if ((masks.read[i] | masks.written[i]) & SLOT_PLACE(slot)) fresh.push_back(i);
+		if (std::equal(begin, end, fresh.begin(), fresh.end())) continue;
+		// most of the time only which instructions use the position changed, not how many
+		if (size_t(end - begin) == fresh.size()) std::copy(fresh.begin(), fresh.end(), begin);
+		else occurrences.insert(occurrences.erase(begin, end), fresh.begin(), fresh.end());
+	}
+}
+void def_use_insert(DefUse& def_use, const PlaceMasks& masks, int position, int count) {
+	unsigned long long touched = 0;
+	for (int i = position; i != position + count; i++) touched |= masks.read[i] | masks.written[i];
+	for (int slot = 0; slot != DEF_USE_SLOTS; slot++) {
+		auto& occurrences = def_use.occurrences[slot];
+		auto at = std::lower_bound(occurrences.begin(), occurrences.end(), position);
+		for (auto it = at; it != occurrences.end(); ++it) *it += count;
+		if (!(touched & SLOT_PLACE(slot))) continue;
+		for (int i = position; i != position + count; i++)
+			if ((masks.read[i] | masks.written[i]) & SLOT_PLACE(slot)) at = occurrences.insert(at, i) + 1;
+	}
+}
+void def_use_erase(DefUse& def_use, int position, int count) {
+	for (auto& occurrences : def_use.occurrences) {
+		auto begin = std::lower_bound(occurrences.begin(), occurrences.end(), position);
+		auto end = std::lower_bound(begin, occurrences.end(), position + count);
+		for (auto it = occurrences.erase(begin, end); it != occurrences.end(); ++it) *it -= count;
+	}
+}
+void def_use_insert(DefUse& def_use, const PlaceMasks& masks, std::span<const int> positions) {
+	if (positions.empty()) return;
+	unsigned long long touched = 0;
+	for (int i : positions) touched |= masks.read[i] | masks.written[i];
+	std::vector<int> merged{};
+	for (int slot = 0; slot != DEF_USE_SLOTS; slot++) {
+		auto& occurrences = def_use.occurrences[slot];
+		auto begin = std::lower_bound(occurrences.begin(), occurrences.end(), positions[0]);
+		// an occurrence moves down by the number of instructions inserted in front of it, positions[p] - p before inserting
+		size_t p = 0;
+		if (!(touched & SLOT_PLACE(slot))) {
+			for (auto it = begin; it != occurrences.end(); ++it) {
+				while (p != positions.size() && positions[p] - int(p) <= *it) p++;
+				*it += int(p);
+			}
+			continue;
+		}
+		merged.clear();
+		for (auto it = begin; it != occurrences.end(); ++it) {
+			for (; p != positions.size() && positions[p] - int(p) <= *it; p++)
+				if ((masks.read[positions[p]] | masks.written[positions[p]]) & SLOT_PLACE(slot)) merged.push_back(positions[p]);
+			merged.push_back(*it + int(p));
+		}
+		for (; p != positions.size(); p++)
+			if ((masks.read[positions[p]] | masks.written[positions[p]]) & SLOT_PLACE(slot)) merged.push_back(positions[p]);
+		occurrences.erase(begin, occurrences.end());
+		occurrences.insert(occurrences.end(), merged.begin(), merged.end());
+	}
+}
+void def_use_erase(DefUse& def_use, std::span<const int> positions) {
+	if (positions.empty()) return;
+	for (auto& occurrences : def_use.occurrences) {
+		auto kept = std::lower_bound(occurrences.begin(), occurrences.end(), positions[0]);
+		size_t p = 0;
+		for (auto it = kept; it != occurrences.end(); ++it) {
+			while (p != positions.size() && positions[p] < *it) p++;
+			if (p != positions.size() && positions[p] == *it) continue;
+			*kept++ = *it - int(p);
+		}
+		occurrences.erase(kept, occurrences.end());
+	}
+}
+void def_use_rotate(DefUse& def_use, int first, int middle, int last) {
+	for (auto& occurrences : def_use.occurrences) {
+		auto begin = std::lower_bound(occurrences.begin(), occurrences.end(), first);
+		auto split = std::lower_bound(begin, occurrences.end(), middle);
+		auto end = std::lower_bound(split, occurrences.end(), last);
+		for (auto it = begin; it != split; ++it) *it += last - middle;
+		for (auto it = split; it != end; ++it) *it -= middle - first;
+		std::rotate(begin, split, end);
+	}
+}
+
+int def_use_next(const DefUse& def_use, unsigned long long pos, int instruction, int instruction_count) {
+	auto& occurrences = def_use.occurrences[DEF_USE_SLOT(pos)];
+	auto it = std::lower_bound(occurrences.begin(), occurrences.end(), instruction);
+	return it == occurrences.end() ? instruction_count : *it;
+}
+int def_use_previous(const DefUse& def_use, unsigned long long pos, int instruction) {
+	auto& occurrences = def_use.occurrences[DEF_USE_SLOT(pos)];
+	auto it = std::lower_bound(occurrences.begin(), occurrences.end(), instruction);
+	return it == occurrences.begin() ? -1 : *(it - 1);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+#include "place_masks.h"
+
+// one slot per register position: general purpose registers 0-15, SIMD registers 16-47,
+// in the order of their PlaceMasks bits
+#define DEF_USE_SLOTS 48
+#define DEF_USE_SLOT(pos) (((pos) & 0x20ull) ? 16 + ((pos) & 0x1f) : ((pos) & 0xf))
+
+// for every register position, the sorted indices of the instructions reading or writing it.
+// whether an occurrence reads, writes or both is in PlaceMasks, so a live range is the stretch from a write
+// to the last read before the next write, and its ends are the neighbouring occurrences instead of a walk.
+struct DefUse {
+	std::vector<int> occurrences[DEF_USE_SLOTS]{};
+};
+
+// all of these take the masks after they were changed the same way
+void def_use_build(DefUse& def_use, const PlaceMasks& masks);
+// the masks of [first, last] changed
+void def_use_update(DefUse& def_use, const PlaceMasks& masks, int first, int last);
+void def_use_insert(DefUse& def_use, const PlaceMasks& masks, int position, int count);
+void def_use_erase(DefUse& def_use, int position, int count);
+// single instructions at sorted <positions>, counted after inserting or before erasing
+void def_use_insert(DefUse& def_use, const PlaceMasks& masks, std::span<const int> positions);
+void def_use_erase(DefUse& def_use, std::span<const int> positions);
+void def_use_rotate(DefUse& def_use, int first, int middle, int last);
+
+// first occurrence of <pos> at or after <instruction> (the number of instructions if none),
+// last occurrence before <instruction> (-1 if none)
+int def_use_next(const DefUse& def_use, unsigned long long pos, int instruction, int instruction_count);
+int def_use_previous(const DefUse& def_use, unsigned long long pos, int instruction);
@@ -0,0 +1,87 @@
+#include "dependency_scan.h"
+#if HAS_AVX2_SCAN
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+int first_conflict_scalar(const unsigned long long* read_masks, const unsigned long long* written_masks, int begin, int end, unsigned long long read, unsigned long long written) {
+	unsigned long long touched = read | written;
+	for (int i = begin; i < end; i++) if ((written_masks[i] & touched) | (read_masks[i] & written)) return i;
+	return end;
+}
+int last_conflict_scalar(const unsigned long long* read_masks, const unsigned long long* written_masks, int begin, int end, unsigned long long read, unsigned long long written) {
+	unsigned long long touched = read | written;
+	for (int i = end - 1; i >= begin; i--) if ((written_masks[i] & touched) | (read_masks[i] & written)) return i;
+	return begin - 1;
+}
+
+#if HAS_AVX2_SCAN
+bool cpu_supports_avx2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6; // OSXSAVE, XMM and YMM state
+	__cpuidex(info, 7, 0);
+	return os_saves_ymm && (info[1] & (1 << 5));
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// 4 instructions per step, bit k of the result is set if instruction k of the group conflicts
+TARGET_AVX2 inline int conflicts_avx2(const unsigned long long* read_masks, const unsigned long long* written_masks, int i, __m256i touched, __m256i written) {
+	__m256i r = _mm256_loadu_si256((const __m256i*)(read_masks + i));
+	__m256i w = _mm256_loadu_si256((const __m256i*)(written_masks + i));
+	__m256i conflict = _mm256_or_si256(_mm256_and_si256(w, touched), _mm256_and_si256(r, written));
+	__m256i free = _mm256_cmpeq_epi64(conflict, _mm256_setzero_si256());
+	return ~_mm256_movemask_pd(_mm256_castsi256_pd(free)) & 0xf;
+}
+TARGET_AVX2 int first_conflict_avx2(const unsigned long long* read_masks, const unsigned long long* written_masks, int begin, int end, unsigned long long read, unsigned long long written) {
+	__m256i touched_4 = _mm256_set1_epi64x(read | written);
+	__m256i written_4 = _mm256_set1_epi64x(written);
+	int i = begin;
+	for (; i + 4 <= end; i += 4)
+		if (int bits = conflicts_avx2(read_masks, written_masks, i, touched_4, written_4)) {
+			int k = 0;
+			while (!(bits & (1 << k))) k++;
+			return i + k;
+		}
+	return first_conflict_scalar(read_masks, written_masks, i, end, read, written);
+}
+TARGET_AVX2 int last_conflict_avx2(const unsigned long long* read_masks, const unsigned long long* written_masks, int begin, int end, unsigned long long read, unsigned long long written) {
+	__m256i touched_4 = _mm256_set1_epi64x(read | written);
+	__m256i written_4 = _mm256_set1_epi64x(written);
+	int i = end;
+	for (; i - 4 >= begin; i -= 4)
+		if (int bits = conflicts_avx2(read_masks, written_masks, i - 4, touched_4, written_4)) {
+			int k = 3;
+			while (!(bits & (1 << k))) k--;
+			return i - 4 + k;
+		}
+	return last_conflict_scalar(read_masks, written_masks, begin, i, read, written);
+}
+#endif
+
+typedef int (*ConflictScan)(const unsigned long long*, const unsigned long long*, int, int, unsigned long long, unsigned long long);
+#if HAS_AVX2_SCAN
+const bool use_avx2_scan = cpu_supports_avx2();
+const ConflictScan first_conflict_impl = use_avx2_scan ? first_conflict_avx2 : first_conflict_scalar;
+const ConflictScan last_conflict_impl = use_avx2_scan ? last_conflict_avx2 : last_conflict_scalar;
+#else
+const ConflictScan first_conflict_impl = first_conflict_scalar;
+const ConflictScan last_conflict_impl = last_conflict_scalar;
+#endif
+
+int first_conflict(const PlaceMasks& masks, int begin, int end, unsigned long long read, unsigned long long written) {
+	return first_conflict_impl(masks.read.data(), masks.written.data(), begin, end, read, written);
+}
+int last_conflict(const PlaceMasks& masks, int begin, int end, unsigned long long read, unsigned long long written) {
+	return last_conflict_impl(masks.read.data(), masks.written.data(), begin, end, read, written);
+}
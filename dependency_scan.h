@@ -0,0 +1,18 @@
+#pragma once
+#include "place_masks.h"
+
+// first instruction in [begin, end) that conflicts with an instruction reading <read> and writing <written>,
+// or end if there is none. conflict means one of them writes a place the other one reads or writes.
+int first_conflict(const PlaceMasks& masks, int begin, int end, unsigned long long read, unsigned long long written);
+// same, but searching from end - 1 down to begin, returns begin - 1 if there is none
+int last_conflict(const PlaceMasks& masks, int begin, int end, unsigned long long read, unsigned long long written);
+
+// the implementations first_conflict/last_conflict choose between at startup
+int first_conflict_scalar(const unsigned long long* read_masks, const unsigned long long* written_masks, int begin, int end, unsigned long long read, unsigned long long written);
+int last_conflict_scalar(const unsigned long long* read_masks, const unsigned long long* written_masks, int begin, int end, unsigned long long read, unsigned long long written);
+#if defined(__x86_64__) || defined(_M_X64)
+#define HAS_AVX2_SCAN 1
+bool cpu_supports_avx2();
+int first_conflict_avx2(const unsigned long long* read_masks, const unsigned long long* written_masks, int begin, int end, unsigned long long read, unsigned long long written);
+int last_conflict_avx2(const unsigned long long* read_masks, const unsigned long long* written_masks, int begin, int end, unsigned long long read, unsigned long long written);
+#endif
@@ -1,74 +1,11 @@
 #include "draw_main.h"
+#include "move_elimination.h"
 #include <bit>
+#include <algorithm>
 
 #define DBG(msg) (std::cout << msg << "\n")
 
 
-USE_MASK get_use_mask_in(const Instruction instruction, const InstructionFootprint& footprint) {
-	USE_MASK result = USE_MASK(footprint.always_read_registers) | (USE_MASK(footprint.always_read_flags) << 16);
-	for (int i = 0; i != 4; i++) if (footprint.operands[i].head & OF_IN) {
-		unsigned long long op = instruction.operands[i];
-		if (OP_IS_REGISTER(op))				result |= 1ull << OP_REGISTER(op);
-		else if (OP_IS_HIGH_BYTE(op))		result |= 1ull << OP_HIGH_BYTE(op);
-		else if (OP_IS_SIMD_REGISTER(op))	result |= 1ull << 32 + OP_SIMD_REGISTER(op);
-	}
-	return result;
-}
-USE_MASK get_use_mask_in_pointer(const Instruction instruction, const InstructionFootprint& footprint) {
-	USE_MASK result = 0;
-	for (int i = 0; i != 4; i++) {
-		unsigned long long op = instruction.operands[i];
-		unsigned char head = footprint.operands[i].head;
-		if ((head & OF_DEREF_TYPE) == OF_IN_DEREF || (head & OF_DEREF_TYPE) == OF_IO_DEREF)
-			result |= 1ull << (footprint.operands[i].head & OF_PTR_REGISTER);
-		else if ((head & OF_IN) && OP_IS_MEMORY_LOCATION(op) && OP_MEMORY_BASE_REGISTER(op) < 16)
-			result |= 1ull << OP_MEMORY_BASE_REGISTER(op);
-	}
-	return result;
-}
-USE_MASK get_use_mask_in_index(const Instruction instruction, const InstructionFootprint& footprint) {
-	USE_MASK result = 0;
-	for (int i = 0; i != 4; i++) {
-		unsigned long long op = instruction.operands[i];
-		unsigned char head = footprint.operands[i].head;
-		if ((head & OF_IN) && OP_IS_MEMORY_LOCATION(op) && OP_MEMORY_INDEX_REGISTER(op) < 16)
-			result |= 1ull << OP_MEMORY_INDEX_REGISTER(op);
-	}
-	return result;
-}
-USE_MASK get_use_mask_out(const Instruction instruction, const InstructionFootprint& footprint) {
-	USE_MASK result = USE_MASK(footprint.always_written_registers) | (USE_MASK(footprint.always_written_flags) << 16);
-	for (int i = 0; i != 4; i++) if (footprint.operands[i].head & OF_OUT) {
-		unsigned long long op = instruction.operands[i];
-		if (OP_IS_REGISTER(op))				result |= 1ull << OP_REGISTER(op);
-		else if (OP_IS_HIGH_BYTE(op))		result |= 1ull << OP_HIGH_BYTE(op);
-		else if (OP_IS_SIMD_REGISTER(op))	result |= 1ull << 32 + OP_SIMD_REGISTER(op);
-	}
-	return result;
-}
-USE_MASK get_use_mask_out_pointer(const Instruction instruction, const InstructionFootprint& footprint) {
-	USE_MASK result = 0;
-	for (int i = 0; i != 4; i++) {
-		unsigned long long op = instruction.operands[i];
-		unsigned char head = footprint.operands[i].head;
-		if ((head & OF_DEREF_TYPE) == OF_OUT_DEREF || (head & OF_DEREF_TYPE) == OF_IO_DEREF)
-			result |= 1ull << (footprint.operands[i].head & OF_PTR_REGISTER);
-		else if ((head & OF_OUT) && OP_IS_MEMORY_LOCATION(op) && OP_MEMORY_BASE_REGISTER(op) < 16)
-			result |= 1ull << OP_MEMORY_BASE_REGISTER(op);
-	}
-	return result;
-}
-USE_MASK get_use_mask_out_index(const Instruction instruction, const InstructionFootprint& footprint) {
-	USE_MASK result = 0;
-	for (int i = 0; i != 4; i++) {
-		unsigned long long op = instruction.operands[i];
-		unsigned char head = footprint.operands[i].head;
-		if ((head & OF_OUT) && OP_IS_MEMORY_LOCATION(op) && OP_MEMORY_INDEX_REGISTER(op) < 16)
-			result |= 1ull << OP_MEMORY_INDEX_REGISTER(op);
-	}
-	return result;
-}
-
 struct DrawState {
 	float x;
 	float y;
@@ -205,6 +142,79 @@ void draw_position(SDL_Renderer* renderer, DrawState& state,
 	state.x += state.w;
 }
 
+unsigned long long label_key(const Instruction& instruction, const InstructionFootprint& footprint, TTF_Font* font) {
+	unsigned long long font_size = (unsigned long long)(TTF_GetFontSize(font) * 4) & 0xffff;
+	return (unsigned long long)(instruction.extension) << 48 | (unsigned long long)(footprint.name) << 16 | font_size;
+}
+Label get_label(LabelCache& cache, SDL_Renderer* renderer, TTF_Font* font, const std::vector<InstructionSetExtension>& extensions, const Instruction& instruction) {
+	const InstructionFootprint& footprint = extensions[instruction.extension].instructions[instruction.index];
+	unsigned long long key = label_key(instruction, footprint, font);
+	auto hit = cache.labels.find(key);
+	if (hit != cache.labels.end()) {
+		cache.lru.splice(cache.lru.begin(), cache.lru, hit->second.lru_position);
+		return hit->second;
+	}
+	if (cache.labels.size() >= LABEL_CACHE_CAPACITY) {
+		auto oldest = cache.labels.find(cache.lru.back());
+		SDL_DestroyTexture(oldest->second.texture);
+		cache.labels.erase(oldest);
+		cache.lru.pop_back();
+	}
+	const char* name = &extensions[instruction.extension].names[footprint.name];
+	Label label{};
+	TTF_GetStringSize(font, name, 0, &label.width, &label.height);
+	SDL_Color color = { 255, 255, 255, 255 };
+	SDL_Surface* surface = TTF_RenderText_Blended(font, name, 0, color);
+	label.texture = SDL_CreateTextureFromSurface(renderer, surface);
+	SDL_DestroySurface(surface);
+	cache.lru.push_front(key);
+	label.lru_position = cache.lru.begin();
+	cache.labels[key] = label;
+	return label;
+}
+void clear_label_cache(LabelCache& cache) {
+	for (auto& [key, label] : cache.labels) SDL_DestroyTexture(label.texture);
+	cache.labels.clear();
+	cache.lru.clear();
+}
+
+void main_view_port_simulate(MainViewPort& view_port) {
+	if (!view_port.show_simulation) return;
+	MainState& main_state = *view_port.main_state;
+	// only what changed since the last frame, while dragging that is the preview of the change
+	if (view_port.simulator_settings == view_port.simulated_settings) {
+		size_t first, end;
+		instruction_buffer_difference(view_port.simulated_instructions, main_state.instructions, first, end, same_simulated_instruction);
+		if (first != end || view_port.simulated_instructions.size() != main_state.instructions.size())
+			simulate_update(view_port.simulation, main_state.instructions, main_state.extensions, main_state.places, view_port.simulator_settings, first, end);
+	}
+	else simulate(view_port.simulation, main_state.instructions, main_state.extensions, main_state.places, view_port.simulator_settings);
+	view_port.simulated_instructions = main_state.instructions;
+	view_port.simulated_settings = view_port.simulator_settings;
+	if (!main_state.temporary_change.type) view_port.cycles_before_drag = view_port.simulation.cycles;
+}
+
+void main_view_port_compare_timings(MainViewPort& view_port) {
+	MainState& main_state = *view_port.main_state;
+	SimulatorSettings settings = view_port.simulator_settings;
+	settings.profile.clear();
+	std::vector<std::string> profiles = timing_profiles(main_state.extensions);
+	bool update = profiles == view_port.compared_profiles && settings == view_port.compared_settings;
+	size_t first = 0, end = 0;
+	if (update) instruction_buffer_difference(view_port.compared_instructions, main_state.instructions, first, end, same_simulated_instruction);
+	if (update && first == end && view_port.compared_instructions.size() == main_state.instructions.size()) return;
+	view_port.compared_simulations.resize(profiles.size());
+	for (size_t p = 0; p != profiles.size(); p++) {
+		settings.profile = profiles[p];
+		if (update) simulate_update(view_port.compared_simulations[p], main_state.instructions, main_state.extensions, main_state.places, settings, first, end);
+		else simulate(view_port.compared_simulations[p], main_state.instructions, main_state.extensions, main_state.places, settings);
+	}
+	settings.profile.clear();
+	view_port.compared_profiles = std::move(profiles);
+	view_port.compared_instructions = main_state.instructions;
+	view_port.compared_settings = settings;
+}
+
 void draw_main(SDL_Renderer* renderer, TTF_Font* font, MainViewPort& view_port)
 {
 	auto& instructions = view_port.main_state->instructions;
@@ -243,23 +253,16 @@ void draw_main(SDL_Renderer* renderer, TTF_Font* font, MainViewPort& view_port)
 	// now draw the instructions [first_instruction_drawn ..< first_instruction_drawn+nr_instructions_drawn].
 	// (0,0) is top left of first instruction.
 
-	USE_MASK use_mask = 0xffffffff00ffffff;
-	for (int i = instructions.size() - 1; i >= first_instruction_drawn + nr_instructions_drawn; i--) {
-		Instruction instruction = instructions[i];
-		InstructionFootprint& footprint = extensions[instruction.extension].instructions[instruction.index];
-		USE_MASK in = get_use_mask_in(instruction, footprint) 
-			| get_use_mask_in_pointer(instruction, footprint)
-			| get_use_mask_in_index(instruction, footprint)
-			| get_use_mask_out_pointer(instruction, footprint)
-			| get_use_mask_out_index(instruction, footprint);
-		USE_MASK out = get_use_mask_out(instruction, footprint);
-		use_mask = (use_mask & ~out) | in;
-	}
+	USE_MASK use_mask = live_ranges_at(view_port.main_state->live_ranges, first_instruction_drawn + nr_instructions_drawn);
+	// cycles are counted from the dispatch of the first instruction drawn
+	bool draw_timeline = view_port.show_simulation && view_port.simulation.instructions.size() == instructions.size() && nr_instructions_drawn > 0;
+	float timeline_x = TIMELINE_OFFSET;
+	for (int width : view_port.displayed_position_widths) timeline_x += width;
+	long long first_cycle = draw_timeline ? view_port.simulation.instructions[first_instruction_drawn].dispatch : 0;
 
 	for (int i = first_instruction_drawn + nr_instructions_drawn - 1; i != first_instruction_drawn - 1; i--) {
 		Instruction instruction = instructions[i];
 		InstructionFootprint& footprint = extensions[instruction.extension].instructions[instruction.index];
-		const char* name = &extensions[instruction.extension].names[footprint.name];
 		USE_MASK in = get_use_mask_in(instruction, footprint);
 		USE_MASK in_pointer = get_use_mask_in_pointer(instruction, footprint);
 		USE_MASK in_index = get_use_mask_in_index(instruction, footprint);
@@ -267,14 +270,18 @@ void draw_main(SDL_Renderer* renderer, TTF_Font* font, MainViewPort& view_port)
 		USE_MASK out_index = get_use_mask_out_index(instruction, footprint);
 		USE_MASK out = get_use_mask_out(instruction, footprint);
 		
+		// below the end of a block is whatever its successors need
+		auto& cfg = view_port.main_state->cfg;
+		int block = cfg_block_of(cfg, i);
+		if (cfg.blocks[block].last == i) use_mask = view_port.main_state->liveness.blocks[block].live_out;
+
 		USE_MASK use_mask_below = use_mask;
 		use_mask = (use_mask & ~out) | in | in_pointer | in_index | out_pointer | out_index;
 		USE_MASK use_mask_above = use_mask;
 
-		TTF_Text* ttf_text = TTF_CreateText(NULL, font, name, 0);
-		int text_width, text_height;
-		TTF_GetTextSize(ttf_text, &text_width, &text_height);
-		TTF_DestroyText(ttf_text);
+		Label label = get_label(view_port.label_cache, renderer, font, extensions, instruction);
+		int text_width = label.width;
+		int text_height = label.height;
 
 		DrawState state = {
 			.x = 0,
@@ -301,18 +308,36 @@ void draw_main(SDL_Renderer* renderer, TTF_Font* font, MainViewPort& view_port)
 				out, out_pointer, out_index);
 		}
 
-		SDL_Color color = {255, 255, 255, 255};
-		SDL_Surface* surface = TTF_RenderText_Blended(font, name, 0, color);
-		SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-		SDL_DestroySurface(surface);
 		SDL_FRect dst_rect = { 
 			state.start_pos, 
 			state.y + (view_port.zoom_vertical-text_height)/2, 
 			text_width, 
 			text_height
 		};
-		SDL_RenderTexture(renderer, texture, NULL, &dst_rect);
-		SDL_DestroyTexture(texture);
+		SDL_RenderTexture(renderer, label.texture, NULL, &dst_rect);
+
+		// waiting in the reorder buffer, executing, waiting to retire
+		if (draw_timeline) {
+			const SimulatedInstruction& simulated = view_port.simulation.instructions[i];
+			float middle = state.y + view_port.zoom_vertical / 2;
+			SDL_FRect executing = {
+				timeline_x + (simulated.issue - first_cycle) * TIMELINE_CYCLE_WIDTH,
+				state.y + view_port.zoom_vertical / 4,
+				std::max(1.f, float(simulated.complete - simulated.issue) * TIMELINE_CYCLE_WIDTH),
+				view_port.zoom_vertical / 2
+			};
+			SDL_SetRenderDrawColor(renderer, 100, 100, 100, 255);
+			SDL_RenderLine(renderer, timeline_x + (simulated.dispatch - first_cycle) * TIMELINE_CYCLE_WIDTH, middle, executing.x, middle);
+			SDL_RenderLine(renderer, executing.x + executing.w, middle, timeline_x + (simulated.retire - first_cycle) * TIMELINE_CYCLE_WIDTH, middle);
+			SDL_SetRenderDrawColor(renderer, 80, 160, 220, 255);
+			SDL_RenderFillRect(renderer, &executing);
+		}
+
+		// basic block boundary
+		if (i && view_port.main_state->cfg.blocks[cfg_block_of(view_port.main_state->cfg, i)].first == i) {
+			SDL_SetRenderDrawColor(renderer, 200, 150, 50, 255);
+			SDL_RenderLine(renderer, 0, state.y, view_translate.w, state.y);
+		}
 	}
 
 
@@ -383,7 +408,7 @@ bool update_drag(MainViewPort& view_port, float mouse_x, float mouse_y) {
 	case DRAG_HORIZONTAL: {
 		unsigned long long new_position = get_mouse_pos_register(view_port, mouse_x, mouse_y);
 		if (new_position == view_port.drag_tracker.horizontal.last_pos) return false;
-		if (view_port.main_state->temporary_change.type) undo_last_change(view_port.main_state->instructions, view_port.main_state->extensions, &view_port.main_state->temporary_change);
+		if (view_port.main_state->temporary_change.type) main_state_undo_last_change(*view_port.main_state, &view_port.main_state->temporary_change);
 		view_port.drag_tracker.horizontal.last_pos = new_position;
 		DBG("trying to build horizontal change: " << view_port.drag_tracker.horizontal.position << " " << int(view_port.drag_tracker.horizontal.start_pos) << " " << int(new_position));
 		if (can_swap_registers(new_position,view_port.drag_tracker.horizontal.start_pos)) {
@@ -391,10 +416,13 @@ bool update_drag(MainViewPort& view_port, float mouse_x, float mouse_y) {
 			view_port.main_state->temporary_change = build_horizontal_change(
 				view_port.main_state->instructions,
 				view_port.main_state->extensions,
+				view_port.main_state->def_use,
+				view_port.main_state->live_ranges,
+				view_port.main_state->cfg,
 				view_port.drag_tracker.horizontal.position,
 				view_port.drag_tracker.horizontal.start_pos,
 				new_position);
-			apply_change(view_port.main_state->instructions, view_port.main_state->extensions, &view_port.main_state->temporary_change);
+			if (view_port.main_state->temporary_change.type) main_state_apply_change(*view_port.main_state, &view_port.main_state->temporary_change);
 
 		}
 		else view_port.main_state->temporary_change.type = 0;
@@ -403,17 +431,18 @@ bool update_drag(MainViewPort& view_port, float mouse_x, float mouse_y) {
 	case DRAG_VERTICAL: {
 		int new_position = get_mouse_pos_instruction(view_port, mouse_x, mouse_y);
 		if (new_position == view_port.drag_tracker.vertical.last_instruction) return false;
-		if (view_port.main_state->temporary_change.type) undo_last_change(view_port.main_state->instructions, view_port.main_state->extensions, &view_port.main_state->temporary_change);
+		if (view_port.main_state->temporary_change.type) main_state_undo_last_change(*view_port.main_state, &view_port.main_state->temporary_change);
 		view_port.drag_tracker.vertical.last_instruction = new_position;
 		if (new_position == view_port.drag_tracker.vertical.start_instruction) view_port.main_state->temporary_change.type = 0;
 		else {
 			DBG("building vertical change " << view_port.drag_tracker.vertical.start_instruction << "" << new_position - view_port.drag_tracker.vertical.start_instruction);
 			view_port.main_state->temporary_change = build_vertical_change(
-				view_port.main_state->instructions,
-				view_port.main_state->extensions,
+				view_port.main_state->places,
+				view_port.main_state->live_ranges,
+				view_port.main_state->cfg,
 				view_port.drag_tracker.vertical.start_instruction,
 				new_position - view_port.drag_tracker.vertical.start_instruction);
-			apply_change(view_port.main_state->instructions, view_port.main_state->extensions, &view_port.main_state->temporary_change);
+			main_state_apply_change(*view_port.main_state, &view_port.main_state->temporary_change);
 		}
 		return true;
 	}
@@ -436,7 +465,7 @@ bool main_view_port_handle_event(MainViewPort& view_port, SDL_Event& event, bool
 		if (ignore_mouse || !in_viewport(view_port, event.button.x, event.button.y)) return false;
 
 		if (view_port.drag_tracker.type) {
-			if (view_port.main_state->temporary_change.type) undo_last_change(view_port.main_state->instructions, view_port.main_state->extensions, &view_port.main_state->temporary_change);
+			if (view_port.main_state->temporary_change.type) main_state_undo_last_change(*view_port.main_state, &view_port.main_state->temporary_change);
 			view_port.main_state->temporary_change.type = 0;
 		}
 		if (event.button.button != mouse_button_drag) return false;
@@ -467,10 +496,10 @@ bool main_view_port_handle_event(MainViewPort& view_port, SDL_Event& event, bool
 		if (ignore_mouse || !in_viewport(view_port, event.button.x, event.button.y) || event.button.button != mouse_button_drag || !view_port.drag_tracker.type) return false;
 		update_drag(view_port, event.button.x, event.button.y);
 		if (view_port.main_state->temporary_change.type) {
-			view_port.main_state->undo_redo_list.resize(view_port.main_state->change_count);
-			view_port.main_state->undo_redo_list.push_back(view_port.main_state->temporary_change);
-			view_port.main_state->change_count++;
+			main_state_record_change(*view_port.main_state, view_port.main_state->temporary_change);
 			view_port.main_state->temporary_change.type = 0;
+			// a separate change, so the drag can still be undone without it
+			if (view_port.eliminate_moves_after_drag) main_state_eliminate_moves(*view_port.main_state);
 		}
 		view_port.drag_tracker.type = DRAG_NONE;
 		return true;
@@ -4,37 +4,10 @@
 #include <SDL3_ttf/SDL_ttf.h>
 #include <vector>
 #include <span>
+#include <list>
+#include <unordered_map>
 #include "main_state.h"
-
-#define USE_MASK unsigned long long
-#define USE_RAX (1ull << 0)
-#define USE_RBX (1ull << 1)
-#define USE_RCX (1ull << 2)
-#define USE_RDX (1ull << 3)
-#define USE_RSI (1ull << 4)
-#define USE_RDI (1ull << 5)
-#define USE_RSP (1ull << 6)
-#define USE_RBP (1ull << 7)
-#define USE_R8 (1ull << 8)
-#define USE_R9 (1ull << 9)
-#define USE_R10 (1ull << 10)
-#define USE_R11 (1ull << 11)
-#define USE_R12 (1ull << 12)
-#define USE_R13 (1ull << 13)
-#define USE_R14 (1ull << 14)
-#define USE_R15 (1ull << 15)
-
-#define USE_CF (1ull << 16)
-#define USE_PF (1ull << 17)
-#define USE_AF (1ull << 18)
-#define USE_ZF (1ull << 19)
-#define USE_SF (1ull << 20)
-#define USE_DF (1ull << 21)
-#define USE_OF (1ull << 22)
-
-#define USE_UNKNOWN (1ull << 23)
-
-// xmm0: 1ull << 32 ... xmm31: 1ull << 63
+#include "simulator.h"
 
 #define DRAG_NONE 0
 #define DRAG_VERTICAL 1
@@ -59,6 +32,22 @@ union DragTracker {
 std::vector<USE_MASK> default_displayed_positions();
 std::vector<int> default_displayed_position_widths();
 
+// rendered instruction names, keyed by (extension, footprint name, font size), least recently used are dropped
+#define LABEL_CACHE_CAPACITY 1024
+struct Label {
+	SDL_Texture* texture;
+	int width;
+	int height;
+	std::list<unsigned long long>::iterator lru_position;
+};
+struct LabelCache {
+	std::unordered_map<unsigned long long, Label> labels{};
+	std::list<unsigned long long> lru{}; // most recently used first
+};
+Label get_label(LabelCache& cache, SDL_Renderer* renderer, TTF_Font* font, const std::vector<InstructionSetExtension>& extensions, const Instruction& instruction);
+// has to be called before the renderer is destroyed
+void clear_label_cache(LabelCache& cache);
+
 struct MainViewPort {
 	SDL_Rect frame;
 	float vertical_scroll_instructions; // 1.0 means one instruction is skipped at the top of the canvas
@@ -68,8 +57,30 @@ struct MainViewPort {
 	std::vector<USE_MASK> displayed_positions{ default_displayed_positions() };
 	std::vector<int> displayed_position_widths {default_displayed_position_widths()};
 	DragTracker drag_tracker{ .type = DRAG_NONE };
+	bool eliminate_moves_after_drag{ false }; // main_state_eliminate_moves after every committed drag, undone on its own
+	LabelCache label_cache{};
+	bool show_simulation{ false }; // the simulated cycles of every instruction as a timeline right of the instructions
+	SimulatorSettings simulator_settings{ default_simulator_settings() };
+	SimulationResult simulation{};
+	// what simulation is for, shares its chunks with the instructions so the changed ones are found quickly
+	InstructionBuffer simulated_instructions{};
+	SimulatorSettings simulated_settings{};
+	long long cycles_before_drag{ 0 }; // of the instructions without the temporary change
+	// Simulation > Compare Timings: a run for every profile with the other settings of simulator_settings
+	std::vector<std::string> compared_profiles{};
+	std::vector<SimulationResult> compared_simulations{};
+	InstructionBuffer compared_instructions{};
+	SimulatorSettings compared_settings{};
 };
 
+// the timeline starts this far right of the register columns, one cycle is this wide
+#define TIMELINE_OFFSET 250
+#define TIMELINE_CYCLE_WIDTH 6
+// simulates the current instructions if show_simulation is set, once per frame before drawing.
+// after a change only the instructions from the checkpoint before it on are simulated again
+void main_view_port_simulate(MainViewPort& view_port);
+// brings compared_simulations up to date the same way, called every frame while they are shown
+void main_view_port_compare_timings(MainViewPort& view_port);
 void draw_main(SDL_Renderer* renderer, TTF_Font* font, MainViewPort& view_port);
 
 // returns true if the event had an effect
@@ -0,0 +1,220 @@
+#include "encoder.h"
+#include "control_flow.h"
+#include <algorithm>
+#include <cstring>
+
+long long sign_extend(unsigned long long value, int bytes) {
+	int shift = 64 - 8 * bytes;
+	return (long long)(value << shift) >> shift;
+}
+
+// whether operand <op> can take <role> in <encoding>, an immediate shorter than its operand has to fit sign extended
+bool encoding_fits(unsigned long long op, unsigned char role, const InstructionEncoding& encoding, OperandFootprint footprint) {
+	switch (role) {
+	case ENCODE_ROLE_REG: return OP_IS_REGISTER(op) || OP_IS_HIGH_BYTE(op) || OP_IS_SIMD_REGISTER(op);
+	case ENCODE_ROLE_RM: return OP_IS_REGISTER(op) || OP_IS_HIGH_BYTE(op) || OP_IS_SIMD_REGISTER(op) || OP_IS_MEMORY_LOCATION(op) || OP_IS_RIP_RELATIVE(op);
+	case ENCODE_ROLE_OPCODE: return OP_IS_REGISTER(op) || OP_IS_HIGH_BYTE(op);
+	case ENCODE_ROLE_VVVV: return OP_IS_REGISTER(op) || OP_IS_SIMD_REGISTER(op);
+	case ENCODE_ROLE_IMMEDIATE: {
+		if (!OP_IS_IMMEDIATE(op)) return false;
+		int size = footprint.head & OF_IMMEDIATE_SIZE;
+		if (encoding.immediate_size >= size) return true;
+		long long value = sign_extend(OP_IMMEDIATE(op), size);
+		return value == sign_extend(value, encoding.immediate_size);
+	}
+	case ENCODE_ROLE_RELATIVE: return OP_IS_IMMEDIATE(op);
+	default: return op == 0;
+	}
+}
+
+// number in machine code, SIMD registers go up to 31
+int encoded_register(unsigned long long op) {
+	if (OP_IS_REGISTER(op)) return ENCODER_REGISTER_NUMBERS[OP_REGISTER(op)];
+	if (OP_IS_HIGH_BYTE(op)) return ENCODER_HIGH_BYTE_NUMBERS[OP_HIGH_BYTE(op)];
+	return OP_SIMD_REGISTER(op);
+}
+
+void encode_value(unsigned char*& out, unsigned long long value, int size) {
+	for (int i = 0; i != size; i++) *out++ = (unsigned char)(value >> 8 * i);
+}
+
+int encode_instruction(const Instruction& instruction, const std::vector<InstructionSetExtension>& extensions, long long displacement,
+	unsigned char* code, const char*& message) {
+	const InstructionSetExtension& extension = extensions[instruction.extension];
+	const InstructionFootprint& footprint = extension.instructions[instruction.index];
+	auto [first, end] = instruction_encodings(extension, instruction.index);
+	const InstructionEncoding* encoding = nullptr;
+	for (size_t e = first; e != end && !encoding; e++) {
+		bool fits = true;
+		for (int i = 0; i != 4 && fits; i++) fits = encoding_fits(instruction.operands[i], extension.encodings[e].roles[i], extension.encodings[e], footprint.operands[i]);
+		if (fits) encoding = &extension.encodings[e];
+	}
+	if (!encoding) {
+		message = first == end ? "the extension file has no encoding for the instruction" : "no encoding of the instruction takes these operands";
+		return 0;
+	}
+
+	// the operands by where they go, reg starts as the /0 to /7 digit
+	int reg = encoding->modrm < 8 ? encoding->modrm : 0, opcode_register = 0, vvvv = 0;
+	unsigned long long rm = 0, immediate = 0;
+	bool high_byte = false, byte_rex = false, high_simd = false, relative = false;
+	for (int i = 0; i != 4; i++) {
+		unsigned long long op = instruction.operands[i];
+		switch (encoding->roles[i]) {
+		case ENCODE_ROLE_REG: reg = encoded_register(op); break;
+		case ENCODE_ROLE_RM: rm = op; break;
+		case ENCODE_ROLE_OPCODE: opcode_register = encoded_register(op); break;
+		case ENCODE_ROLE_VVVV: vvvv = encoded_register(op); break;
+		case ENCODE_ROLE_IMMEDIATE: immediate = OP_IMMEDIATE(op); break;
+		case ENCODE_ROLE_RELATIVE: immediate = (unsigned long long)displacement; relative = true; break;
+		}
+		high_byte |= OP_IS_HIGH_BYTE(op);
+		high_simd |= OP_IS_SIMD_REGISTER(op) && OP_SIMD_REGISTER(op) >= 16;
+		// SPL, BPL, SIL and DIL instead of AH to DH, only for the byte operands (MOVZX has a wide one)
+		OperandFootprint ofp = footprint.operands[i];
+		bool byte_operand = (!(ofp.head & OF_SIMD_REGISTER) && (ofp.head & OF_CAN_BE_HIGH_BYTE)) || ofp.memory_size == 1;
+		byte_rex |= (encoding->prefixes & ENCODE_BYTE_REGISTERS) && byte_operand && OP_IS_REGISTER(op) && (encoded_register(op) & ~3) == 4;
+	}
+	bool vex = encoding->prefixes & ENCODE_VEX, evex = vex && high_simd;
+	if (high_simd && !vex) {
+		message = "XMM16 to XMM31 need a VEX encoding to become EVEX";
+		return 0;
+	}
+	if (relative && sign_extend(displacement, encoding->immediate_size) != displacement) {
+		message = "the jump is too far for its displacement";
+		return 0;
+	}
+
+	// ModRM, SIB and displacement
+	unsigned char address[6];
+	unsigned char* address_end = address;
+	int x_bit = 0, b_bit = opcode_register >> 3;
+	if (encoding->modrm != ENCODE_NO_MODRM) {
+		int reg_field = (reg & 7) << 3;
+		if (OP_IS_RIP_RELATIVE(rm)) {
+			*address_end++ = (unsigned char)(reg_field | 5);
+			encode_value(address_end, OP_RIP_RELATIVE(rm), 4);
+		}
+		else if (OP_IS_MEMORY_LOCATION(rm)) {
+			int base = OP_MEMORY_BASE_REGISTER(rm) < 16 ? ENCODER_REGISTER_NUMBERS[OP_MEMORY_BASE_REGISTER(rm)] : -1;
+			int scale = int(OP_MEMORY_SCALE(rm));
+			int index = OP_MEMORY_INDEX_REGISTER(rm) < 16 && scale ? ENCODER_REGISTER_NUMBERS[OP_MEMORY_INDEX_REGISTER(rm)] : -1;
+			int scale_bits = scale == 1 ? 0 : scale == 2 ? 1 : scale == 4 ? 2 : 3;
+			if (index == 4) {
+				message = "RSP can't be an index register";
+				return 0;
+			}
+			if (index >= 0 && scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+				message = "the scale of an index register has to be 1, 2, 4 or 8";
+				return 0;
+			}
+			int offset = int(OP_MEMORY_OFFSET(rm));
+			int sib = (index >= 0 ? scale_bits << 6 | (index & 7) << 3 : 4 << 3);
+			if (base < 0) {
+				// no base: SIB with base 5 and a 32 bit displacement
+				*address_end++ = (unsigned char)(reg_field | 4);
+				*address_end++ = (unsigned char)(sib | 5);
+				encode_value(address_end, (unsigned int)offset, 4);
+			}
+			else {
+				// RBP and R13 always have a displacement, EVEX scales 8 bit ones by the operand size so it only uses 0
+				int mod = offset == 0 && (base & 7) != 5 ? 0 : offset == (signed char)offset && (!evex || offset == 0) ? 1 : 2;
+				bool has_sib = index >= 0 || (base & 7) == 4;
+				*address_end++ = (unsigned char)(mod << 6 | reg_field | (has_sib ? 4 : base & 7));
+				if (has_sib) *address_end++ = (unsigned char)(sib | (base & 7));
+				encode_value(address_end, (unsigned int)offset, mod == 1 ? 1 : mod == 2 ? 4 : 0);
+			}
+			x_bit = index >= 0 ? index >> 3 : 0;
+			b_bit = base >= 0 ? base >> 3 : 0;
+		}
+		else {
+			int r = encoded_register(rm);
+			*address_end++ = (unsigned char)(0xc0 | reg_field | (r & 7));
+			b_bit = (r >> 3) & 1;
+			x_bit = r >> 4; // only with EVEX
+		}
+	}
+	int r_bit = (reg >> 3) & 1;
+
+	unsigned char* out = code;
+	int prefixes = encoding->prefixes;
+	if (vex) {
+		int pp = (prefixes & ENCODE_PREFIX_66) ? 1 : (prefixes & ENCODE_PREFIX_F3) ? 2 : (prefixes & ENCODE_PREFIX_F2) ? 3 : 0;
+		int map = encoding->vex & ENCODE_VEX_MAP, l = (encoding->vex & ENCODE_VEX_L) ? 1 : 0, w = (encoding->vex & ENCODE_VEX_W) ? 1 : 0;
+		if (evex) {
+			*out++ = 0x62;
+			*out++ = (unsigned char)(!r_bit << 7 | !x_bit << 6 | !b_bit << 5 | !(reg >> 4) << 4 | map);
+			*out++ = (unsigned char)(w << 7 | (~vvvv & 15) << 3 | 4 | pp);
+			*out++ = (unsigned char)(l << 5 | !(vvvv >> 4) << 3);
+		}
+		else if (map == 1 && !w && !x_bit && !b_bit) {
+			*out++ = 0xc5;
+			*out++ = (unsigned char)(!r_bit << 7 | (~vvvv & 15) << 3 | l << 2 | pp);
+		}
+		else {
+			*out++ = 0xc4;
+			*out++ = (unsigned char)(!r_bit << 7 | !x_bit << 6 | !b_bit << 5 | map);
+			*out++ = (unsigned char)(w << 7 | (~vvvv & 15) << 3 | l << 2 | pp);
+		}
+	}
+	else {
+		if (prefixes & ENCODE_PREFIX_66) *out++ = 0x66;
+		if (prefixes & ENCODE_PREFIX_F2) *out++ = 0xf2;
+		if (prefixes & ENCODE_PREFIX_F3) *out++ = 0xf3;
+		int rex = ((prefixes & ENCODE_REX_W) ? 8 : 0) | r_bit << 2 | x_bit << 1 | b_bit;
+		if (rex || byte_rex) {
+			if (high_byte) {
+				message = "AH to DH can't be used with a REX prefix, which R8 to R15, SPL to DIL or 64 bit operands need";
+				return 0;
+			}
+			*out++ = (unsigned char)(0x40 | rex);
+		}
+	}
+	memcpy(out, encoding->opcode, encoding->opcode_size);
+	out += encoding->opcode_size;
+	out[-1] |= (unsigned char)(opcode_register & 7);
+	memcpy(out, address, address_end - address);
+	out += address_end - address;
+	encode_value(out, immediate, encoding->immediate_size);
+	return int(out - code);
+}
+
+bool encode_listing(const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, MachineCode& result, EncodingError& error) {
+	result.bytes.clear();
+	result.offsets.clear();
+	result.offsets.reserve(instructions.size() + 1);
+	// the jumps get their displacements once every offset is known, their length doesn't depend on it
+	std::vector<size_t> jumps{};
+	size_t used = 0, i = 0;
+	for (auto it = instructions.begin(); it != instructions.end(); ++it, i++) {
+		if (result.bytes.size() - used < ENCODER_MAX_INSTRUCTION_SIZE) result.bytes.resize(std::max(2 * result.bytes.size(), used + 4096));
+		const Instruction& instruction = *it;
+		result.offsets.push_back((unsigned int)used);
+		int size = encode_instruction(instruction, extensions, 0, result.bytes.data() + used, error.message);
+		if (!size) {
+			error.instruction = i;
+			return false;
+		}
+		used += size;
+		if (jump_displacement_operand(instruction, extensions[instruction.extension].instructions[instruction.index]) >= 0) jumps.push_back(i);
+	}
+	result.offsets.push_back((unsigned int)used);
+	result.bytes.resize(used);
+	for (size_t j : jumps) {
+		const Instruction& jump = instructions[j];
+		const InstructionFootprint& footprint = extensions[jump.extension].instructions[jump.index];
+		long long target = (long long)j + 1 + jump_displacement(jump, footprint, jump_displacement_operand(jump, footprint));
+		if (target < 0 || target > (long long)instructions.size()) {
+			error = { .instruction = j, .message = "the jump leaves the listing" };
+			return false;
+		}
+		unsigned char code[ENCODER_MAX_INSTRUCTION_SIZE];
+		int size = encode_instruction(jump, extensions, (long long)result.offsets[target] - result.offsets[j + 1], code, error.message);
+		if (!size) {
+			error.instruction = j;
+			return false;
+		}
+		memcpy(result.bytes.data() + result.offsets[j], code, size);
+	}
+	return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include "instruction_buffer.h"
+
+// x86-64 machine code from the encodings in the extension files (InstructionEncoding, the "=" lines).
+// relative jumps in the listing count instructions, in machine code they count bytes from the end of the jump.
+// the encoding of an instruction is picked from its operands only, so its length doesn't depend on where its jumps go.
+#define ENCODER_MAX_INSTRUCTION_SIZE 15
+
+// register numbers of the listing (RAX, RBX, RCX, ...) to the ones in machine code (RAX, RCX, RDX, RBX, ...)
+constexpr unsigned char ENCODER_REGISTER_NUMBERS[16] = { 0, 3, 1, 2, 6, 7, 4, 5, 8, 9, 10, 11, 12, 13, 14, 15 };
+// AH, BH, CH, DH without a REX prefix
+constexpr unsigned char ENCODER_HIGH_BYTE_NUMBERS[4] = { 4, 7, 5, 6 };
+
+// writes at most ENCODER_MAX_INSTRUCTION_SIZE bytes to <code> and returns how many, 0 if it can't be encoded, see <message>.
+// a relative jump takes <displacement> in bytes instead of its operand
+int encode_instruction(const Instruction& instruction, const std::vector<InstructionSetExtension>& extensions, long long displacement,
+	unsigned char* code, const char*& message);
+
+struct MachineCode {
+	std::vector<unsigned char> bytes{};
+	std::vector<unsigned int> offsets{}; // where each instruction starts, and the end
+};
+struct EncodingError {
+	size_t instruction;
+	const char* message;
+};
+// a jump may go to the end of the listing, the code following it then runs next
+bool encode_listing(const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, MachineCode& result, EncodingError& error);
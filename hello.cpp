@@ -11,6 +11,27 @@
 #include "instructions.h"
 #include "draw_main.h"
 #include "changes.h"
+#include "benchmarks.h"
+#include "project_file.h"
+#include "optimizer.h"
+#include "move_elimination.h"
+#include "encoder.h"
+#include "jit_harness.h"
+
+// the file dialog callback can run on another thread, so the chosen path is passed back as an event.
+// userdata is one of FILE_DIALOG_..., it ends up in event.user.code
+#define FILE_DIALOG_OPEN_LISTING 0
+#define FILE_DIALOG_OPEN_PROJECT 1
+#define FILE_DIALOG_SAVE_PROJECT 2
+Uint32 file_dialog_event = 0;
+void SDLCALL file_dialog_callback(void* userdata, const char* const* filelist, int filter) {
+    if (!filelist || !filelist[0]) return;
+    SDL_Event event{};
+    event.type = file_dialog_event;
+    event.user.code = Sint32(intptr_t(userdata));
+    event.user.data1 = SDL_strdup(filelist[0]);
+    SDL_PushEvent(&event);
+}
 
 int main(int argc, char* argv[]) {
     //try {
@@ -21,6 +42,11 @@ int main(int argc, char* argv[]) {
     //}
     test_stuff();
     // return 0;
+    if (argc > 1 && std::string_view(argv[1]) == "--benchmark") {
+        MainState main_state = init_example_main_state();
+        run_benchmarks(main_state);
+        return 0;
+    }
 
     SDL_Init(SDL_INIT_VIDEO);
     SDL_Window* window = SDL_CreateWindow("asm",
@@ -49,6 +75,19 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    // Optimize runs on its own thread, its changes are applied once it is done
+    OptimizerRun optimizer_run{};
+    // Run on This Machine measures on its own thread too, the last two measurements are shown to compare a change
+    JitRun jit_run{};
+    JitMeasurement jit_measurements[2]{}; // before, after
+    int jit_changes[2]{ -1, -1 }; // where in the history they were taken, -1 if not yet
+    int jit_change = -1;
+    std::string jit_message{};
+
+    file_dialog_event = SDL_RegisterEvents(1);
+    const SDL_DialogFileFilter listing_filters[] = { { "Listings", "txt;asm" }, { "All files", "*" } };
+    const SDL_DialogFileFilter project_filters[] = { { "Projects", "asmproj" }, { "All files", "*" } };
+
     bool running = true;
     while (running) {
         SDL_Event event;
@@ -56,6 +95,25 @@ int main(int argc, char* argv[]) {
             ImGui_ImplSDL3_ProcessEvent(&event);
             if (event.type == SDL_EVENT_QUIT)
                 running = false;
+            if (event.type == file_dialog_event) {
+                const char* path = (const char*)event.user.data1;
+                if (event.user.code == FILE_DIALOG_OPEN_LISTING) {
+                    ListingError error{};
+                    if (main_state_load_listing(main_state, path, error)) main_view.vertical_scroll_instructions = 0;
+                    else std::cout << path << ":" << error.line << ":" << error.column << ": " << error.message << "\n";
+                }
+                if (event.user.code == FILE_DIALOG_OPEN_PROJECT) {
+                    if (load_project(path, main_state)) {
+                        main_view.vertical_scroll_instructions = 0;
+                        clear_label_cache(main_view.label_cache); // the extensions changed
+                    }
+                    else std::cout << "could not open project " << path << "\n";
+                }
+                if (event.user.code == FILE_DIALOG_SAVE_PROJECT && !save_project(path, main_state))
+                    std::cout << "could not save project " << path << "\n";
+                SDL_free(event.user.data1);
+                break;
+            }
             if (event.type == SDL_EVENT_WINDOW_RESIZED) {
                 main_view.frame.w = event.window.data1;
                 main_view.frame.h = event.window.data2 - menu_height;
@@ -64,6 +122,25 @@ int main(int argc, char* argv[]) {
             if (main_view_port_handle_event(main_view, event, io.WantCaptureKeyboard, io.WantCaptureMouse)) break;
         }
 
+        main_view_port_simulate(main_view);
+
+        bool optimizer_applied = false;
+        if (optimizer_run_finish(optimizer_run, main_state, optimizer_applied)) {
+            const OptimizerResult& result = optimizer_run.result;
+            if (optimizer_applied) std::cout << "optimizer: cost " << result.start_cost << " -> " << result.cost << " with " << result.changes.size() << " changes\n";
+            else std::cout << "optimizer: the instructions changed while it ran, its " << result.changes.size() << " changes were dropped\n";
+        }
+
+        if (jit_run_finish(jit_run)) {
+            if (!jit_run.result.failure.empty()) jit_message = "could not run the instructions: " + jit_run.result.failure;
+            else {
+                jit_measurements[0] = std::move(jit_measurements[1]);
+                jit_changes[0] = jit_changes[1];
+                jit_measurements[1] = jit_run.result;
+                jit_changes[1] = jit_change;
+            }
+        }
+
         // Start the ImGui frame
         ImGui_ImplSDLRenderer3_NewFrame();
         ImGui_ImplSDL3_NewFrame();
@@ -76,7 +153,13 @@ int main(int argc, char* argv[]) {
                     // Handle New action
                 }
                 if (ImGui::MenuItem("Open")) {
-                    // Handle Open action
+                    SDL_ShowOpenFileDialog(file_dialog_callback, (void*)FILE_DIALOG_OPEN_LISTING, window, listing_filters, 2, nullptr, false);
+                }
+                if (ImGui::MenuItem("Open Project")) {
+                    SDL_ShowOpenFileDialog(file_dialog_callback, (void*)FILE_DIALOG_OPEN_PROJECT, window, project_filters, 2, nullptr, false);
+                }
+                if (ImGui::MenuItem("Save Project")) {
+                    SDL_ShowSaveFileDialog(file_dialog_callback, (void*)FILE_DIALOG_SAVE_PROJECT, window, project_filters, 2, nullptr);
                 }
                 if (ImGui::MenuItem("Exit")) {
                     running = false;
@@ -84,14 +167,25 @@ int main(int argc, char* argv[]) {
                 ImGui::EndMenu();
             }
             if (ImGui::BeginMenu("Edit")) {
-                if (main_state.change_count && ImGui::MenuItem("Undo")) {
-                    undo_last_change(main_state.instructions, main_state.extensions, &main_state.undo_redo_list[main_state.change_count - 1]);
-                    main_state.change_count--;
-                }
-                if (main_state.change_count != main_state.undo_redo_list.size() && ImGui::MenuItem("Redo")) {
-                    apply_change(main_state.instructions, main_state.extensions, &main_state.undo_redo_list[main_state.change_count]);
-                    main_state.change_count++;
+                ChangeLog& log = main_state.change_log;
+                int first = log.branches[0].start.index, last = log.branches[log.current.branch].count;
+                if (log.current.index != first && ImGui::MenuItem("Undo")) main_state_undo(main_state);
+                if (change_log_redo_branch(log) >= 0 && ImGui::MenuItem("Redo")) main_state_redo(main_state);
+                // from the start to the end of the current branch
+                int history = log.current.index;
+                if (first != last && ImGui::SliderInt("History", &history, first, last))
+                    main_state_checkout(main_state, log.current.branch, history);
+                if (log.branches.size() > 1 && ImGui::BeginMenu("Branches")) {
+                    for (int b = 0; b != int(log.branches.size()); b++) {
+                        const ChangeBranch& branch = log.branches[b];
+                        if (branch.parent == CHANGE_BRANCH_DROPPED) continue;
+                        std::string label = "Branch " + std::to_string(b) + ": changes " + std::to_string(branch.start.index) + " to " + std::to_string(branch.count);
+                        if (ImGui::MenuItem(label.c_str(), nullptr, b == log.current.branch)) main_state_checkout(main_state, b, branch.count);
+                    }
+                    ImGui::EndMenu();
                 }
+                if (ImGui::MenuItem("Eliminate Dead Moves")) main_state_eliminate_moves(main_state);
+                ImGui::MenuItem("Eliminate Dead Moves After Drag", nullptr, &main_view.eliminate_moves_after_drag);
                 ImGui::EndMenu();
             }
             if (ImGui::BeginMenu("Instructions")) {
@@ -103,13 +197,122 @@ int main(int argc, char* argv[]) {
                     }
                     SDL_SetClipboardText(result.c_str());
                 }
+                if (ImGui::MenuItem("Copy Machine Code to Clipboard")) {
+                    // one line of hex bytes per instruction
+                    MachineCode code{};
+                    EncodingError error{};
+                    if (encode_listing(main_state.instructions, main_state.extensions, code, error)) {
+                        std::string result = "";
+                        for (size_t i = 0; i + 1 < code.offsets.size(); i++) {
+                            for (unsigned int b = code.offsets[i]; b != code.offsets[i + 1]; b++) result += std::format("{:02X} ", code.bytes[b]);
+                            result.back() = '\n';
+                        }
+                        SDL_SetClipboardText(result.c_str());
+                    }
+                    else std::cout << "could not encode instruction " << error.instruction << ": " << error.message << "\n";
+                }
                 if (ImGui::MenuItem("Paste from Clipboard")) {
+                    // the listing and its history stay as they are unless the whole clipboard parses
                     char* clipboard = SDL_GetClipboardText();
-                    main_state.instructions = load_instructions(clipboard, main_state.extensions);
+                    std::vector<Instruction> instructions{};
+                    ListingError error{};
+                    if (!clipboard) std::cout << "could not read the clipboard: " << SDL_GetError() << "\n";
+                    else if (parse_listing(clipboard, instructions, main_state.extensions, &main_state.mnemonics, error))
+                        main_state_set_instructions(main_state, std::move(instructions));
+                    else std::cout << "clipboard:" << error.line << ":" << error.column << ": " << error.message << "\n";
                     SDL_free(clipboard);
                 }
                 ImGui::EndMenu();
             }
+            if (ImGui::BeginMenu("Optimize")) {
+                // runs on all cores in the background, the found changes end up in the undo list
+                OptimizerSettings settings = default_optimizer_settings();
+                bool running_already = optimizer_run_running(optimizer_run);
+                if (running_already) {
+                    ImGui::ProgressBar(optimizer_run_progress(optimizer_run), ImVec2(200, 0));
+                    // the best program found until then is still applied
+                    if (ImGui::MenuItem("Stop")) optimizer_run.progress.cancel = true;
+                    ImGui::Separator();
+                }
+                ImGui::BeginDisabled(running_already);
+                bool run = ImGui::MenuItem("In-Order Cycles");
+                if (ImGui::MenuItem("Out-of-Order Cycles")) {
+                    settings.cost = optimizer_cost_out_of_order_cycles;
+                    run = true;
+                }
+                if (ImGui::MenuItem("Instruction Count")) {
+                    settings.cost = optimizer_cost_instruction_count;
+                    settings.start_temperature = 1;
+                    settings.end_temperature = 0.05;
+                    run = true;
+                }
+                ImGui::EndDisabled();
+                if (run) optimizer_run_start(optimizer_run, main_state, settings);
+                ImGui::EndMenu();
+            }
+            if (ImGui::BeginMenu("Simulation")) {
+                ImGui::MenuItem("Show Timeline", nullptr, &main_view.show_simulation);
+                SimulatorSettings& settings = main_view.simulator_settings;
+                ImGui::SliderInt("Dispatch Width", &settings.dispatch_width, 1, 8);
+                ImGui::SliderInt("Retire Width", &settings.retire_width, 1, 8);
+                ImGui::SliderInt("Reorder Buffer", &settings.reorder_buffer_size, 1, 512);
+                ImGui::SliderInt("Ports", &settings.nr_ports, 1, SIMULATOR_MAX_PORTS);
+                ImGui::InputScalar("ALU Ports", ImGuiDataType_U32, &settings.alu_ports, nullptr, nullptr, "%x", ImGuiInputTextFlags_CharsHexadecimal);
+                ImGui::InputScalar("Load Ports", ImGuiDataType_U32, &settings.load_ports, nullptr, nullptr, "%x", ImGuiInputTextFlags_CharsHexadecimal);
+                ImGui::InputScalar("Store Ports", ImGuiDataType_U32, &settings.store_ports, nullptr, nullptr, "%x", ImGuiInputTextFlags_CharsHexadecimal);
+                ImGui::SliderInt("ALU Latency", &settings.alu_latency, 1, 20);
+                ImGui::SliderInt("Load Latency", &settings.load_latency, 1, 20);
+                ImGui::SliderInt("Store Latency", &settings.store_latency, 1, 20);
+                // instructions without a timing in the profile keep using the numbers above
+                if (ImGui::BeginCombo("Timings", settings.profile.empty() ? "None" : settings.profile.c_str())) {
+                    if (ImGui::Selectable("None", settings.profile.empty())) settings.profile.clear();
+                    for (auto& profile : timing_profiles(main_state.extensions))
+                        if (ImGui::Selectable(profile.c_str(), profile == settings.profile)) settings.profile = profile;
+                    ImGui::EndCombo();
+                }
+                if (ImGui::BeginMenu("Compare Timings")) {
+                    main_view_port_compare_timings(main_view);
+                    for (size_t p = 0; p != main_view.compared_profiles.size(); p++) {
+                        const SimulationResult& result = main_view.compared_simulations[p];
+                        ImGui::Text("%s: %lld cycles, %.2f IPC", main_view.compared_profiles[p].c_str(), result.cycles, result.instructions_per_cycle);
+                    }
+                    ImGui::EndMenu();
+                }
+                // the real thing for comparison, encoded and timed on this core
+                bool measuring = jit_run_running(jit_run);
+                if (ImGui::MenuItem("Run on This Machine", nullptr, false, !measuring)) {
+                    MachineCode code{};
+                    EncodingError error{};
+                    if (!encode_listing(main_state.instructions, main_state.extensions, code, error))
+                        jit_message = "could not encode instruction " + std::to_string(error.instruction) + ": " + error.message;
+                    else {
+                        jit_message.clear();
+                        jit_change = main_state.change_log.current.index;
+                        jit_run_start(jit_run, std::move(code.bytes), default_jit_settings());
+                    }
+                }
+                if (measuring) ImGui::Text("measuring...");
+                if (!jit_message.empty()) ImGui::Text("%s", jit_message.c_str());
+                for (int m = 0; m != 2; m++) {
+                    const JitMeasurement& measurement = jit_measurements[m];
+                    if (jit_changes[m] < 0) continue;
+                    ImGui::Text("%s change %d: %lld ticks median, %lld best", m ? "after" : "before", jit_changes[m], measurement.median_ticks, measurement.min_ticks);
+                    if (measurement.min_cycles >= 0) {
+                        ImGui::SameLine();
+                        ImGui::Text(", %lld cycles median, %lld best", measurement.median_cycles, measurement.min_cycles);
+                    }
+                }
+                if (ImGui::MenuItem("Reset")) settings = default_simulator_settings();
+                ImGui::EndMenu();
+            }
+            if (optimizer_run_running(optimizer_run)) ImGui::Text("optimizing %.0f%%", optimizer_run_progress(optimizer_run) * 100);
+            // while dragging also how many cycles the change would gain or lose
+            if (main_view.show_simulation) {
+                const SimulationResult& simulation = main_view.simulation;
+                if (main_state.temporary_change.type)
+                    ImGui::Text("%lld cycles (%+lld), %.2f IPC", simulation.cycles, simulation.cycles - main_view.cycles_before_drag, simulation.instructions_per_cycle);
+                else ImGui::Text("%lld cycles, %.2f IPC", simulation.cycles, simulation.instructions_per_cycle);
+            }
             ImGui::EndMainMenuBar();
         }
         ImGui::Render();
@@ -139,6 +342,10 @@ int main(int argc, char* argv[]) {
     }
 
     // Cleanup
+    optimizer_run.progress.cancel = true;
+    if (optimizer_run_running(optimizer_run)) optimizer_run.thread.join();
+    if (jit_run_running(jit_run)) jit_run.thread.join();
+    clear_label_cache(main_view.label_cache);
     ImGui_ImplSDLRenderer3_Shutdown();
     ImGui_ImplSDL3_Shutdown();
     ImGui::DestroyContext();
@@ -0,0 +1,237 @@
+#include "instruction_buffer.h"
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+
+InstructionBuffer::InstructionBuffer(std::span<const Instruction> instructions) {
+	for (size_t start = 0; start < instructions.size(); start += INSTRUCTION_CHUNK_SIZE) {
+		size_t end = std::min(instructions.size(), start + INSTRUCTION_CHUNK_SIZE);
+		chunks.push_back(std::make_shared<std::vector<Instruction>>(instructions.begin() + start, instructions.begin() + end));
+		chunk_starts.push_back(end);
+	}
+}
+
+std::vector<Instruction>& InstructionBuffer::own_chunk(size_t chunk) {
+	if (chunks[chunk].use_count() != 1) chunks[chunk] = std::make_shared<std::vector<Instruction>>(*chunks[chunk]);
+	// the other owner may have dropped it on another thread, its reads happen before
+	else std::atomic_thread_fence(std::memory_order_acquire);
+	return *chunks[chunk];
+}
+
+// const buffers are read from several threads at once, so the last found chunk is kept per thread.
+// it is only a guess checked against chunk_starts, it may come from another buffer
+static thread_local size_t cached_chunk = 0;
+
+size_t InstructionBuffer::find_chunk(size_t index) const {
+	size_t c = cached_chunk;
+	if (c < chunks.size() && chunk_starts[c] <= index && index < chunk_starts[c + 1]) return c;
+	if (c + 1 < chunks.size() && chunk_starts[c + 1] <= index && index < chunk_starts[c + 2]) return cached_chunk = c + 1;
+	c = std::upper_bound(chunk_starts.begin(), chunk_starts.end() - 1, index) - chunk_starts.begin() - 1;
+	return cached_chunk = c;
+}
+
+void InstructionBuffer::insert(size_t index, std::span<const Instruction> instructions) {
+	if (instructions.empty()) return;
+	if (chunks.empty()) {
+		chunks.push_back(std::make_shared<std::vector<Instruction>>());
+		chunk_starts.push_back(0);
+	}
+	size_t c = (index == size()) ? chunks.size() - 1 : find_chunk(index);
+	auto& chunk = own_chunk(c);
+	chunk.insert(chunk.begin() + (index - chunk_starts[c]), instructions.begin(), instructions.end());
+	for (size_t i = c + 1; i != chunk_starts.size(); i++) chunk_starts[i] += instructions.size();
+	if (chunk.size() <= 2 * INSTRUCTION_CHUNK_SIZE) return;
+	// keep the first INSTRUCTION_CHUNK_SIZE, the rest goes into new chunks of at most that size
+	std::vector<InstructionChunk> rest{};
+	std::vector<size_t> rest_starts{};
+	for (size_t start = INSTRUCTION_CHUNK_SIZE; start < chunk.size(); start += INSTRUCTION_CHUNK_SIZE) {
+		rest.push_back(std::make_shared<std::vector<Instruction>>(chunk.begin() + start, chunk.begin() + std::min(chunk.size(), start + INSTRUCTION_CHUNK_SIZE)));
+		rest_starts.push_back(chunk_starts[c] + start);
+	}
+	chunk.resize(INSTRUCTION_CHUNK_SIZE);
+	chunks.insert(chunks.begin() + c + 1, std::make_move_iterator(rest.begin()), std::make_move_iterator(rest.end()));
+	chunk_starts.insert(chunk_starts.begin() + c + 1, rest_starts.begin(), rest_starts.end());
+}
+
+void InstructionBuffer::erase(size_t index, size_t count) {
+	while (count) {
+		size_t c = find_chunk(index);
+		auto& chunk = own_chunk(c);
+		size_t offset = index - chunk_starts[c];
+		size_t erased = std::min(count, chunk.size() - offset);
+		chunk.erase(chunk.begin() + offset, chunk.begin() + offset + erased);
+		for (size_t i = c + 1; i != chunk_starts.size(); i++) chunk_starts[i] -= erased;
+		count -= erased;
+		// merge with the next chunk once both fit into one, this also drops empty chunks
+		if (c + 1 < chunks.size() && chunk.size() + chunks[c + 1]->size() <= INSTRUCTION_CHUNK_SIZE) {
+			chunk.insert(chunk.end(), chunks[c + 1]->begin(), chunks[c + 1]->end());
+			chunks.erase(chunks.begin() + c + 1);
+			chunk_starts.erase(chunk_starts.begin() + c + 1);
+		}
+		else if (chunk.empty()) {
+			chunks.erase(chunks.begin() + c);
+			chunk_starts.erase(chunk_starts.begin() + c);
+		}
+	}
+}
+
+void InstructionBuffer::erase(std::span<const int> positions) {
+	if (positions.empty()) return;
+	std::vector<char> shrunk(chunks.size(), 0);
+	for (size_t p = 0; p != positions.size(); ) {
+		size_t c = find_chunk(positions[p]);
+		auto& chunk = own_chunk(c);
+		size_t start = chunk_starts[c], kept = positions[p] - start;
+		for (size_t i = kept; i != chunk.size(); i++) {
+			if (p != positions.size() && size_t(positions[p]) == start + i) p++;
+			else chunk[kept++] = chunk[i];
+		}
+		chunk.resize(kept);
+		shrunk[c] = 1;
+	}
+	// the offsets once for all of them, a chunk that got smaller is merged with the one before it like in erase
+	size_t kept = 0;
+	for (size_t c = 0; c != chunks.size(); c++) {
+		if (chunks[c]->empty()) continue;
+		if (kept && (shrunk[c] || shrunk[kept - 1]) && chunks[kept - 1]->size() + chunks[c]->size() <= INSTRUCTION_CHUNK_SIZE) {
+			auto& previous = own_chunk(kept - 1);
+			previous.insert(previous.end(), chunks[c]->begin(), chunks[c]->end());
+			continue;
+		}
+		shrunk[kept] = shrunk[c];
+		chunks[kept++] = std::move(chunks[c]);
+	}
+	chunks.resize(kept);
+	chunk_starts.resize(kept + 1);
+	for (size_t c = 0; c != kept; c++) chunk_starts[c + 1] = chunk_starts[c] + chunks[c]->size();
+}
+void InstructionBuffer::insert(std::span<const int> positions, std::span<const Instruction> instructions) {
+	if (positions.empty()) return;
+	if (chunks.empty()) {
+		chunks.push_back(std::make_shared<std::vector<Instruction>>());
+		chunk_starts.push_back(0);
+	}
+	// instructions[p] goes in front of positions[p] - p before inserting, or behind the last chunk
+	for (size_t p = 0; p != positions.size(); ) {
+		size_t c = positions[p] - p == size() ? chunks.size() - 1 : find_chunk(positions[p] - p);
+		const auto& chunk = *chunks[c];
+		size_t start = chunk_starts[c];
+		std::vector<Instruction> merged{};
+		merged.reserve(chunk.size() + positions.size() - p);
+		for (size_t i = 0; i != chunk.size(); i++) {
+			for (; p != positions.size() && positions[p] - p == start + i; p++) merged.push_back(instructions[p]);
+			merged.push_back(chunk[i]);
+		}
+		if (c + 1 == chunks.size()) for (; p != positions.size(); p++) merged.push_back(instructions[p]);
+		// the chunk may still be shared with a copy
+		chunks[c] = std::make_shared<std::vector<Instruction>>(std::move(merged));
+	}
+	// split the chunks that got too large like insert does, and the offsets once for all of them
+	std::vector<InstructionChunk> result{};
+	result.reserve(chunks.size());
+	for (auto& chunk : chunks) {
+		if (chunk->size() <= 2 * INSTRUCTION_CHUNK_SIZE) {
+			result.push_back(std::move(chunk));
+			continue;
+		}
+		for (size_t start = 0; start < chunk->size(); start += INSTRUCTION_CHUNK_SIZE)
+			result.push_back(std::make_shared<std::vector<Instruction>>(chunk->begin() + start, chunk->begin() + std::min(chunk->size(), start + INSTRUCTION_CHUNK_SIZE)));
+	}
+	chunks = std::move(result);
+	chunk_starts.resize(chunks.size() + 1);
+	for (size_t c = 0; c != chunks.size(); c++) chunk_starts[c + 1] = chunk_starts[c] + chunks[c]->size();
+}
+
+void InstructionBuffer::rotate(size_t first, size_t middle, size_t last) {
+	if (first == middle || middle == last) return;
+	size_t c = find_chunk(first);
+	if (last <= chunk_starts[c + 1]) {
+		auto begin = own_chunk(c).begin();
+		size_t start = chunk_starts[c];
+		std::rotate(begin + (first - start), begin + (middle - start), begin + (last - start));
+		return;
+	}
+	std::vector<Instruction> range{};
+	for (size_t i = first; i != last; i++) range.push_back((*this)[i]);
+	std::rotate(range.begin(), range.begin() + (middle - first), range.end());
+	for (size_t i = first; i != last; i++) modify(i) = range[i - first];
+}
+
+std::vector<Instruction> InstructionBuffer::to_vector() const {
+	std::vector<Instruction> result{};
+	result.reserve(size());
+	for (auto& chunk : chunks) result.insert(result.end(), chunk->begin(), chunk->end());
+	return result;
+}
+
+int inserted_in_front(std::span<const int> positions, long long index) {
+	size_t low = 0, high = positions.size();
+	while (low != high) {
+		size_t middle = (low + high) / 2;
+		if (positions[middle] - (long long)middle <= index) low = middle + 1;
+		else high = middle;
+	}
+	return int(low);
+}
+
+bool same_instruction(const Instruction& a, const Instruction& b) {
+	return a.extension == b.extension && a.index == b.index && std::equal(a.operands, a.operands + 4, b.operands);
+}
+
+void instruction_buffer_difference(const InstructionBuffer& before, const InstructionBuffer& after, size_t& first, size_t& end,
+	bool (*same)(const Instruction&, const Instruction&)) {
+	size_t common = std::min(before.size(), after.size());
+	size_t c = 0;
+	while (c < before.chunks.size() && c < after.chunks.size() && before.chunks[c] == after.chunks[c]) c++;
+	first = std::min(before.chunk_starts[c], common);
+	// walking the chunks of both, indexing would search them for every instruction
+	for (size_t cb = c, ca = c, ob = 0, oa = 0; first != common; first++, ob++, oa++) {
+		if (ob == before.chunks[cb]->size()) cb++, ob = 0;
+		if (oa == after.chunks[ca]->size()) ca++, oa = 0;
+		if (!same((*before.chunks[cb])[ob], (*after.chunks[ca])[oa])) break;
+	}
+	// the same from the back, the unchanged tail can't overlap the unchanged head
+	size_t cb = before.chunks.size(), ca = after.chunks.size();
+	while (cb && ca && before.chunks[cb - 1] == after.chunks[ca - 1]) cb--, ca--;
+	size_t tail = std::min(before.size() - before.chunk_starts[cb], common - first);
+	if (tail != common - first) {
+		cb = before.find_chunk(before.size() - 1 - tail);
+		ca = after.find_chunk(after.size() - 1 - tail);
+		// offsets behind the instruction compared next
+		size_t ob = before.size() - tail - before.chunk_starts[cb], oa = after.size() - tail - after.chunk_starts[ca];
+		for (; tail != common - first; tail++, ob--, oa--) {
+			if (!ob) ob = before.chunks[--cb]->size();
+			if (!oa) oa = after.chunks[--ca]->size();
+			if (!same((*before.chunks[cb])[ob - 1], (*after.chunks[ca])[oa - 1])) break;
+		}
+	}
+	end = after.size() - tail;
+}
+
+void instruction_buffer_runs(const InstructionBuffer& before, const InstructionBuffer& after, std::vector<InstructionRun>& runs) {
+	runs.clear();
+	// chunks are shared in the same order by both, so a run ends at the next chunk of <before> that <after> has later on
+	std::unordered_map<const std::vector<Instruction>*, size_t> in_after{};
+	for (size_t c = 0; c != after.chunks.size(); c++) in_after[after.chunks[c].get()] = c;
+	size_t cb = 0, ca = 0;
+	while (cb != before.chunks.size() || ca != after.chunks.size()) {
+		if (cb != before.chunks.size() && ca != after.chunks.size() && before.chunks[cb] == after.chunks[ca]) {
+			cb++, ca++;
+			continue;
+		}
+		size_t end_before = cb, end_after = after.chunks.size();
+		for (; end_before != before.chunks.size(); end_before++) {
+			auto found = in_after.find(before.chunks[end_before].get());
+			if (found != in_after.end() && found->second >= ca) {
+				end_after = found->second;
+				break;
+			}
+		}
+		size_t first_before = before.chunk_starts[cb], first = after.chunk_starts[ca];
+		size_t last_before = before.chunk_starts[end_before], last = after.chunk_starts[end_after];
+		while (first_before != last_before && first != last && same_instruction(before[first_before], after[first])) first_before++, first++;
+		while (first_before != last_before && first != last && same_instruction(before[last_before - 1], after[last - 1])) last_before--, last--;
+		if (first_before != last_before || first != last) runs.push_back({ first, last_before - first_before, last - first });
+		cb = end_before, ca = end_after;
+	}
+}
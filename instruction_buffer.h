@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <span>
+#include <memory>
+#include "instructions.h"
+
+// instruction sequence stored in chunks of up to 2*INSTRUCTION_CHUNK_SIZE instructions.
+// inserting or erasing only moves the instructions of one chunk and the chunk offsets,
+// indexing is a binary search over the chunk offsets (sequential access hits the chunk last found on the thread).
+// copies share their chunks, a chunk is copied the first time one of the buffers sharing it changes it
+#define INSTRUCTION_CHUNK_SIZE 512
+typedef std::shared_ptr<std::vector<Instruction>> InstructionChunk;
+struct InstructionBuffer {
+	std::vector<InstructionChunk> chunks{};
+	std::vector<size_t> chunk_starts{ 0 }; // index of chunks[i][0], the last entry is size()
+
+	InstructionBuffer() = default;
+	InstructionBuffer(std::span<const Instruction> instructions);
+	InstructionBuffer(std::initializer_list<Instruction> instructions) : InstructionBuffer(std::span<const Instruction>(instructions.begin(), instructions.size())) {}
+
+	size_t size() const { return chunk_starts.back(); }
+	bool empty() const { return size() == 0; }
+	size_t find_chunk(size_t index) const;
+	const Instruction& operator[](size_t index) const { size_t c = find_chunk(index); return (*chunks[c])[index - chunk_starts[c]]; }
+	// for changing the instruction, its chunk stops being shared
+	Instruction& modify(size_t index) { size_t c = find_chunk(index); return own_chunk(c)[index - chunk_starts[c]]; }
+	std::vector<Instruction>& own_chunk(size_t chunk);
+
+	void insert(size_t index, const Instruction& instruction) { insert(index, std::span<const Instruction>(&instruction, 1)); }
+	// the whole range is inserted into one chunk, which is split afterwards if it got too large
+	void insert(size_t index, std::span<const Instruction> instructions);
+	void erase(size_t index, size_t count = 1);
+	// the instructions at <positions> (sorted, counted before erasing) in one pass over their chunks
+	void erase(std::span<const int> positions);
+	// instructions[i] ends up at positions[i] (sorted, counted after inserting), in one pass over their chunks
+	void insert(std::span<const int> positions, std::span<const Instruction> instructions);
+	void push_back(const Instruction& instruction) { insert(size(), instruction); }
+	// same as std::rotate on [first, last): middle becomes the first element
+	void rotate(size_t first, size_t middle, size_t last);
+	std::vector<Instruction> to_vector() const;
+
+	struct const_iterator {
+		const InstructionBuffer* buffer;
+		size_t chunk;
+		size_t offset;
+		const Instruction& operator*() const { return (*buffer->chunks[chunk])[offset]; }
+		const_iterator& operator++() {
+			if (++offset == buffer->chunks[chunk]->size()) {
+				chunk++;
+				offset = 0;
+			}
+			return *this;
+		}
+		bool operator==(const const_iterator& other) const { return chunk == other.chunk && offset == other.offset; }
+	};
+	const_iterator begin() const { return { this, 0, 0 }; }
+	const_iterator end() const { return { this, chunks.size(), 0 }; }
+};
+
+bool same_instruction(const Instruction& a, const Instruction& b);
+// number of <positions> (sorted, counted after inserting) that go in front of instruction <index> before inserting them.
+// the same for erased ones: how many were in front of instruction <index> after erasing them
+int inserted_in_front(std::span<const int> positions, long long index);
+// <after> is <before> with [first, end) replacing [first, end + before.size() - after.size()), the instructions around it are the same.
+// chunks both buffers share are skipped, the others are compared with <same>
+void instruction_buffer_difference(const InstructionBuffer& before, const InstructionBuffer& after, size_t& first, size_t& end,
+	bool (*same)(const Instruction&, const Instruction&) = same_instruction);
+// [first, first + old_count) of <before> replaced by [first, first + new_count) of <after>. first counts the instructions
+// of <after>, so the runs in front of it are already replaced
+struct InstructionRun {
+	size_t first;
+	size_t old_count;
+	size_t new_count;
+};
+// the runs in which <after> differs from <before>, in order. chunks both share are skipped, the others are compared
+// only from both ends of a run, so a run can still hold instructions that did not change
+void instruction_buffer_runs(const InstructionBuffer& before, const InstructionBuffer& after, std::vector<InstructionRun>& runs);
@@ -2,6 +2,9 @@
 #include "ctre.hpp"
 #include <cassert>
 #include <format>
+#include <algorithm>
+#include <charconv>
+#include "mapped_file.h"
 
 #define RX_REGISTER "r[a-d]x|r[sd]i|r[sb]p|r[89]|r1[0-5]|R[A-D]X|R[SD]I|R[SB]P|R[89]|R1[0-5]"
 #define RX_SIMD_REGISTER "[xyz]mm[12][0-9]|[xyz]mm3[01]|[xyz]mm[0-9]|[XYZ]MM[12][0-9]|[XYZ]MM3[01]|[XYZ]MM[0-9]"
@@ -74,15 +77,134 @@ OperandFootprint read_operand_footprint(std::string_view& source) {
 	}
 	return OperandFootprint{};
 }
+// "=<roles> <encoding>" of the footprint at <index>, false if it doesn't fit the footprint
+bool read_instruction_encoding(std::string_view roles, std::string_view rest, const InstructionFootprint& footprint, unsigned int index, InstructionEncoding& result) {
+	result = { .instruction = index, .roles = {}, .prefixes = 0, .vex = 0, .opcode = {}, .opcode_size = 0, .modrm = ENCODE_NO_MODRM, .immediate_size = 0 };
+	bool relative = false;
+	while (auto t = ctre::match<"\\s*([0-9A-F]{2}|REX[.]W|REX|VEX[.][0-9A-Z.]+|/[0-7r]|[ic][bwd])(.*)">(rest)) {
+		rest = t.get<2>().to_view();
+		auto token = t.get<1>().to_view();
+		// prefixes before the opcode, ModRM and immediate behind it
+		bool after_opcode = token[0] == '/' || token[0] == 'i' || token[0] == 'c';
+		if ((result.opcode_size != 0) != after_opcode && (after_opcode || token.size() != 2)) return false;
+		if (token == "REX.W") result.prefixes |= ENCODE_REX_W;
+		else if (token == "REX") result.prefixes |= ENCODE_BYTE_REGISTERS;
+		else if (token.starts_with("VEX")) {
+			auto v = ctre::match<"VEX[.](128|256)([.](66|F2|F3))?[.](0F|0F38|0F3A)[.](W0|W1|WIG)">(token);
+			if (!v || result.prefixes) return false;
+			result.prefixes = ENCODE_VEX | (v.get<3>().to_view() == "66" ? ENCODE_PREFIX_66 : v.get<3>().to_view() == "F2" ? ENCODE_PREFIX_F2
+				: v.get<3>().to_view() == "F3" ? ENCODE_PREFIX_F3 : 0);
+			auto map = v.get<4>().to_view();
+			result.vex = (map == "0F" ? 1 : map == "0F38" ? 2 : 3) | (v.get<1>().to_view() == "256" ? ENCODE_VEX_L : 0) | (v.get<5>().to_view() == "W1" ? ENCODE_VEX_W : 0);
+		}
+		else if (token[0] == '/') {
+			if (result.modrm != ENCODE_NO_MODRM || result.immediate_size) return false;
+			result.modrm = token[1] == 'r' ? ENCODE_MODRM_REG : token[1] - '0';
+		}
+		else if (after_opcode) {
+			if (result.immediate_size) return false;
+			result.immediate_size = token[1] == 'b' ? 1 : token[1] == 'w' ? 2 : 4;
+			relative = token[0] == 'c';
+		}
+		else if (!result.opcode_size && !(result.prefixes & (ENCODE_VEX | ENCODE_REX_W | ENCODE_BYTE_REGISTERS)) && (token == "66" || token == "F2" || token == "F3"))
+			result.prefixes |= token == "66" ? ENCODE_PREFIX_66 : token == "F2" ? ENCODE_PREFIX_F2 : ENCODE_PREFIX_F3;
+		else {
+			if (result.opcode_size == ((result.prefixes & ENCODE_VEX) ? 1 : 3) || result.modrm != ENCODE_NO_MODRM || result.immediate_size) return false;
+			auto digit = [](char d) { return d <= '9' ? d - '0' : d - 'A' + 10; };
+			result.opcode[result.opcode_size++] = (unsigned char)(digit(token[0]) << 4 | digit(token[1]));
+		}
+	}
+	if (!result.opcode_size || !ctre::match<"\\s*(#.*)?">(rest)) return false;
+
+	// one role for each explicit operand, each role at most once
+	unsigned char used = 0;
+	size_t r = 0;
+	for (int i = 0; i != 4; i++) {
+		OperandFootprint operand = footprint.operands[i];
+		if (!operand.head || (operand.head & OF_TYPE) == OF_DEREF) continue;
+		if (r == roles.size()) return false;
+		unsigned char kinds = accepted_operand_kinds(operand);
+		unsigned char registers = kinds & (OK_REGISTER | OK_HIGH_BYTE | OK_LOW_SIMD | OK_HIGH_SIMD);
+		unsigned char role = 0;
+		bool fits = false;
+		switch (roles[r++]) {
+		case 'R': role = ENCODE_ROLE_REG; fits = registers; break;
+		case 'M': role = ENCODE_ROLE_RM; fits = registers || (kinds & OK_MEMORY); break;
+		case 'O': role = ENCODE_ROLE_OPCODE; fits = kinds & (OK_REGISTER | OK_HIGH_BYTE); break;
+		case 'V': role = ENCODE_ROLE_VVVV; fits = (kinds & (OK_REGISTER | OK_LOW_SIMD | OK_HIGH_SIMD)) && (result.prefixes & ENCODE_VEX); break;
+		case 'I': role = ENCODE_ROLE_IMMEDIATE; fits = (kinds & OK_IMMEDIATE) && !relative && result.immediate_size <= (operand.head & OF_IMMEDIATE_SIZE)
+			&& footprint.jump_type != UNCONDITIONAL_RELATIVE && footprint.jump_type != CONDITIONAL_RELATIVE; break;
+		case 'J': role = ENCODE_ROLE_RELATIVE; fits = (kinds & OK_IMMEDIATE) && relative && result.immediate_size == (operand.head & OF_IMMEDIATE_SIZE)
+			&& (footprint.jump_type == UNCONDITIONAL_RELATIVE || footprint.jump_type == CONDITIONAL_RELATIVE); break;
+		}
+		if (!fits || (used & (1 << role))) return false;
+		used |= 1 << role;
+		result.roles[i] = role;
+	}
+	if (r != roles.size()) return false;
+	bool has_immediate = used & ((1 << ENCODE_ROLE_IMMEDIATE) | (1 << ENCODE_ROLE_RELATIVE));
+	if (has_immediate != (result.immediate_size != 0)) return false;
+	// /r puts an operand into ModRM.reg, /0 to /7 a digit, either needs an operand in ModRM.rm
+	if ((result.modrm == ENCODE_MODRM_REG) != bool(used & (1 << ENCODE_ROLE_REG))) return false;
+	if ((result.modrm != ENCODE_NO_MODRM) != bool(used & (1 << ENCODE_ROLE_RM))) return false;
+	return true;
+}
+
 InstructionSetExtension read_instruction_set_extension(const std::string& filePath) {
-	std::ifstream file(filePath);
-	if (!file) throw ParserError{ &filePath, -1 };
-	std::string line;
+	MappedFile file;
+	if (!map_file(filePath.c_str(), file)) throw ParserError{ &filePath, -1 };
+	try {
+		InstructionSetExtension ise = read_instruction_set_extension(mapped_view(file), filePath);
+		unmap_file(file);
+		return ise;
+	}
+	catch (ParserError&) {
+		unmap_file(file);
+		throw;
+	}
+}
+// the timing of the instruction above it, for one profile
+struct TimingAnnotation {
+	int profile;
+	size_t instruction;
+	InstructionTiming timing;
+};
+InstructionSetExtension read_instruction_set_extension(std::string_view source, const std::string& filePath) {
 	int linenr = 0;
 	InstructionSetExtension ise{};
-	while (std::getline(file, line)) {
+	std::vector<std::string_view> profiles{};
+	std::vector<TimingAnnotation> annotations{};
+	while (source.size()) {
 		linenr++;
+		size_t line_end = source.find('\n');
+		std::string_view line = source.substr(0, line_end);
+		source.remove_prefix((line_end == std::string_view::npos) ? source.size() : line_end + 1);
+		if (line.size() && line.back() == '\r') line.remove_suffix(1);
 		if (ctre::match<"\\s*(#.*)?">(line)) continue;
+		if (auto t = ctre::match<"\\s*@([a-zA-Z_][a-zA-Z0-9_]*)\\s+([0-9]{1,4})\\s+([0-9]{1,4}[.]?[0-9]{0,4})\\s+p([0-9A-F]{1,16})\\s*(#.*)?">(line)) {
+			if (ise.instructions.empty()) throw ParserError{ &filePath, linenr };
+			auto name = t.get<1>().to_view();
+			int profile = int(std::find(profiles.begin(), profiles.end(), name) - profiles.begin());
+			if (profile == int(profiles.size())) profiles.push_back(name);
+			TimingAnnotation annotation{ .profile = profile, .instruction = ise.instructions.size() - 1, .timing = {} };
+			for (auto other = annotations.rbegin(); other != annotations.rend() && other->instruction == annotation.instruction; other++)
+				if (other->profile == profile) throw ParserError{ &filePath, linenr };
+			annotation.timing.latency = read_number<unsigned short, 10>(t.get<2>().to_view());
+			auto throughput = t.get<3>().to_view();
+			std::from_chars(throughput.data(), throughput.data() + throughput.size(), annotation.timing.reciprocal_throughput);
+			for (char port : t.get<4>().to_view()) annotation.timing.ports |= 1 << (port <= '9' ? port - '0' : port - 'A' + 10);
+			if (!annotation.timing.latency) throw ParserError{ &filePath, linenr };
+			annotations.push_back(annotation);
+			continue;
+		}
+		if (auto e = ctre::match<"\\s*=([RMOVIJ]{0,4})\\s+(.*)">(line)) {
+			if (ise.instructions.empty()) throw ParserError{ &filePath, linenr };
+			InstructionEncoding encoding;
+			if (!read_instruction_encoding(e.get<1>().to_view(), e.get<2>().to_view(), ise.instructions.back(), unsigned int(ise.instructions.size() - 1), encoding))
+				throw ParserError{ &filePath, linenr };
+			ise.encodings.push_back(encoding);
+			continue;
+		}
 		auto m = ctre::match<"\\s*([a-zA-Z_][a-zA-Z0-9_]*)\\s+"
 			"([01]{8})\\s*0{8}\\s*([01]{7})\\s*([0-7])\\s*([01])\\s*"
 			"([01]{8})\\s*0{8}\\s*([01]{7})\\s*([0-7])\\s*([01])(.*)">(line);
@@ -107,9 +229,43 @@ InstructionSetExtension read_instruction_set_extension(const std::string& filePa
 		if (!ctre::match<"\\s*(#.*)?">(rest)) throw ParserError{ &filePath, linenr };
 		ise.instructions.push_back(inst);
 	}
+	for (auto profile : profiles) {
+		ise.profile_names.insert(ise.profile_names.end(), profile.begin(), profile.end());
+		ise.profile_names.push_back('\0');
+	}
+	ise.timings.resize(profiles.size() * ise.instructions.size());
+	for (auto& annotation : annotations) ise.timings[annotation.profile * ise.instructions.size() + annotation.instruction] = annotation.timing;
 	return ise;
 }
 
+int timing_profile_index(const InstructionSetExtension& extension, std::string_view name) {
+	int index = 0;
+	for (size_t start = 0; start < extension.profile_names.size(); index++) {
+		std::string_view profile(&extension.profile_names[start]);
+		if (profile == name) return index;
+		start += profile.size() + 1;
+	}
+	return -1;
+}
+std::vector<std::string> timing_profiles(const std::vector<InstructionSetExtension>& extensions) {
+	std::vector<std::string> result{};
+	for (auto& extension : extensions)
+		for (size_t start = 0; start < extension.profile_names.size(); ) {
+			std::string profile(&extension.profile_names[start]);
+			start += profile.size() + 1;
+			if (std::find(result.begin(), result.end(), profile) == result.end()) result.push_back(std::move(profile));
+		}
+	return result;
+}
+
+std::pair<size_t, size_t> instruction_encodings(const InstructionSetExtension& extension, unsigned int index) {
+	auto by_instruction = [](const InstructionEncoding& encoding, unsigned int index) { return encoding.instruction < index; };
+	auto first = std::lower_bound(extension.encodings.begin(), extension.encodings.end(), index, by_instruction);
+	auto end = first;
+	while (end != extension.encodings.end() && end->instruction == index) end++;
+	return { size_t(first - extension.encodings.begin()), size_t(end - extension.encodings.begin()) };
+}
+
 std::string print_instruction_footprint(std::vector<InstructionSetExtension>& ises, int ext, int inst) {
 	InstructionFootprint footprint = ises[ext].instructions[inst];
 	char* name = &ises[ext].names[footprint.name];
@@ -139,25 +295,23 @@ std::string print_instruction(const Instruction& inst, const std::vector<Instruc
 	auto& footprint = ises[inst.extension].instructions[inst.index];
 	std::string result { &ises[inst.extension].names[footprint.name] };
 	for (int i = 0; i != 4; i++) if (auto op = inst.operands[i]) {
-		if (OP_IS_HIGH_BYTE(op)) result += HIGH_BYTE_NAMES[OP_HIGH_BYTE(op)];
+		if (OP_IS_HIGH_BYTE(op)) { result += " "; result += HIGH_BYTE_NAMES[OP_HIGH_BYTE(op)]; }
 		else if (OP_IS_REGISTER(op)) { result += " "; result += REGISTER_NAMES[OP_REGISTER(op)]; }
 		else if (OP_IS_IMMEDIATE(op)) {
 			result += " 0x";
 			for (int j = 28; j >= 0; j -= 4) result += HEX[(op >> j) & 0xf];
 		}
-		else if (OP_IS_RIP_RELATIVE(op)) {
-			result += std::format(" *RIP[{}]", int(OP_RIP_RELATIVE(op)));
-			for (int j = 28; j >= 0; j -= 4) result += HEX[(op >> j) & 0xf];
-			result += "]";
-		}
+		else if (OP_IS_RIP_RELATIVE(op)) result += std::format(" *RIP[{}]", int(OP_RIP_RELATIVE(op)));
 		else if (OP_IS_SIMD_REGISTER(op)) {
 			result += " XMM";
 			if (OP_SIMD_REGISTER(op) > 9) result += '0' + OP_SIMD_REGISTER(op) / 10;
 			result += '0' + (OP_SIMD_REGISTER(op) % 10);
 		}
-		else if (OP_IS_MEMORY_LOCATION(op))
-			if (OP_MEMORY_SCALE(op)) result += std::format(" *{}[{}{}{:+}]", REGISTER_NAMES[OP_MEMORY_BASE_REGISTER(op)], OP_MEMORY_SCALE(op), REGISTER_NAMES[OP_MEMORY_INDEX_REGISTER(op)], OP_MEMORY_OFFSET(op));
-			else result += std::format(" *{}[{}]", REGISTER_NAMES[OP_MEMORY_BASE_REGISTER(op)], OP_MEMORY_OFFSET(op));
+		else if (OP_IS_MEMORY_LOCATION(op)) {
+			const char* base = (OP_MEMORY_BASE_REGISTER(op) < 16) ? REGISTER_NAMES[OP_MEMORY_BASE_REGISTER(op)] : "";
+			if (OP_MEMORY_SCALE(op)) result += std::format(" *{}[{}{}{:+}]", base, OP_MEMORY_SCALE(op), REGISTER_NAMES[OP_MEMORY_INDEX_REGISTER(op)], int(OP_MEMORY_OFFSET(op)));
+			else result += std::format(" *{}[{}]", base, int(OP_MEMORY_OFFSET(op)));
+		}
 		else {
 			DBG("op: " << std::hex << op << std::dec);
 			assert(false);
@@ -166,14 +320,8 @@ std::string print_instruction(const Instruction& inst, const std::vector<Instruc
 	return result + std::format(" ({},{})", inst.extension, inst.index);
 }
 
-bool instruction_is_valid(const Instruction& inst, const std::vector<InstructionSetExtension>& ises) {
-	auto& footprint = ises[inst.extension].instructions[inst.index];
-	for (int i = 0; i != 4; i++) {
-		auto ofp = footprint.operands[i];
-		auto op = inst.operands[i];
-		if ((op == 0) != ((ofp.head & OF_TYPE) == OF_DEREF || ofp.head == 0)) return false;
-		if (op == 0) continue;
-		if (OP_IS_HIGH_BYTE(op) && ofp.head & OF_SIMD_REGISTER
+bool operand_fits(unsigned long long op, OperandFootprint ofp) {
+	return !((OP_IS_HIGH_BYTE(op) && (ofp.head & OF_SIMD_REGISTER))
 		|| (OP_IS_HIGH_BYTE(op) && !(ofp.head & OF_CAN_BE_HIGH_BYTE))
 		|| (OP_IS_IMMEDIATE(op) && (ofp.head & OF_IMMEDIATE_SIZE) == 0)
 		|| (OP_IS_IMMEDIATE(op) && (OP_IMMEDIATE(op) >> ((ofp.head & OF_IMMEDIATE_SIZE) * 8)))
@@ -182,12 +330,65 @@ bool instruction_is_valid(const Instruction& inst, const std::vector<Instruction
 		|| (OP_IS_REGISTER(op) && ofp.head & OF_SIMD_REGISTER)
 		|| (OP_IS_REGISTER(op) && !(ofp.head & OF_CAN_BE_REGISTER))
 		|| (OP_IS_SIMD_REGISTER(op) && OP_SIMD_REGISTER(op) < 16 && (ofp.head & OF_CAN_BE_LOW_SIMD) != OF_CAN_BE_LOW_SIMD)
-		|| (OP_IS_SIMD_REGISTER(op) && OP_SIMD_REGISTER(op) > 15 && (ofp.head & OF_CAN_BE_HIGH_SIMD) != OF_CAN_BE_HIGH_SIMD))
-			return false;
+		|| (OP_IS_SIMD_REGISTER(op) && OP_SIMD_REGISTER(op) > 15 && (ofp.head & OF_CAN_BE_HIGH_SIMD) != OF_CAN_BE_HIGH_SIMD));
+}
+bool instruction_is_valid(const Instruction& inst, const std::vector<InstructionSetExtension>& ises) {
+	auto& footprint = ises[inst.extension].instructions[inst.index];
+	for (int i = 0; i != 4; i++) {
+		auto ofp = footprint.operands[i];
+		auto op = inst.operands[i];
+		if ((op == 0) != ((ofp.head & OF_TYPE) == OF_DEREF || ofp.head == 0)) return false;
+		if (op == 0) continue;
+		if (!operand_fits(op, ofp)) return false;
 	}
 	return true;
 
 }
+// explicit operands ops[0..] against the footprints explicit operands
+bool operands_fit(const unsigned long long ops[4], const InstructionFootprint& footprint) {
+	int j = 0;
+	for (auto op : footprint.operands) if (op.head != 0 && (op.head & OF_TYPE) != OF_DEREF) {
+		if (!ops[j] || !operand_fits(ops[j], op)) return false;
+		j++;
+	}
+	return j == 4 || !ops[j];
+}
+
+unsigned char operand_kind(unsigned long long op) {
+	if (OP_IS_REGISTER(op)) return OK_REGISTER;
+	if (OP_IS_HIGH_BYTE(op)) return OK_HIGH_BYTE;
+	if (OP_IS_SIMD_REGISTER(op)) return (OP_SIMD_REGISTER(op) < 16) ? OK_LOW_SIMD : OK_HIGH_SIMD;
+	if (OP_IS_IMMEDIATE(op)) return OK_IMMEDIATE;
+	if (OP_IS_MEMORY_LOCATION(op) || OP_IS_RIP_RELATIVE(op)) return OK_MEMORY;
+	return 0;
+}
+unsigned char accepted_operand_kinds(OperandFootprint ofp) {
+	unsigned char result = 0;
+	if (ofp.head & OF_SIMD_REGISTER) {
+		if ((ofp.head & OF_CAN_BE_LOW_SIMD) == OF_CAN_BE_LOW_SIMD) result |= OK_LOW_SIMD;
+		if ((ofp.head & OF_CAN_BE_HIGH_SIMD) == OF_CAN_BE_HIGH_SIMD) result |= OK_HIGH_SIMD;
+	}
+	else {
+		if (ofp.head & OF_CAN_BE_REGISTER) result |= OK_REGISTER;
+		if (ofp.head & OF_CAN_BE_HIGH_BYTE) result |= OK_HIGH_BYTE;
+	}
+	if (ofp.head & OF_IMMEDIATE_SIZE) result |= OK_IMMEDIATE;
+	if (ofp.memory_size) result |= OK_MEMORY;
+	return result;
+}
+MnemonicIndex build_mnemonic_index(const std::vector<InstructionSetExtension>& ises) {
+	MnemonicIndex result{};
+	for (size_t e = 0; e != ises.size(); e++)
+		for (size_t i = 0; i != ises[e].instructions.size(); i++) {
+			auto& footprint = ises[e].instructions[i];
+			MnemonicCandidate candidate{ .extension = (unsigned char)e, .nr_operands = 0, .index = (unsigned int)i, .accepted_kinds = 0 };
+			for (auto op : footprint.operands) if (op.head != 0 && (op.head & OF_TYPE) != OF_DEREF)
+				candidate.accepted_kinds |= (unsigned int)accepted_operand_kinds(op) << (8 * candidate.nr_operands++);
+			result.candidates[&ises[e].names[footprint.name]].push_back(candidate);
+		}
+	return result;
+}
+
 unsigned long long read_operand(std::string_view& source) {
 	// " (0,0)"
 	auto match = ctre::match<"\\s+(.+)">(source);
@@ -218,7 +419,7 @@ unsigned long long read_operand(std::string_view& source) {
 		if (m.get<1>().to_view() == "rip" || m.get<1>().to_view() == "RIP") {
 			if (m.get<2>().to_view().size()) return 0;
 			auto x = read_number<unsigned int, 10>(m.get<6>().to_view());
-			return 0x300000000 | ((m.get<5>()) ? ~x : x);
+			return 0x300000000 | ((m.get<5>()) ? 0u - x : x);
 		}
 		unsigned long long result = 0x400000000000;
 		if (m.get<1>()) result |= unsigned long long(read_register(m.get<1>().to_view())) << 41;
@@ -229,7 +430,7 @@ unsigned long long read_operand(std::string_view& source) {
 		}
 		else result |= 0x10ull << 36;
 		auto offset = read_number<unsigned int, 10>(m.get<6>().to_view());
-		result |= (m.get<5>()) ? ~offset : offset;
+		result |= (m.get<5>()) ? 0u - offset : offset;
 		return result;
 	}
 	case '0': if (auto m = ctre::match<"0[xX]([0-9a-fA-F]{1,8})(.*)">(rest)) {
@@ -246,10 +447,53 @@ unsigned long long read_operand(std::string_view& source) {
 		if (!m) return 0;
 		source = m.get<3>().to_view();
 		auto x = read_number<unsigned int, 10>(m.get<2>().to_view());
-		return 0x200000000 | ((m.get<1>().to_view() == "-") ? ~x : x);
+		return 0x200000000 | ((m.get<1>().to_view() == "-") ? 0u - x : x);
+	}
+}
+bool resolve_instruction(std::string_view name, const unsigned long long ops[4], int ext, int idx, Instruction& inst, const std::vector<InstructionSetExtension>& ises, const MnemonicIndex* index) {
+	if (ext >= 0) {
+		if (size_t(ext) >= ises.size() || size_t(idx) >= ises[ext].instructions.size()) return false;
+		if (&ises[ext].names[ises[ext].instructions[idx].name] != name) return false;
+	}
+	else if (index) {
+		auto candidates = index->candidates.find(name);
+		if (candidates == index->candidates.end()) return false;
+		unsigned int kinds = 0;
+		unsigned char nr_operands = 0;
+		while (nr_operands != 4 && ops[nr_operands]) kinds |= (unsigned int)operand_kind(ops[nr_operands]) << (8 * nr_operands++);
+		for (auto& candidate : candidates->second) {
+			if (candidate.nr_operands != nr_operands || (kinds & ~candidate.accepted_kinds)) continue;
+			if (!operands_fit(ops, ises[candidate.extension].instructions[candidate.index])) continue;
+			ext = candidate.extension;
+			idx = candidate.index;
+		}
+		if (ext < 0) return false;
+	}
+	else {
+		for (int e = 0; e != int(ises.size()); e++) 
+			for (int i = 0; i != int(ises[e].instructions.size()); i++) if (name == &ises[e].names[ises[e].instructions[i].name]) {
+				DBG("possible hit: " << (&ises[e].names[ises[e].instructions[i].name]) << " (" << e << "," << i << ")");
+				if (operands_fit(ops, ises[e].instructions[i])) {
+					ext = e;
+					idx = i;
+				}
+			}
+		if (ext < 0) return false;
+	}
+	inst.extension = ext;
+	inst.index = idx;
+	auto& footprint = ises[ext].instructions[idx];
+	for (int i = 0, j = 0; i != 4; i++)
+		if ((footprint.operands[i].head & OF_TYPE) != OF_DEREF) inst.operands[i] = ops[j++];
+		else inst.operands[i] = 0;
+	if (!instruction_is_valid(inst, ises)) {
+		DBG("produced invalid instruction");
+		DBG(print_instruction(inst, ises));
+		return false;
 	}
+	return true;
 }
-bool load_instruction(std::string_view source, Instruction& inst, const std::vector<InstructionSetExtension>& ises) {
+bool load_instruction_regex(std::string_view source, Instruction& inst, const std::vector<InstructionSetExtension>& ises, const MnemonicIndex* index) {
 	auto m = ctre::match<"\\s*([[:alpha:]_][[:alpha:]0-9_]*)(\\s+.*)">(source);
 	if (!m) { 
 		DBG("did not match initial regex ( identifier )");
@@ -271,66 +515,18 @@ bool load_instruction(std::string_view source, Instruction& inst, const std::vec
 		DBG("'" << rest << "'");
 		return false;
 	}
-	unsigned char ext;
-	unsigned int idx;
-	if (m1.get<1>()) {
-		ext = read_number<unsigned char, 10>(m1.get<2>().to_view());
-		idx = read_number<unsigned int, 10>(m1.get<3>().to_view());
-		if (&ises[ext].names[ises[ext].instructions[idx].name] != name) return false;
-	}
-	else {
-		bool found = false;
-		for (int e = 0; e != ises.size(); e++) 
-			for (int i = 0; i != ises[e].instructions.size(); i++) if (name == &ises[e].names[ises[e].instructions[i].name]) {
-				DBG("possible hit: " << (&ises[e].names[ises[e].instructions[i].name]) << " (" << e << "," << i << ")");
-				int j = 0;
-				bool hit = true;
-				for (auto op : ises[e].instructions[i].operands) if (op.head != 0 && (op.head & OF_TYPE) != OF_DEREF) {
-					if (!ops[j]) hit = false;
-					if (OP_IS_HIGH_BYTE(ops[j]) && op.head & OF_SIMD_REGISTER
-						|| (OP_IS_HIGH_BYTE(ops[j]) && !(op.head & OF_CAN_BE_HIGH_BYTE))
-						|| (OP_IS_IMMEDIATE(ops[j]) && (op.head & OF_IMMEDIATE_SIZE) == 0)
-						|| (OP_IS_IMMEDIATE(ops[j]) && (OP_IMMEDIATE(ops[j]) >> ((op.head & OF_IMMEDIATE_SIZE) * 8)))
-						|| (OP_IS_MEMORY_LOCATION(ops[j]) && op.memory_size == 0)
-						|| (OP_IS_RIP_RELATIVE(ops[j]) && op.memory_size == 0)
-						|| (OP_IS_REGISTER(ops[j]) && op.head & OF_SIMD_REGISTER)
-						|| (OP_IS_REGISTER(ops[j]) && !(op.head & OF_CAN_BE_REGISTER))
-						|| (OP_IS_SIMD_REGISTER(ops[j]) && OP_SIMD_REGISTER(ops[j]) < 16 && (op.head & OF_CAN_BE_LOW_SIMD) != OF_CAN_BE_LOW_SIMD)
-						|| (OP_IS_SIMD_REGISTER(ops[j]) && OP_SIMD_REGISTER(ops[j]) > 15 && (op.head & OF_CAN_BE_HIGH_SIMD) != OF_CAN_BE_HIGH_SIMD))
-						hit = false;
-					j++;
-				}
-				if (ops[j]) hit = false;
-				if (hit) {
-					if (!found) { ext = e; idx = i; }
-					else return false;
-				}
-			}
-	}
-	inst.extension = ext;
-	inst.index = idx;
-	auto& footprint = ises[ext].instructions[idx];
-	for (int i = 0, j = 0; i != 4; i++)
-		if ((footprint.operands[i].head & OF_TYPE) != OF_DEREF) inst.operands[i] = ops[j++];
-		else inst.operands[i] = 0;
-	if (!instruction_is_valid(inst, ises)) {
-		DBG("produced invalid instruction");
-		DBG(print_instruction(inst, ises));
-		return false;
-	}
-	return true;
+	if (m1.get<1>()) return resolve_instruction(name, ops, read_number<unsigned char, 10>(m1.get<2>().to_view()), read_number<unsigned int, 10>(m1.get<3>().to_view()), inst, ises, index);
+	return resolve_instruction(name, ops, -1, -1, inst, ises, index);
 }
 
-std::vector<Instruction> load_instructions(std::string_view source, const std::vector<InstructionSetExtension>& extensions) {
-	DBG("loading instructions from: \"" << source << "\"");
+std::vector<Instruction> load_instructions_regex(std::string_view source, const std::vector<InstructionSetExtension>& extensions, const MnemonicIndex* index) {
 	std::vector<Instruction> result{};
 	while (auto match = ctre::match<"(\\s*(#[^\n]*)?\n)*([^\n]*)(.*)">(source)) {
 		source = match.get<4>().to_view();
-		DBG("line: \"" << match.get<3>().to_view() << "\"");
 		std::string_view line = match.get<3>().to_view();
 		if (!line.size()) return result;
 		result.push_back({});
-		if (!load_instruction(line, result[result.size() - 1], extensions)) return {};
+		if (!load_instruction_regex(line, result[result.size() - 1], extensions, index)) return {};
 	}
 	return {};
 }
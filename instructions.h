@@ -4,6 +4,7 @@
 #include <fstream>
 #include <string>
 #include <format>
+#include <unordered_map>
 
 #define CF 128
 #define PF 64
@@ -62,9 +63,62 @@ struct InstructionFootprint {
 	unsigned int name;
 };
 
+// timing of one instruction on one microarchitecture, from a line below the instruction in the extension file:
+//	@<profile> <latency> <reciprocal throughput> p<ports, one hex digit each>, e.g. "@zen4 1 0.25 p0123"
+struct InstructionTiming {
+	unsigned short latency; // cycles until the results are ready, 0 if the profile has no timing for the instruction
+	unsigned short ports; // bit p for each port it can issue to
+	float reciprocal_throughput; // cycles between two independent ones
+};
+
+// one way to encode an instruction in x86-64 machine code, from a line below the instruction in the extension file:
+//	=<roles> <encoding>, e.g. "=MR REX.W 8B /r" or "=IM REX.W 83 /0 ib"
+// roles has a letter for each explicit operand saying where it goes:
+//	R ModRM.reg, M ModRM.rm (register or memory), O added to the last opcode byte, V VEX.vvvv,
+//	I the immediate, J a relative jump displacement
+// the encoding is written like in the Intel manual: 66/F2/F3 prefixes, REX.W, REX (byte registers: SPL to DIL need a REX
+// prefix, AH to DH can't have one. the byte operands are the ones that can be AH to DH or are 1 byte in memory),
+// VEX.<128|256>.<66|F2|F3>.<0F|0F38|0F3A>.<W0|W1|WIG>, 1 to 3 opcode bytes,
+// /r or /0 to /7, ib iw id for the immediate and cb cw cd for the displacement. an immediate may be shorter than
+// the operand if the value fits sign extended. the first line whose roles fit the operands is used.
+// with a SIMD register from 16 up a VEX encoding becomes EVEX with the same fields.
+#define ENCODE_ROLE_NONE 0 // implicit operand or none
+#define ENCODE_ROLE_REG 1
+#define ENCODE_ROLE_RM 2
+#define ENCODE_ROLE_OPCODE 3
+#define ENCODE_ROLE_VVVV 4
+#define ENCODE_ROLE_IMMEDIATE 5
+#define ENCODE_ROLE_RELATIVE 6
+#define ENCODE_PREFIX_66 1
+#define ENCODE_PREFIX_F2 2
+#define ENCODE_PREFIX_F3 4
+#define ENCODE_REX_W 8
+#define ENCODE_BYTE_REGISTERS 16
+#define ENCODE_VEX 32
+// InstructionEncoding::vex
+#define ENCODE_VEX_MAP 0b0011 // 1: 0F, 2: 0F38, 3: 0F3A
+#define ENCODE_VEX_L 0b0100
+#define ENCODE_VEX_W 0b1000
+// InstructionEncoding::modrm besides /0 to /7
+#define ENCODE_MODRM_REG 8
+#define ENCODE_NO_MODRM 0xff
+struct InstructionEncoding {
+	unsigned int instruction; // index in the extension
+	unsigned char roles[4]; // ENCODE_ROLE_... of each operand of the footprint
+	unsigned char prefixes; // ENCODE_PREFIX_..., ENCODE_REX_W, ENCODE_BYTE_REGISTERS, ENCODE_VEX
+	unsigned char vex;
+	unsigned char opcode[3];
+	unsigned char opcode_size;
+	unsigned char modrm;
+	unsigned char immediate_size; // bytes of the immediate or displacement, 0 if none
+};
+
 struct InstructionSetExtension {
 	std::vector<char> names{};
 	std::vector<InstructionFootprint> instructions{};
+	std::vector<char> profile_names{}; // '\0' terminated, in the order they first appear in the file
+	std::vector<InstructionTiming> timings{}; // profile p of instruction i at p * instructions.size() + i
+	std::vector<InstructionEncoding> encodings{}; // by instruction, the ones of an instruction in the order of the file
 };
 struct ParserError : std::exception {
 	const std::string* filePath{};
@@ -78,6 +132,14 @@ struct ParserError : std::exception {
 	}
 };
 InstructionSetExtension read_instruction_set_extension(const std::string& filePath);
+// filePath is only used for error messages
+InstructionSetExtension read_instruction_set_extension(std::string_view source, const std::string& filePath);
+// index of the profile called <name> in the extension, -1 if it has no timings for it
+int timing_profile_index(const InstructionSetExtension& extension, std::string_view name);
+// the profiles of all extensions, each once
+std::vector<std::string> timing_profiles(const std::vector<InstructionSetExtension>& extensions);
+// the encodings of instruction <index>, [first, end) of extension.encodings
+std::pair<size_t, size_t> instruction_encodings(const InstructionSetExtension& extension, unsigned int index);
 
 /*
 	immediate value	32			00000000 00000000 00000000 00000010 iiiiiiii iiiiiiii iiiiiiii iiiiiiii
@@ -113,8 +175,42 @@ struct Instruction {
 	unsigned long long operands[4];
 };
 
+// kinds of explicit operands, one byte per operand in a signature
+#define OK_REGISTER 1
+#define OK_HIGH_BYTE 2
+#define OK_LOW_SIMD 4
+#define OK_HIGH_SIMD 8
+#define OK_IMMEDIATE 16
+#define OK_MEMORY 32 // memory location or RIP relative
+unsigned char operand_kind(unsigned long long op);
+unsigned char accepted_operand_kinds(OperandFootprint ofp);
+
+struct MnemonicCandidate {
+	unsigned char extension;
+	unsigned char nr_operands; // explicit ones, without OF_DEREF
+	unsigned int index;
+	unsigned int accepted_kinds; // OK_... of explicit operand i in byte i
+};
+// all footprints sharing a name, in (extension, index) order. built once after the extension files are loaded,
+// only valid as long as the extensions are not modified.
+struct MnemonicHash {
+	using is_transparent = void;
+	size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+};
+struct MnemonicIndex {
+	std::unordered_map<std::string, std::vector<MnemonicCandidate>, MnemonicHash, std::equal_to<>> candidates{};
+};
+MnemonicIndex build_mnemonic_index(const std::vector<InstructionSetExtension>&);
+
 std::string print_instruction(const Instruction&, const std::vector<InstructionSetExtension>&);
-bool load_instruction(std::string_view, Instruction&, const std::vector<InstructionSetExtension>&);
-std::vector<Instruction> load_instructions(std::string_view, const std::vector<InstructionSetExtension>&);
+bool instruction_is_valid(const Instruction&, const std::vector<InstructionSetExtension>&);
+// picks the footprint for <name> with the explicit operands ops (0 terminated), either the given (ext,idx) or by lookup.
+// without an index, every footprint of every extension is tried.
+bool resolve_instruction(std::string_view name, const unsigned long long ops[4], int ext, int idx, Instruction&, const std::vector<InstructionSetExtension>&, const MnemonicIndex* = nullptr);
+bool load_instruction(std::string_view, Instruction&, const std::vector<InstructionSetExtension>&, const MnemonicIndex* = nullptr);
+std::vector<Instruction> load_instructions(std::string_view, const std::vector<InstructionSetExtension>&, const MnemonicIndex* = nullptr);
+// the old ctre based parser, only kept to compare against
+bool load_instruction_regex(std::string_view, Instruction&, const std::vector<InstructionSetExtension>&, const MnemonicIndex* = nullptr);
+std::vector<Instruction> load_instructions_regex(std::string_view, const std::vector<InstructionSetExtension>&, const MnemonicIndex* = nullptr);
 void test_stuff();
 std::string print_instruction_footprint(std::vector<InstructionSetExtension>& ises, int ext, int inst);
\ No newline at end of file
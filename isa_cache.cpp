@@ -0,0 +1,140 @@
+#include "isa_cache.h"
+#include "mapped_file.h"
+#include <cstring>
+#include <filesystem>
+
+unsigned long long hash_bytes(std::string_view bytes) {
+	unsigned long long hash = 0xcbf29ce484222325ull;
+	for (unsigned char c : bytes) hash = (hash ^ c) * 0x100000001b3ull;
+	return hash;
+}
+
+unsigned long long align_isa_cache_offset(unsigned long long offset) { return (offset + 7) & ~7ull; }
+
+// entries of a valid cache file, empty if the file is missing or does not fit
+std::vector<IsaCacheEntry> read_isa_cache_entries(const MappedFile& file) {
+	if (file.size < sizeof(IsaCacheHeader)) return {};
+	auto header = (const IsaCacheHeader*)file.data;
+	if (memcmp(header->magic, ISA_CACHE_MAGIC, sizeof(ISA_CACHE_MAGIC)) || header->version != ISA_CACHE_VERSION
+		|| header->footprint_size != sizeof(InstructionFootprint) || header->timing_size != sizeof(InstructionTiming)
+		|| header->encoding_size != sizeof(InstructionEncoding)
+		|| header->nr_extensions > (file.size - sizeof(IsaCacheHeader)) / sizeof(IsaCacheEntry)) return {};
+	auto entries = (const IsaCacheEntry*)(file.data + sizeof(IsaCacheHeader));
+	for (unsigned long long i = 0; i != header->nr_extensions; i++) {
+		auto& entry = entries[i];
+		if (entry.names_offset > file.size || entry.names_size > file.size - entry.names_offset
+			|| entry.footprints_offset % 8 || entry.footprints_offset > file.size
+			|| entry.nr_footprints > (file.size - entry.footprints_offset) / sizeof(InstructionFootprint)
+			|| entry.profile_names_offset > file.size || entry.profile_names_size > file.size - entry.profile_names_offset
+			|| (entry.profile_names_size && file.data[entry.profile_names_offset + entry.profile_names_size - 1] != '\0')
+			|| entry.timings_offset % 8 || entry.timings_offset > file.size || entry.nr_profiles > entry.profile_names_size
+			|| entry.nr_profiles * entry.nr_footprints > (file.size - entry.timings_offset) / sizeof(InstructionTiming)
+			|| entry.encodings_offset % 8 || entry.encodings_offset > file.size
+			|| entry.nr_encodings > (file.size - entry.encodings_offset) / sizeof(InstructionEncoding)
+			|| (entry.names_size && file.data[entry.names_offset + entry.names_size - 1] != '\0')) return {};
+		// every name inside the '\0' terminated names
+		auto footprints = (const InstructionFootprint*)(file.data + entry.footprints_offset);
+		for (unsigned long long f = 0; f != entry.nr_footprints; f++) if (footprints[f].name >= entry.names_size) return {};
+		// a timing always has a port, the parser requires one
+		auto timings = (const InstructionTiming*)(file.data + entry.timings_offset);
+		for (unsigned long long t = 0; t != entry.nr_profiles * entry.nr_footprints; t++) if (timings[t].latency && !timings[t].ports) return {};
+		// every encoding of an instruction there, sorted by instruction
+		auto encodings = (const InstructionEncoding*)(file.data + entry.encodings_offset);
+		for (unsigned long long e = 0; e != entry.nr_encodings; e++)
+			if (encodings[e].instruction >= entry.nr_footprints || (e && encodings[e - 1].instruction > encodings[e].instruction)) return {};
+	}
+	return { entries, entries + header->nr_extensions };
+}
+
+void write_isa_cache(const char* cache_path, const std::vector<IsaCacheEntry>& hashes, const std::vector<InstructionSetExtension>& extensions) {
+	IsaCacheHeader header{
+		.magic = ISA_CACHE_MAGIC,
+		.version = ISA_CACHE_VERSION,
+		.footprint_size = sizeof(InstructionFootprint),
+		.timing_size = sizeof(InstructionTiming),
+		.encoding_size = sizeof(InstructionEncoding),
+		.nr_extensions = extensions.size()
+	};
+	std::vector<IsaCacheEntry> entries = hashes;
+	unsigned long long offset = sizeof(IsaCacheHeader) + entries.size() * sizeof(IsaCacheEntry);
+	for (size_t i = 0; i != extensions.size(); i++) {
+		entries[i].names_offset = offset;
+		entries[i].names_size = extensions[i].names.size();
+		entries[i].footprints_offset = align_isa_cache_offset(offset + entries[i].names_size);
+		entries[i].nr_footprints = extensions[i].instructions.size();
+		entries[i].profile_names_offset = entries[i].footprints_offset + entries[i].nr_footprints * sizeof(InstructionFootprint);
+		entries[i].profile_names_size = extensions[i].profile_names.size();
+		entries[i].timings_offset = align_isa_cache_offset(entries[i].profile_names_offset + entries[i].profile_names_size);
+		entries[i].nr_profiles = extensions[i].instructions.empty() ? 0 : extensions[i].timings.size() / extensions[i].instructions.size();
+		entries[i].encodings_offset = align_isa_cache_offset(entries[i].timings_offset + extensions[i].timings.size() * sizeof(InstructionTiming));
+		entries[i].nr_encodings = extensions[i].encodings.size();
+		offset = align_isa_cache_offset(entries[i].encodings_offset + entries[i].nr_encodings * sizeof(InstructionEncoding));
+	}
+	// written next to the cache and renamed over it, so a failed write never leaves a cache that loads
+	std::string temporary_path = std::string(cache_path) + ".tmp";
+	std::ofstream file(temporary_path, std::ios::binary);
+	if (!file) return;
+	const char zeros[8] = {};
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)entries.data(), entries.size() * sizeof(IsaCacheEntry));
+	for (size_t i = 0; i != extensions.size(); i++) {
+		file.write(extensions[i].names.data(), extensions[i].names.size());
+		file.write(zeros, entries[i].footprints_offset - entries[i].names_offset - entries[i].names_size);
+		file.write((const char*)extensions[i].instructions.data(), extensions[i].instructions.size() * sizeof(InstructionFootprint));
+		file.write(extensions[i].profile_names.data(), extensions[i].profile_names.size());
+		file.write(zeros, entries[i].timings_offset - entries[i].profile_names_offset - entries[i].profile_names_size);
+		file.write((const char*)extensions[i].timings.data(), extensions[i].timings.size() * sizeof(InstructionTiming));
+		file.write(zeros, entries[i].encodings_offset - entries[i].timings_offset - extensions[i].timings.size() * sizeof(InstructionTiming));
+		file.write((const char*)extensions[i].encodings.data(), extensions[i].encodings.size() * sizeof(InstructionEncoding));
+		if (i + 1 != extensions.size()) file.write(zeros, entries[i + 1].names_offset - entries[i].encodings_offset - extensions[i].encodings.size() * sizeof(InstructionEncoding));
+	}
+	file.close();
+	std::error_code error;
+	if (file) std::filesystem::rename(temporary_path, cache_path, error);
+	if (!file || error) std::filesystem::remove(temporary_path, error);
+}
+
+std::vector<InstructionSetExtension> read_instruction_set_extensions(const std::vector<std::string>& paths, const char* cache_path) {
+	MappedFile cache;
+	bool cache_mapped = map_file(cache_path, cache);
+	std::vector<IsaCacheEntry> cached = cache_mapped ? read_isa_cache_entries(cache) : std::vector<IsaCacheEntry>{};
+
+	std::vector<InstructionSetExtension> result(paths.size());
+	std::vector<IsaCacheEntry> hashes(paths.size());
+	bool changed = cached.size() != paths.size();
+	for (size_t i = 0; i != paths.size(); i++) {
+		MappedFile source;
+		if (!map_file(paths[i].c_str(), source)) {
+			if (cache_mapped) unmap_file(cache);
+			throw ParserError{ &paths[i], -1 };
+		}
+		hashes[i] = { .path_hash = hash_bytes(paths[i]), .source_hash = hash_bytes(mapped_view(source)) };
+		if (i < cached.size() && cached[i].path_hash == hashes[i].path_hash && cached[i].source_hash == hashes[i].source_hash) {
+			auto names = cache.data + cached[i].names_offset;
+			auto footprints = (const InstructionFootprint*)(cache.data + cached[i].footprints_offset);
+			result[i].names.assign(names, names + cached[i].names_size);
+			result[i].instructions.assign(footprints, footprints + cached[i].nr_footprints);
+			auto profile_names = cache.data + cached[i].profile_names_offset;
+			auto timings = (const InstructionTiming*)(cache.data + cached[i].timings_offset);
+			result[i].profile_names.assign(profile_names, profile_names + cached[i].profile_names_size);
+			result[i].timings.assign(timings, timings + cached[i].nr_profiles * cached[i].nr_footprints);
+			auto encodings = (const InstructionEncoding*)(cache.data + cached[i].encodings_offset);
+			result[i].encodings.assign(encodings, encodings + cached[i].nr_encodings);
+			unmap_file(source);
+			continue;
+		}
+		changed = true;
+		try {
+			result[i] = read_instruction_set_extension(mapped_view(source), paths[i]);
+		}
+		catch (ParserError&) {
+			unmap_file(source);
+			if (cache_mapped) unmap_file(cache);
+			throw;
+		}
+		unmap_file(source);
+	}
+	if (cache_mapped) unmap_file(cache);
+	if (changed) write_isa_cache(cache_path, hashes, result);
+	return result;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "instructions.h"
+
+// binary copy of parsed extension files, so they don't have to go through the regex parser on every start.
+// every entry remembers a hash of its source file, only changed files are parsed again.
+//	IsaCacheHeader
+//	IsaCacheEntry[nr_extensions]
+//	per extension, 8 byte aligned: names (char[names_size]), footprints (InstructionFootprint[nr_footprints]),
+//		profile names (char[profile_names_size]), timings (InstructionTiming[nr_profiles * nr_footprints]),
+//		encodings (InstructionEncoding[nr_encodings])
+#define ISA_CACHE_MAGIC "asmisa"
+#define ISA_CACHE_VERSION 3
+struct IsaCacheHeader {
+	char magic[8]; // ISA_CACHE_MAGIC
+	unsigned int version;
+	unsigned short footprint_size;
+	unsigned short timing_size;
+	unsigned short encoding_size;
+	unsigned long long nr_extensions;
+};
+struct IsaCacheEntry {
+	unsigned long long path_hash;
+	unsigned long long source_hash;
+	unsigned long long names_offset;
+	unsigned long long names_size;
+	unsigned long long footprints_offset;
+	unsigned long long nr_footprints;
+	unsigned long long profile_names_offset;
+	unsigned long long profile_names_size;
+	unsigned long long timings_offset;
+	unsigned long long nr_profiles;
+	unsigned long long encodings_offset;
+	unsigned long long nr_encodings;
+};
+
+// FNV-1a
+unsigned long long hash_bytes(std::string_view bytes);
+
+// same as calling read_instruction_set_extension for every path, throws ParserError the same way.
+// the cache file is rewritten if any source changed, a missing or broken cache is not an error.
+std::vector<InstructionSetExtension> read_instruction_set_extensions(const std::vector<std::string>& paths, const char* cache_path);
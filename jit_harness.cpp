@@ -0,0 +1,328 @@
+#include "jit_harness.h"
+#include <algorithm>
+#include <vector>
+#include <cstring>
+
+JitSettings default_jit_settings() {
+	return { .runs = 101, .core = -1, .timeout_ms = 1000 };
+}
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <cerrno>
+#include <chrono>
+#include <csetjmp>
+#include <csignal>
+#include <ctime>
+#include <cpuid.h>
+#include <x86intrin.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// where a faulting or timed out run continues, in the child process of the measurement
+static sigjmp_buf jit_jump;
+static volatile sig_atomic_t jit_signal;
+static void jit_signal_handler(int signal) {
+	jit_signal = signal;
+	siglongjmp(jit_jump, 1);
+}
+#define JIT_TIMEOUT_SIGNAL SIGRTMIN
+static const int jit_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGTRAP };
+
+static const char* jit_signal_name(int signal) {
+	if (signal == SIGSEGV) return "it accessed memory outside its mapping";
+	if (signal == SIGBUS) return "it accessed memory that isn't there";
+	if (signal == SIGFPE) return "it divided by zero or overflowed a division";
+	if (signal == SIGILL) return "it ran an instruction this processor doesn't have";
+	if (signal == SIGTRAP) return "it hit a breakpoint";
+	return "it timed out";
+}
+
+// the regions of one mapping: the code, a page for the saved stack pointer and the scratch memory
+struct JitMapping {
+	unsigned char* base;
+	size_t size;
+	size_t code_size; // whole pages
+	unsigned char* saved_rsp;
+	unsigned char* scratch;
+};
+
+static void jit_emit(std::vector<unsigned char>& out, std::initializer_list<unsigned char> bytes) {
+	out.insert(out.end(), bytes);
+}
+static void jit_emit_value(std::vector<unsigned char>& out, unsigned long long value, int size) {
+	for (int i = 0; i != size; i++) out.push_back((unsigned char)(value >> 8 * i));
+}
+// mov [rip + saved_rsp], rsp or mov rsp, [rip + saved_rsp], the displacement is from the end of the instruction
+static void jit_emit_saved_rsp(std::vector<unsigned char>& out, const JitMapping& mapping, unsigned char opcode) {
+	jit_emit(out, { 0x48, opcode, 0x25 });
+	jit_emit_value(out, (unsigned long long)(mapping.saved_rsp - (mapping.base + out.size() + 4)), 4);
+}
+
+static bool jit_has_avx() {
+	unsigned int a, b, c, d;
+	return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_AVX);
+}
+
+// the code between the prologue and the epilogue, false if it doesn't fit in the mapping
+static bool jit_write(const JitMapping& mapping, std::span<const unsigned char> code) {
+	std::vector<unsigned char> out;
+	// callee-saved registers, then the stack pointer, then every register to the scratch memory
+	jit_emit(out, { 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57 });
+	jit_emit_saved_rsp(out, mapping, 0x89);
+	jit_emit(out, { 0x48, 0xb8 });
+	jit_emit_value(out, (unsigned long long)(mapping.scratch + JIT_SCRATCH_SIZE / 2), 8);
+	for (int r = 1; r != 16; r++)
+		if (r != 4) jit_emit(out, { (unsigned char)(r < 8 ? 0x48 : 0x49), 0x89, (unsigned char)(0xc0 | (r & 7)) });
+	jit_emit(out, { 0x48, 0x89, 0xc4 });
+	out.insert(out.end(), code.begin(), code.end());
+	jit_emit_saved_rsp(out, mapping, 0x8b);
+	jit_emit(out, { 0xfc });
+	if (jit_has_avx()) jit_emit(out, { 0xc5, 0xf8, 0x77 });
+	jit_emit(out, { 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b, 0xc3 });
+	if (out.size() > mapping.code_size) return false;
+	memcpy(mapping.base, out.data(), out.size());
+	// anything jumping past the epilogue stops at a breakpoint
+	memset(mapping.base + out.size(), 0xcc, mapping.code_size - out.size());
+	return true;
+}
+
+// all <runs> + 1 runs of the code, the warm up first. false with <failure> set if one didn't finish
+static bool jit_run(std::span<const unsigned char> code, const JitSettings& settings, int perf, std::vector<long long>& ticks,
+	std::vector<long long>& cycles, std::string& failure) {
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	// the prologue and epilogue are under 100 bytes
+	size_t code_size = (code.size() + 128 + page - 1) / page * page;
+	size_t size = code_size + page + JIT_SCRATCH_SIZE;
+	void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		failure = "could not map memory for the code";
+		return false;
+	}
+	JitMapping mapping{
+		.base = (unsigned char*)base,
+		.size = size,
+		.code_size = code_size,
+		.saved_rsp = (unsigned char*)base + code_size,
+		.scratch = (unsigned char*)base + code_size + page
+	};
+	bool completed = jit_write(mapping, code);
+	if (!completed) failure = "the code doesn't fit in its mapping";
+	else if (mprotect(base, code_size, PROT_READ | PROT_EXEC)) {
+		failure = "could not make the code executable";
+		completed = false;
+	}
+	auto function = (void(*)())base;
+
+	timer_t timer{};
+	sigevent event{};
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = JIT_TIMEOUT_SIGNAL;
+	event._sigev_un._tid = (pid_t)syscall(SYS_gettid);
+	bool has_timer = completed && !timer_create(CLOCK_MONOTONIC, &event, &timer);
+	itimerspec timeout{}, disarmed{};
+	timeout.it_value.tv_sec = settings.timeout_ms / 1000;
+	timeout.it_value.tv_nsec = settings.timeout_ms % 1000 * 1000000L;
+
+	ticks.clear();
+	cycles.clear();
+	for (int run = 0; completed && run <= settings.runs; run++) {
+		// scratch memory starts out the same for every run
+		memset(mapping.scratch, 0, JIT_SCRATCH_SIZE);
+		if (sigsetjmp(jit_jump, 1)) {
+			if (has_timer) timer_settime(timer, 0, &disarmed, nullptr);
+			if (perf >= 0) ioctl(perf, PERF_EVENT_IOC_DISABLE, 0);
+			failure = std::string("run ") + std::to_string(run) + " stopped, " + jit_signal_name(jit_signal);
+			completed = false;
+			break;
+		}
+		if (has_timer) timer_settime(timer, 0, &timeout, nullptr);
+		if (perf >= 0) {
+			ioctl(perf, PERF_EVENT_IOC_RESET, 0);
+			ioctl(perf, PERF_EVENT_IOC_ENABLE, 0);
+		}
+		_mm_lfence();
+		unsigned long long start = __rdtsc();
+		_mm_lfence();
+		function();
+		unsigned int core;
+		unsigned long long stop = __rdtscp(&core);
+		_mm_lfence();
+		if (perf >= 0) ioctl(perf, PERF_EVENT_IOC_DISABLE, 0);
+		if (has_timer) timer_settime(timer, 0, &disarmed, nullptr);
+		long long count = -1;
+		if (perf >= 0 && read(perf, &count, sizeof(count)) != sizeof(count)) count = -1;
+		if (run == 0) continue;
+		ticks.push_back((long long)(stop - start));
+		cycles.push_back(count);
+	}
+	if (has_timer) timer_delete(timer);
+	munmap(base, size);
+	return completed;
+}
+
+static long long jit_median(std::vector<long long> values) {
+	std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+	return values[values.size() / 2];
+}
+
+// the measurement in the child process, which exits afterwards, so nothing set up here has to be undone
+static bool jit_measure_here(std::span<const unsigned char> code, const JitSettings& settings, JitMeasurement& result) {
+	int core = settings.core >= 0 ? settings.core : sched_getcpu();
+	cpu_set_t cores;
+	CPU_ZERO(&cores);
+	if (core >= 0) CPU_SET(core, &cores);
+	bool pinned = core >= 0 && !sched_setaffinity(0, sizeof(cores), &cores);
+	if (!pinned && settings.core >= 0) {
+		result.failure = "could not pin the thread to core " + std::to_string(settings.core);
+		return false;
+	}
+
+	// user mode core cycles of this thread, often not allowed by perf_event_paranoid or not there in virtual machines
+	perf_event_attr attributes{};
+	attributes.type = PERF_TYPE_HARDWARE;
+	attributes.size = sizeof(attributes);
+	attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+	attributes.disabled = 1;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+	int perf = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+
+	struct sigaction action{};
+	action.sa_handler = jit_signal_handler;
+	action.sa_flags = SA_ONSTACK | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	// a fault may come with the stack pointer anywhere, so the handler gets its own stack
+	std::vector<unsigned char> signal_stack(std::max<size_t>(SIGSTKSZ, 65536));
+	stack_t stack{};
+	stack.ss_sp = signal_stack.data();
+	stack.ss_size = signal_stack.size();
+	sigaltstack(&stack, nullptr);
+	for (int signal : jit_signals) sigaction(signal, &action, nullptr);
+	sigaction(JIT_TIMEOUT_SIGNAL, &action, nullptr);
+
+	std::vector<long long> base_ticks, base_cycles, ticks, cycles;
+	if (!jit_run({}, settings, perf, base_ticks, base_cycles, result.failure) || !jit_run(code, settings, perf, ticks, cycles, result.failure))
+		return false;
+
+	long long base = *std::min_element(base_ticks.begin(), base_ticks.end());
+	for (long long& t : ticks) t = std::max(t - base, 0ll);
+	result.runs = (int)ticks.size();
+	result.min_ticks = *std::min_element(ticks.begin(), ticks.end());
+	result.median_ticks = jit_median(ticks);
+	if (perf >= 0 && std::count(cycles.begin(), cycles.end(), -1ll) == 0 && std::count(base_cycles.begin(), base_cycles.end(), -1ll) == 0) {
+		long long base_cycle = *std::min_element(base_cycles.begin(), base_cycles.end());
+		for (long long& c : cycles) c = std::max(c - base_cycle, 0ll);
+		result.min_cycles = *std::min_element(cycles.begin(), cycles.end());
+		result.median_cycles = jit_median(cycles);
+	}
+	return true;
+}
+
+// the child writes the numbers of the measurement and then the failure, if there is one
+static void jit_write_all(int fd, const void* data, size_t size) {
+	for (size_t done = 0; done != size;) {
+		ssize_t written = write(fd, (const char*)data + done, size - done);
+		if (written <= 0) return;
+		done += (size_t)written;
+	}
+}
+
+bool jit_measure(std::span<const unsigned char> code, const JitSettings& settings, JitMeasurement& result) {
+	result = { .runs = 0, .min_ticks = -1, .median_ticks = -1, .min_cycles = -1, .median_cycles = -1 };
+	if (settings.runs < 1) {
+		result.failure = "there has to be at least one run";
+		return false;
+	}
+	int fds[2];
+	if (pipe(fds)) {
+		result.failure = "could not create a pipe to the measurement";
+		return false;
+	}
+	pid_t child = fork();
+	if (child < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		result.failure = "could not start a process for the measurement";
+		return false;
+	}
+	if (child == 0) {
+		// only this thread is copied into the child. glibc's malloc stays usable after fork, everything else here is
+		// the child's own
+		close(fds[0]);
+		JitMeasurement measured{ .runs = 0, .min_ticks = -1, .median_ticks = -1, .min_cycles = -1, .median_cycles = -1 };
+		jit_measure_here(code, settings, measured);
+		long long numbers[5] = { measured.runs, measured.min_ticks, measured.median_ticks, measured.min_cycles, measured.median_cycles };
+		jit_write_all(fds[1], numbers, sizeof(numbers));
+		jit_write_all(fds[1], measured.failure.data(), measured.failure.size());
+		_exit(0);
+	}
+	close(fds[1]);
+
+	// every run stops itself at the timeout, the child is only killed if that didn't work
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(2ll * (settings.runs + 1) * settings.timeout_ms + 1000);
+	std::vector<char> received;
+	bool timed_out = false;
+	for (;;) {
+		long long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		pollfd wait{ .fd = fds[0], .events = POLLIN, .revents = 0 };
+		int ready = poll(&wait, 1, (int)std::clamp(left, 0ll, 1000000ll));
+		if (ready < 0 && errno == EINTR) continue;
+		if (ready <= 0) {
+			timed_out = true;
+			break;
+		}
+		char buffer[4096];
+		ssize_t got = read(fds[0], buffer, sizeof(buffer));
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) break;
+		received.insert(received.end(), buffer, buffer + got);
+	}
+	close(fds[0]);
+	if (timed_out) kill(child, SIGKILL);
+	int status = 0;
+	while (waitpid(child, &status, 0) < 0 && errno == EINTR);
+
+	long long numbers[5];
+	if (timed_out) result.failure = "the measurement didn't finish in time";
+	else if (received.size() < sizeof(numbers)) {
+		if (WIFSIGNALED(status)) result.failure = "the measurement process was stopped by signal " + std::to_string(WTERMSIG(status));
+		else result.failure = "the measurement process ended without a result";
+	}
+	if (!result.failure.empty()) return false;
+	memcpy(numbers, received.data(), sizeof(numbers));
+	result.failure.assign(received.begin() + sizeof(numbers), received.end());
+	if (!result.failure.empty()) return false;
+	result = { .runs = (int)numbers[0], .min_ticks = numbers[1], .median_ticks = numbers[2], .min_cycles = numbers[3], .median_cycles = numbers[4] };
+	return true;
+}
+#else
+bool jit_measure(std::span<const unsigned char> code, const JitSettings& settings, JitMeasurement& result) {
+	result = { .runs = 0, .min_ticks = -1, .median_ticks = -1, .min_cycles = -1, .median_cycles = -1 };
+	result.failure = "running code is only supported on x86-64 Linux";
+	return false;
+}
+#endif
+
+void jit_run_start(JitRun& run, std::vector<unsigned char> code, const JitSettings& settings) {
+	run.code = std::move(code);
+	run.settings = settings;
+	run.done = false;
+	run.thread = std::thread([&run] {
+		jit_measure(run.code, run.settings, run.result);
+		run.done = true;
+	});
+}
+bool jit_run_running(const JitRun& run) {
+	return run.thread.joinable();
+}
+bool jit_run_finish(JitRun& run) {
+	if (!run.thread.joinable() || !run.done) return false;
+	run.thread.join();
+	return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <span>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+// runs x86-64 machine code on this machine and times it, only on Linux.
+// the code is copied into an executable mapping between a prologue and an epilogue:
+//	the prologue saves the callee-saved registers and the stack pointer, then points all 16 registers (RSP too)
+//	to the middle of JIT_SCRATCH_SIZE bytes of zeroed memory, so small memory operands and pushes stay inside it
+//	the epilogue restores the stack pointer and the saved registers and returns
+// the runs happen in a child process, so code that writes anywhere can only break the child. a run that faults
+// (bad memory access, division by zero, jumping off) or takes longer than the timeout is stopped through a signal
+// handler on its own stack there, the measurement then fails instead of the program.
+#define JIT_SCRATCH_SIZE (1 << 20)
+struct JitSettings {
+	int runs; // counted runs, one more runs first to warm up caches and predictors
+	int core; // the child process is pinned to it while measuring, -1 for the core it starts on
+	int timeout_ms; // per run
+};
+// 101 runs on the current core, a second each
+JitSettings default_jit_settings();
+
+// the empty prologue and epilogue are measured the same way and subtracted
+struct JitMeasurement {
+	int runs;
+	long long min_ticks; // time stamp counter, runs at a fixed rate that is not the core clock
+	long long median_ticks;
+	long long min_cycles; // core cycles in user mode from perf_event_open, -1 if the kernel doesn't allow counting them
+	long long median_cycles;
+	std::string failure{}; // why the code could not be measured, empty if it was
+};
+// false if the code could not be measured, see result.failure
+bool jit_measure(std::span<const unsigned char> code, const JitSettings& settings, JitMeasurement& result);
+
+// measure on a thread of its own, so the editor keeps running while it waits for the child process
+struct JitRun {
+	std::thread thread{};
+	std::vector<unsigned char> code{};
+	JitSettings settings{};
+	JitMeasurement result{};
+	std::atomic<bool> done{};
+};
+void jit_run_start(JitRun& run, std::vector<unsigned char> code, const JitSettings& settings);
+bool jit_run_running(const JitRun& run);
+// true once, after the measurement is done. the run is left for the next jit_run_start
+bool jit_run_finish(JitRun& run);
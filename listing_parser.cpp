@@ -0,0 +1,347 @@
+#include "listing_parser.h"
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#define DBG(msg) (std::cout << msg << "\n")
+
+bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+bool is_digit(char c) { return '0' <= c && c <= '9'; }
+bool is_alpha(char c) { return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z'); }
+bool is_identifier(char c) { return is_alpha(c) || is_digit(c) || c == '_'; }
+
+struct LineCursor {
+	const char* position;
+	const char* begin;
+	const char* end;
+	bool at_end() const { return position == end; }
+	char peek() const { return position == end ? '\0' : *position; }
+	void skip_spaces() { while (position != end && is_space(*position)) position++; }
+	std::string_view token() {
+		const char* start = position;
+		while (position != end && (is_alpha(*position) || is_digit(*position))) position++;
+		return { start, size_t(position - start) };
+	}
+	// false if the number doesn't fit in 32 bits
+	bool decimal(unsigned int& result) {
+		unsigned long long value = 0;
+		while (position != end && is_digit(*position)) {
+			value = value * 10 + (*position++ - '0');
+			if (value > 0xffffffffull) return false;
+		}
+		result = (unsigned int)value;
+		return true;
+	}
+};
+
+// names have to be all uppercase or all lowercase, like the regex parser expected
+bool name_equals(std::string_view token, const char* upper_case_name) {
+	bool lower = 'a' <= token[0] && token[0] <= 'z';
+	for (size_t i = 0; i != token.size(); i++) {
+		if (!upper_case_name[i]) return false;
+		char c = lower ? upper_case_name[i] - 'A' + 'a' : upper_case_name[i];
+		if ('0' <= upper_case_name[i] && upper_case_name[i] <= '9') c = upper_case_name[i];
+		if (token[i] != c) return false;
+	}
+	return upper_case_name[token.size()] == '\0';
+}
+int register_number(std::string_view token) {
+	if (token.size() < 2 || token.size() > 3) return -1;
+	for (int i = 0; i != 16; i++) if (name_equals(token, REGISTER_NAMES[i])) return i;
+	return -1;
+}
+int high_byte_number(std::string_view token) {
+	if (token.size() != 2) return -1;
+	for (int i = 0; i != 4; i++) if (name_equals(token, HIGH_BYTE_NAMES[i])) return i;
+	return -1;
+}
+int simd_register_number(std::string_view token) {
+	if (token.size() < 4 || token.size() > 5) return -1;
+	if (!((token[0] == 'x' || token[0] == 'y' || token[0] == 'z') && token[1] == 'm' && token[2] == 'm')
+		&& !((token[0] == 'X' || token[0] == 'Y' || token[0] == 'Z') && token[1] == 'M' && token[2] == 'M')) return -1;
+	int result = 0;
+	for (size_t i = 3; i != token.size(); i++) {
+		if (!is_digit(token[i])) return -1;
+		result = result * 10 + (token[i] - '0');
+	}
+	return (result < 32) ? result : -1;
+}
+
+// same encoding as read_operand, returns 0 and sets error on failure
+unsigned long long parse_memory_operand(LineCursor& cursor, ListingError& error) {
+	cursor.position++; // '*'
+	const char* base_position = cursor.position;
+	std::string_view base = cursor.token();
+	bool rip = base == "rip" || base == "RIP";
+	int base_register = base.empty() ? -1 : register_number(base);
+	if (!base.empty() && !rip && base_register < 0) {
+		error = { 0, int(base_position - cursor.begin) + 1, "unknown base register" };
+		return 0;
+	}
+	if (cursor.peek() != '[') {
+		error = { 0, int(cursor.position - cursor.begin) + 1, "expected '['" };
+		return 0;
+	}
+	cursor.position++;
+	cursor.skip_spaces();
+
+	int scale = 0;
+	int index_register = -1;
+	char c = cursor.peek();
+	if (is_digit(c)) {
+		LineCursor look_ahead = cursor;
+		look_ahead.position++;
+		look_ahead.skip_spaces();
+		if (look_ahead.peek() == '*') look_ahead.position++;
+		look_ahead.skip_spaces();
+		int reg = register_number(look_ahead.token());
+		if (reg >= 0) {
+			if (c != '1' && c != '2' && c != '4' && c != '8') {
+				error = { 0, int(cursor.position - cursor.begin) + 1, "the scale has to be 1, 2, 4 or 8" };
+				return 0;
+			}
+			scale = c - '0';
+			index_register = reg;
+			cursor = look_ahead;
+		}
+	}
+	cursor.skip_spaces();
+	if (cursor.peek() == '+') cursor.position++;
+	cursor.skip_spaces();
+	bool negative = cursor.peek() == '-';
+	if (negative) cursor.position++;
+	cursor.skip_spaces();
+	unsigned int offset;
+	if (!cursor.decimal(offset)) {
+		error = { 0, int(cursor.position - cursor.begin) + 1, "the offset doesn't fit in 32 bits" };
+		return 0;
+	}
+	cursor.skip_spaces();
+	if (cursor.peek() != ']') {
+		error = { 0, int(cursor.position - cursor.begin) + 1, "expected ']'" };
+		return 0;
+	}
+	cursor.position++;
+
+	if (rip) {
+		if (index_register >= 0) {
+			error = { 0, int(base_position - cursor.begin) + 1, "RIP relative operands can not have an index" };
+			return 0;
+		}
+		return 0x300000000ull | (negative ? 0u - offset : offset);
+	}
+	unsigned long long result = 0x400000000000ull;
+	result |= (unsigned long long)(base_register >= 0 ? base_register : 0x10) << 41;
+	if (index_register >= 0) result |= (unsigned long long)(scale) << 32 | (unsigned long long)(index_register) << 36;
+	else result |= 0x10ull << 36;
+	return result | (negative ? 0u - offset : offset);
+}
+unsigned long long parse_operand(LineCursor& cursor, ListingError& error) {
+	const char* start = cursor.position;
+	char c = cursor.peek();
+	if (c == '*') return parse_memory_operand(cursor, error);
+	if (is_alpha(c)) {
+		std::string_view token = cursor.token();
+		if (int reg = register_number(token); reg >= 0) return 0x10ull | reg;
+		if (int reg = high_byte_number(token); reg >= 0) return 0x4ull | reg;
+		if (int reg = simd_register_number(token); reg >= 0) return 0x20ull | reg;
+		error = { 0, int(start - cursor.begin) + 1, "unknown register" };
+		return 0;
+	}
+	if (c == '0' && cursor.position + 1 != cursor.end && (cursor.position[1] == 'x' || cursor.position[1] == 'X')) {
+		cursor.position += 2;
+		unsigned long long result = 0;
+		int digits = 0;
+		for (; !cursor.at_end(); cursor.position++, digits++) {
+			char d = *cursor.position;
+			if ('0' <= d && d <= '9') result = (result << 4) | (d - '0');
+			else if ('a' <= d && d <= 'f') result = (result << 4) | (d - 'a' + 10);
+			else if ('A' <= d && d <= 'F') result = (result << 4) | (d - 'A' + 10);
+			else break;
+		}
+		if (digits == 0 || digits > 8) {
+			error = { 0, int(start - cursor.begin) + 1, "hexadecimal immediates need 1 to 8 digits" };
+			return 0;
+		}
+		return result | 0x200000000ull;
+	}
+	bool negative = c == '-';
+	if (c == '-' || c == '+') {
+		cursor.position++;
+		c = cursor.peek();
+	}
+	if (!is_digit(c)) {
+		error = { 0, int(start - cursor.begin) + 1, "expected an operand" };
+		return 0;
+	}
+	unsigned int x;
+	if (!cursor.decimal(x)) {
+		error = { 0, int(start - cursor.begin) + 1, "the immediate doesn't fit in 32 bits" };
+		return 0;
+	}
+	return 0x200000000ull | (negative ? 0u - x : x);
+}
+
+bool parse_instruction(std::string_view line, Instruction& result, const std::vector<InstructionSetExtension>& extensions, const MnemonicIndex* index, ListingError& error) {
+	LineCursor cursor{ line.data(), line.data(), line.data() + line.size() };
+	cursor.skip_spaces();
+	const char* name_start = cursor.position;
+	if (!is_alpha(cursor.peek()) && cursor.peek() != '_') {
+		error = { 0, int(cursor.position - cursor.begin) + 1, "expected an instruction name" };
+		return false;
+	}
+	while (!cursor.at_end() && is_identifier(*cursor.position)) cursor.position++;
+	std::string_view name{ name_start, size_t(cursor.position - name_start) };
+
+	unsigned long long ops[4] = { 0,0,0,0 };
+	int ext = -1;
+	int idx = -1;
+	for (int i = 0; i != 5; i++) {
+		if (cursor.at_end() || cursor.peek() == '#') break;
+		if (!is_space(cursor.peek())) {
+			error = { 0, int(cursor.position - cursor.begin) + 1, "expected a space" };
+			return false;
+		}
+		cursor.skip_spaces();
+		char c = cursor.peek();
+		if (c == '\0' || c == '#') break;
+		if (c == '(') {
+			cursor.position++;
+			cursor.skip_spaces();
+			if (!is_digit(cursor.peek())) {
+				error = { 0, int(cursor.position - cursor.begin) + 1, "expected the extension number" };
+				return false;
+			}
+			unsigned int number;
+			if (!cursor.decimal(number) || number > 0xff) {
+				error = { 0, int(cursor.position - cursor.begin) + 1, "the extension number is too large" };
+				return false;
+			}
+			ext = int(number);
+			cursor.skip_spaces();
+			if (cursor.peek() != ',') {
+				error = { 0, int(cursor.position - cursor.begin) + 1, "expected a ','" };
+				return false;
+			}
+			cursor.position++;
+			cursor.skip_spaces();
+			if (!is_digit(cursor.peek())) {
+				error = { 0, int(cursor.position - cursor.begin) + 1, "expected the instruction number" };
+				return false;
+			}
+			if (!cursor.decimal(number) || number > 0x7fffffff) {
+				error = { 0, int(cursor.position - cursor.begin) + 1, "the instruction number is too large" };
+				return false;
+			}
+			idx = int(number);
+			cursor.skip_spaces();
+			if (cursor.peek() != ')') {
+				error = { 0, int(cursor.position - cursor.begin) + 1, "expected a ')'" };
+				return false;
+			}
+			cursor.position++;
+			cursor.skip_spaces();
+			break;
+		}
+		if (i == 4) {
+			error = { 0, int(cursor.position - cursor.begin) + 1, "more than 4 operands" };
+			return false;
+		}
+		ops[i] = parse_operand(cursor, error);
+		if (!ops[i]) return false;
+	}
+	if (!cursor.at_end() && cursor.peek() != '#') {
+		error = { 0, int(cursor.position - cursor.begin) + 1, "unexpected character" };
+		return false;
+	}
+	if (!resolve_instruction(name, ops, ext, idx, result, extensions, index)) {
+		error = { 0, int(name_start - cursor.begin) + 1, "no instruction with this name fits the operands" };
+		return false;
+	}
+	return true;
+}
+
+bool parse_listing(std::string_view source, std::vector<Instruction>& result, const std::vector<InstructionSetExtension>& extensions, const MnemonicIndex* index, ListingError& error) {
+	const char* position = source.data();
+	const char* end = source.data() + source.size();
+	int line_number = 0;
+	while (position != end) {
+		line_number++;
+		const char* line_end = (const char*)memchr(position, '\n', end - position);
+		if (!line_end) line_end = end;
+		const char* first = position;
+		while (first != line_end && is_space(*first)) first++;
+		if (first != line_end && *first != '#') {
+			result.push_back({});
+			if (!parse_instruction({ position, size_t(line_end - position) }, result.back(), extensions, index, error)) {
+				result.pop_back();
+				error.line = line_number;
+				return false;
+			}
+		}
+		position = (line_end == end) ? end : line_end + 1;
+	}
+	return true;
+}
+
+bool load_instruction(std::string_view source, Instruction& inst, const std::vector<InstructionSetExtension>& ises, const MnemonicIndex* index) {
+	ListingError error{};
+	if (parse_instruction(source, inst, ises, index, error)) return true;
+	DBG("column " << error.column << ": " << error.message);
+	return false;
+}
+std::vector<Instruction> load_instructions(std::string_view source, const std::vector<InstructionSetExtension>& ises, const MnemonicIndex* index) {
+	std::vector<Instruction> result{};
+	ListingError error{};
+	if (parse_listing(source, result, ises, index, error)) return result;
+	DBG("line " << error.line << ", column " << error.column << ": " << error.message);
+	return {};
+}
+
+bool parse_listing_parallel(std::string_view source, std::vector<Instruction>& result, const std::vector<InstructionSetExtension>& extensions, const MnemonicIndex* index, ListingError& error, int threads) {
+	if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	size_t nr_chunks = std::min(size_t(threads) * PARALLEL_PARSE_CHUNKS_PER_THREAD, source.size() / PARALLEL_PARSE_MIN_CHUNK_BYTES);
+	if (nr_chunks <= 1 || threads == 1) return parse_listing(source, result, extensions, index, error);
+
+	// chunk i is [starts[i], starts[i + 1]), every chunk but the last ends with '\n'
+	std::vector<size_t> starts{ 0 };
+	for (size_t i = 1; i != nr_chunks; i++) {
+		size_t newline = source.find('\n', std::max(starts.back(), source.size() * i / nr_chunks));
+		if (newline == std::string_view::npos) break;
+		starts.push_back(newline + 1);
+	}
+	starts.push_back(source.size());
+	nr_chunks = starts.size() - 1;
+
+	std::vector<std::vector<Instruction>> parsed(nr_chunks);
+	std::vector<ListingError> errors(nr_chunks);
+	std::atomic<size_t> next_chunk = 0;
+	std::atomic<size_t> first_failed = nr_chunks; // chunks after it don't have to be parsed
+	auto work = [&]() {
+		for (size_t chunk; (chunk = next_chunk++) < nr_chunks; ) {
+			if (chunk > first_failed) continue;
+			std::string_view text = source.substr(starts[chunk], starts[chunk + 1] - starts[chunk]);
+			parsed[chunk].reserve(text.size() / LISTING_BYTES_PER_LINE_ESTIMATE + 1);
+			if (parse_listing(text, parsed[chunk], extensions, index, errors[chunk])) continue;
+			for (size_t failed = first_failed; chunk < failed && !first_failed.compare_exchange_weak(failed, chunk); );
+		}
+	};
+	std::vector<std::thread> workers{};
+	for (int i = 1; i < threads && size_t(i) < nr_chunks; i++) workers.emplace_back(work);
+	work();
+	for (auto& worker : workers) worker.join();
+
+	size_t failed = first_failed;
+	bool success = failed == nr_chunks;
+	if (!success) {
+		// every chunk before the failed one was parsed completely
+		error = errors[failed];
+		error.line += int(std::count(source.data(), source.data() + starts[failed], '\n'));
+		nr_chunks = failed + 1;
+	}
+	size_t total = result.size();
+	for (size_t chunk = 0; chunk != nr_chunks; chunk++) total += parsed[chunk].size();
+	result.reserve(total);
+	for (size_t chunk = 0; chunk != nr_chunks; chunk++) result.insert(result.end(), parsed[chunk].begin(), parsed[chunk].end());
+	return success;
+}
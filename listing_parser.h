@@ -0,0 +1,29 @@
+#pragma once
+#include <string_view>
+#include "instructions.h"
+
+// single pass parser for listings, replaces the ctre based load_instructions_regex.
+// one instruction per line:
+//	NAME [operand [operand ...]] [(ext,idx)] [# comment]
+// operands: RAX..R15, AH..DH, XMM0..XMM31 (also YMM/ZMM), 0x1F, -12, *RBX[4RCX+8], *[16], *RIP[-8]
+// empty lines and lines containing only a comment are skipped.
+
+struct ListingError {
+	int line; // starting at 1
+	int column; // starting at 1
+	const char* message;
+};
+
+// used to reserve space for the instructions of a listing
+#define LISTING_BYTES_PER_LINE_ESTIMATE 32
+
+// parses one line (without the '\n'), column in error is relative to the start of the line
+bool parse_instruction(std::string_view line, Instruction& result, const std::vector<InstructionSetExtension>& extensions, const MnemonicIndex* index, ListingError& error);
+// appends to result. stops at the first invalid line, result then contains all instructions before it.
+bool parse_listing(std::string_view source, std::vector<Instruction>& result, const std::vector<InstructionSetExtension>& extensions, const MnemonicIndex* index, ListingError& error);
+
+// same as parse_listing, but splits source at line boundaries into chunks that are parsed on threads.
+// the reported error is always the first invalid line. threads == 0 uses all hardware threads.
+#define PARALLEL_PARSE_MIN_CHUNK_BYTES (1 << 20)
+#define PARALLEL_PARSE_CHUNKS_PER_THREAD 4
+bool parse_listing_parallel(std::string_view source, std::vector<Instruction>& result, const std::vector<InstructionSetExtension>& extensions, const MnemonicIndex* index, ListingError& error, int threads = 0);
@@ -0,0 +1,376 @@
+#include "liveness.h"
+#include <algorithm>
+#include <bit>
+
+USE_MASK get_use_mask_in(const Instruction instruction, const InstructionFootprint& footprint) {
+	USE_MASK result = USE_MASK(footprint.always_read_registers) | (USE_MASK(footprint.always_read_flags) << 16);
+	for (int i = 0; i != 4; i++) if (footprint.operands[i].head & OF_IN) {
+		unsigned long long op = instruction.operands[i];
+		if (OP_IS_REGISTER(op))				result |= 1ull << OP_REGISTER(op);
+		else if (OP_IS_HIGH_BYTE(op))		result |= 1ull << OP_HIGH_BYTE(op);
+		else if (OP_IS_SIMD_REGISTER(op))	result |= 1ull << (32 + OP_SIMD_REGISTER(op));
+	}
+	return result;
+}
+USE_MASK get_use_mask_in_pointer(const Instruction instruction, const InstructionFootprint& footprint) {
+	USE_MASK result = 0;
+	for (int i = 0; i != 4; i++) {
+		unsigned long long op = instruction.operands[i];
+		unsigned char head = footprint.operands[i].head;
+		if ((head & OF_DEREF_TYPE) == OF_IN_DEREF || (head & OF_DEREF_TYPE) == OF_IO_DEREF)
+			result |= 1ull << (footprint.operands[i].head & OF_PTR_REGISTER);
+		else if ((head & OF_IN) && OP_IS_MEMORY_LOCATION(op) && OP_MEMORY_BASE_REGISTER(op) < 16)
+			result |= 1ull << OP_MEMORY_BASE_REGISTER(op);
+	}
+	return result;
+}
+USE_MASK get_use_mask_in_index(const Instruction instruction, const InstructionFootprint& footprint) {
+	USE_MASK result = 0;
+	for (int i = 0; i != 4; i++) {
+		unsigned long long op = instruction.operands[i];
+		unsigned char head = footprint.operands[i].head;
+		if ((head & OF_IN) && OP_IS_MEMORY_LOCATION(op) && OP_MEMORY_INDEX_REGISTER(op) < 16)
+			result |= 1ull << OP_MEMORY_INDEX_REGISTER(op);
+	}
+	return result;
+}
+USE_MASK get_use_mask_out(const Instruction instruction, const InstructionFootprint& footprint) {
+	USE_MASK result = USE_MASK(footprint.always_written_registers) | (USE_MASK(footprint.always_written_flags) << 16);
+	for (int i = 0; i != 4; i++) if (footprint.operands[i].head & OF_OUT) {
+		unsigned long long op = instruction.operands[i];
+		if (OP_IS_REGISTER(op))				result |= 1ull << OP_REGISTER(op);
+		else if (OP_IS_HIGH_BYTE(op))		result |= 1ull << OP_HIGH_BYTE(op);
+		else if (OP_IS_SIMD_REGISTER(op))	result |= 1ull << (32 + OP_SIMD_REGISTER(op));
+	}
+	return result;
+}
+USE_MASK get_use_mask_out_pointer(const Instruction instruction, const InstructionFootprint& footprint) {
+	USE_MASK result = 0;
+	for (int i = 0; i != 4; i++) {
+		unsigned long long op = instruction.operands[i];
+		unsigned char head = footprint.operands[i].head;
+		if ((head & OF_DEREF_TYPE) == OF_OUT_DEREF || (head & OF_DEREF_TYPE) == OF_IO_DEREF)
+			result |= 1ull << (footprint.operands[i].head & OF_PTR_REGISTER);
+		else if ((head & OF_OUT) && OP_IS_MEMORY_LOCATION(op) && OP_MEMORY_BASE_REGISTER(op) < 16)
+			result |= 1ull << OP_MEMORY_BASE_REGISTER(op);
+	}
+	return result;
+}
+USE_MASK get_use_mask_out_index(const Instruction instruction, const InstructionFootprint& footprint) {
+	USE_MASK result = 0;
+	for (int i = 0; i != 4; i++) {
+		unsigned long long op = instruction.operands[i];
+		unsigned char head = footprint.operands[i].head;
+		if ((head & OF_OUT) && OP_IS_MEMORY_LOCATION(op) && OP_MEMORY_INDEX_REGISTER(op) < 16)
+			result |= 1ull << OP_MEMORY_INDEX_REGISTER(op);
+	}
+	return result;
+}
+USE_MASK use_mask_above(const Instruction instruction, const InstructionFootprint& footprint, USE_MASK below) {
+	USE_MASK in = get_use_mask_in(instruction, footprint)
+		| get_use_mask_in_pointer(instruction, footprint)
+		| get_use_mask_in_index(instruction, footprint)
+		| get_use_mask_out_pointer(instruction, footprint)
+		| get_use_mask_out_index(instruction, footprint);
+	USE_MASK out = get_use_mask_out(instruction, footprint);
+	return (below & ~out) | in;
+}
+
+// flags 16-23 are the PlaceMasks flags 0-7, registers 0-15 are PlaceMasks 16-31, SIMD registers are the same
+unsigned long long places_of_use_mask(USE_MASK use_mask) {
+	return ((use_mask & 0xffff) << 16) | ((use_mask >> 16) & 0xff) | (use_mask & 0xffffffff00000000ull);
+}
+USE_MASK use_mask_of_places(unsigned long long places) {
+	return ((places >> 16) & 0xffff) | ((places & 0xff) << 16) | (places & 0xffffffff00000000ull);
+}
+
+void block_transfer(BlockLiveness& block_liveness, const BasicBlock& block, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions) {
+	USE_MASK gen = 0, kill = 0;
+	for (int i = block.last; i >= block.first; i--) {
+		auto& footprint = extensions[instructions[i].extension].instructions[instructions[i].index];
+		USE_MASK in = get_use_mask_in(instructions[i], footprint)
+			| get_use_mask_in_pointer(instructions[i], footprint)
+			| get_use_mask_in_index(instructions[i], footprint)
+			| get_use_mask_out_pointer(instructions[i], footprint)
+			| get_use_mask_out_index(instructions[i], footprint);
+		USE_MASK out = get_use_mask_out(instructions[i], footprint);
+		gen = (gen & ~out) | in;
+		kill = (kill | out) & ~in;
+	}
+	block_liveness.gen = gen;
+	block_liveness.kill = kill;
+}
+
+void liveness_solve(LivenessSolution& solution, const ControlFlowGraph& cfg, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, int first, int last, std::vector<int>& changed) {
+	int nr_blocks = int(cfg.blocks.size());
+	changed.clear();
+	bool from_scratch = solution.cfg_generation != cfg.generation || solution.blocks.size() != size_t(nr_blocks);
+	// 1: in the worklist, 2: live_out may have changed
+	std::vector<char>& flags = solution.flags;
+	flags.resize(nr_blocks);
+	std::vector<int> worklist{};
+	std::vector<int> visited{};
+	std::vector<USE_MASK> old_live_out{};
+	auto push = [&](int b) {
+		if (!(flags[b] & 2)) {
+			visited.push_back(b);
+			old_live_out.push_back(solution.blocks[b].live_out);
+		}
+		if (!(flags[b] & 1)) worklist.push_back(b);
+		flags[b] |= 3;
+	};
+	if (from_scratch) {
+		// an edge may have disappeared, start from nothing alive
+		solution.blocks.assign(nr_blocks, {});
+		solution.cfg_generation = cfg.generation;
+		for (int b = 0; b != nr_blocks; b++) {
+			block_transfer(solution.blocks[b], cfg.blocks[b], instructions, extensions);
+			changed.push_back(b);
+			worklist.push_back(b); // the last block is processed first
+			flags[b] = 1;
+		}
+	}
+	else {
+		// only uses appearing or definitions disappearing can be added to the old solution.
+		// a position that lost a use or gained a definition is cleared from the blocks it was alive in because of that,
+		// walking up the predecessors until it is read again, and those blocks are solved again from there.
+		if (first <= last) liveness_invalidate(solution, cfg, first, last);
+		std::sort(solution.invalid.begin(), solution.invalid.end());
+		solution.invalid.erase(std::unique(solution.invalid.begin(), solution.invalid.end()), solution.invalid.end());
+		std::vector<std::pair<int, USE_MASK>> to_clear{};
+		for (int b : solution.invalid) {
+			// the gaps inside have to be rewritten even if the transfer function stays the same
+			changed.push_back(b);
+			BlockLiveness before = solution.blocks[b];
+			block_transfer(solution.blocks[b], cfg.blocks[b], instructions, extensions);
+			USE_MASK lost = (before.gen & ~solution.blocks[b].gen) | (solution.blocks[b].kill & ~before.kill);
+			if (lost) to_clear.push_back({ b, lost });
+			if (solution.blocks[b].gen != before.gen || solution.blocks[b].kill != before.kill) push(b);
+		}
+		std::vector<USE_MASK>& cleared = solution.cleared;
+		if (!to_clear.empty()) cleared.resize(nr_blocks);
+		while (!to_clear.empty()) {
+			auto [b, lost] = to_clear.back();
+			to_clear.pop_back();
+			auto& block_liveness = solution.blocks[b];
+			lost &= block_liveness.live_in & ~block_liveness.gen & ~cleared[b];
+			if (!lost) continue;
+			cleared[b] |= lost;
+			block_liveness.live_in &= ~lost;
+			push(b);
+			for (int predecessor : cfg.blocks[b].predecessors) {
+				push(predecessor);
+				solution.blocks[predecessor].live_out &= ~lost;
+				to_clear.push_back({ predecessor, lost });
+			}
+		}
+	}
+	solution.invalid.clear();
+	while (!worklist.empty()) {
+		int b = worklist.back();
+		worklist.pop_back();
+		flags[b] &= ~1;
+		auto& block_liveness = solution.blocks[b];
+		USE_MASK live_out = 0;
+		for (int successor : cfg.blocks[b].successors) {
+			if (successor == CFG_EXIT) live_out |= USE_MASK_END_OF_PROGRAM;
+			else if (successor >= 0) live_out |= solution.blocks[successor].live_in;
+		}
+		USE_MASK live_in = block_liveness.gen | (live_out & ~block_liveness.kill);
+		block_liveness.live_out = live_out;
+		if (live_in == block_liveness.live_in) continue;
+		block_liveness.live_in = live_in;
+		for (int predecessor : cfg.blocks[b].predecessors) push(predecessor);
+	}
+	// only the blocks pushed have flags or cleared bits left
+	for (int b : visited) {
+		flags[b] = 0;
+		// cleared only grows when something is cleared, blocks added since are 0 already
+		if (size_t(b) < solution.cleared.size()) solution.cleared[b] = 0;
+	}
+	if (!from_scratch) {
+		for (size_t i = 0; i != visited.size(); i++) if (solution.blocks[visited[i]].live_out != old_live_out[i]) changed.push_back(visited[i]);
+		std::sort(changed.begin(), changed.end());
+		changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+	}
+}
+
+void liveness_invalidate(LivenessSolution& solution, const ControlFlowGraph& cfg, int first, int last) {
+	if (cfg.blocks.empty()) return;
+	for (int b = cfg_block_of(cfg, std::max(first, 0)); b != int(cfg.blocks.size()) && cfg.blocks[b].first <= last; b++) solution.invalid.push_back(b);
+}
+void liveness_invalidate(LivenessSolution& solution, const ControlFlowGraph& cfg, std::span<const int> positions) {
+	if (cfg.blocks.empty()) return;
+	for (int position : positions) {
+		int b = cfg_block_of(cfg, position);
+		if (solution.invalid.empty() || solution.invalid.back() != b) solution.invalid.push_back(b);
+	}
+}
+
+#define LIVE_RANGE_POSITIONS USE_MASK_END_OF_PROGRAM
+
+// merges ranges [begin, end) that touch, [a, b] [b + 1, c] is [a, c]
+void merge_live_ranges(std::vector<LiveRange>& ranges, int begin, int end) {
+	int kept = begin;
+	for (int i = begin; i != end; i++) {
+		if (kept != begin && ranges[kept - 1].last + 1 >= ranges[i].first) ranges[kept - 1].last = std::max(ranges[kept - 1].last, ranges[i].last);
+		else ranges[kept++] = ranges[i];
+	}
+	ranges.erase(ranges.begin() + kept, ranges.begin() + end);
+}
+// the first range ending at or after <gap>
+int live_range_after(const std::vector<LiveRange>& ranges, int gap) {
+	return int(std::lower_bound(ranges.begin(), ranges.end(), gap, [](const LiveRange& range, int gap) { return range.last < gap; }) - ranges.begin());
+}
+
+// use masks of the gaps [block.first, block.last]
+void block_gap_masks(const BasicBlock& block, USE_MASK live_out, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, std::vector<USE_MASK>& masks) {
+	masks.resize(block.last - block.first + 1);
+	USE_MASK use_mask = live_out;
+	for (int i = block.last; i >= block.first; i--) {
+		use_mask = use_mask_above(instructions[i], extensions[instructions[i].extension].instructions[instructions[i].index], use_mask);
+		masks[i - block.first] = use_mask;
+	}
+}
+void live_ranges_build(LiveRanges& live_ranges, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const ControlFlowGraph& cfg, const LivenessSolution& solution) {
+	int size = int(instructions.size());
+	for (int bit = 0; bit != 64; bit++) {
+		live_ranges.ranges[bit].clear();
+		if (LIVE_RANGE_POSITIONS & (1ull << bit)) live_ranges.ranges[bit].push_back({ size, size });
+	}
+	std::vector<int> blocks(cfg.blocks.size());
+	for (int b = 0; b != int(blocks.size()); b++) blocks[b] = b;
+	live_ranges_update(live_ranges, instructions, extensions, cfg, solution, blocks);
+}
+USE_MASK live_ranges_at(const LiveRanges& live_ranges, int gap) {
+	return live_ranges_alive_throughout(live_ranges, gap, gap);
+}
+USE_MASK live_ranges_at(const LiveRanges& live_ranges, int gap, USE_MASK positions) {
+	USE_MASK result = 0;
+	for (positions &= LIVE_RANGE_POSITIONS; positions; positions &= positions - 1) {
+		int bit = std::countr_zero(positions);
+		auto& ranges = live_ranges.ranges[bit];
+		int range = live_range_after(ranges, gap);
+		if (range != int(ranges.size()) && ranges[range].first <= gap) result |= 1ull << bit;
+	}
+	return result;
+}
+USE_MASK live_ranges_alive_throughout(const LiveRanges& live_ranges, int first_gap, int last_gap) {
+	USE_MASK result = 0;
+	for (USE_MASK positions = LIVE_RANGE_POSITIONS; positions; positions &= positions - 1) {
+		int bit = std::countr_zero(positions);
+		auto& ranges = live_ranges.ranges[bit];
+		int range = live_range_after(ranges, last_gap);
+		if (range != int(ranges.size()) && ranges[range].first <= first_gap) result |= 1ull << bit;
+	}
+	return result;
+}
+USE_MASK live_ranges_alive_anywhere(const LiveRanges& live_ranges, int first_gap, int last_gap, USE_MASK positions) {
+	// the ones without ranges are never known to be dead
+	USE_MASK result = positions & ~LIVE_RANGE_POSITIONS;
+	for (positions &= LIVE_RANGE_POSITIONS; positions; positions &= positions - 1) {
+		int bit = std::countr_zero(positions);
+		auto& ranges = live_ranges.ranges[bit];
+		int range = live_range_after(ranges, first_gap);
+		if (range != int(ranges.size()) && ranges[range].first <= last_gap) result |= 1ull << bit;
+	}
+	return result;
+}
+
+// appends [first, last] behind ranges that end before it, merging when they touch
+void append_live_range(std::vector<LiveRange>& ranges, int first, int last) {
+	if (first > last) return;
+	if (ranges.size() && ranges.back().last + 1 >= first) ranges.back().last = std::max(ranges.back().last, last);
+	else ranges.push_back({ first, last });
+}
+// one pass per position over its ranges, replacing the gaps of all the blocks at once
+void live_ranges_update(LiveRanges& live_ranges, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const ControlFlowGraph& cfg, const LivenessSolution& solution, const std::vector<int>& blocks) {
+	if (blocks.empty()) return;
+	// use masks of the gaps of every block in <blocks>, one after the other
+	std::vector<USE_MASK> masks{};
+	std::vector<USE_MASK> block_masks{};
+	for (int b : blocks) {
+		block_gap_masks(cfg.blocks[b], solution.blocks[b].live_out, instructions, extensions, block_masks);
+		masks.insert(masks.end(), block_masks.begin(), block_masks.end());
+	}
+	// only the ranges from the one touching the first block to the one touching the last block are rebuilt
+	int first_gap_of_all = cfg.blocks[blocks.front()].first, last_gap_of_all = cfg.blocks[blocks.back()].last;
+	std::vector<LiveRange> result{};
+	for (USE_MASK positions = LIVE_RANGE_POSITIONS; positions; positions &= positions - 1) {
+		int bit = std::countr_zero(positions);
+		auto& ranges = live_ranges.ranges[bit];
+		int begin = live_range_after(ranges, first_gap_of_all - 1);
+		int end = int(std::partition_point(ranges.begin() + begin, ranges.end(), [&](const LiveRange& range) { return range.first <= last_gap_of_all + 1; }) - ranges.begin());
+		result.clear();
+		int range = begin;
+		int range_first = range == end ? 0 : ranges[range].first; // the part of ranges[range] that is not handled yet
+		USE_MASK* block_mask = masks.data();
+		for (int b : blocks) {
+			int first_gap = cfg.blocks[b].first, last_gap = cfg.blocks[b].last;
+			while (range != end && range_first <= last_gap) {
+				if (range_first < first_gap) append_live_range(result, range_first, std::min(ranges[range].last, first_gap - 1));
+				if (ranges[range].last > last_gap) {
+					range_first = last_gap + 1;
+					break;
+				}
+				if (++range != end) range_first = ranges[range].first;
+			}
+			for (int gap = first_gap; gap <= last_gap; gap++, block_mask++)
+				if (*block_mask & (1ull << bit)) append_live_range(result, gap, gap);
+		}
+		for (; range != end; range++) {
+			append_live_range(result, range_first, ranges[range].last);
+			if (range + 1 != end) range_first = ranges[range + 1].first;
+		}
+		ranges.insert(ranges.erase(ranges.begin() + begin, ranges.begin() + end), result.begin(), result.end());
+	}
+}
+void live_ranges_insert(LiveRanges& live_ranges, int position, int count) {
+	for (auto& ranges : live_ranges.ranges)
+		for (auto range = ranges.begin() + live_range_after(ranges, position); range != ranges.end(); ++range) {
+			if (range->first >= position) range->first += count;
+			range->last += count;
+		}
+}
+void live_ranges_erase(LiveRanges& live_ranges, int position, int count) {
+	// gaps [position, position + count) are the ones above the removed instructions
+	for (auto& ranges : live_ranges.ranges) {
+		int first_moved = live_range_after(ranges, position);
+		auto begin = ranges.begin() + first_moved;
+		for (auto range = begin; range != ranges.end(); ++range) {
+			range->first = range->first < position ? range->first : std::max(range->first - count, position);
+			range->last = range->last >= position + count ? range->last - count : position - 1;
+		}
+		ranges.erase(std::remove_if(begin, ranges.end(), [](const LiveRange& range) { return range.first > range.last; }), ranges.end());
+		// only the ranges around the removed gaps can touch now
+		int from = std::max(first_moved - 1, 0);
+		int to = int(std::partition_point(ranges.begin() + from, ranges.end(), [&](const LiveRange& range) { return range.first <= position + 1; }) - ranges.begin());
+		merge_live_ranges(ranges, from, to);
+	}
+}
+void live_ranges_insert(LiveRanges& live_ranges, std::span<const int> positions) {
+	if (positions.empty()) return;
+	// gap g moves down by the instructions inserted at or above it, a range around one of them grows over the new gaps
+	for (auto& ranges : live_ranges.ranges)
+		for (auto range = ranges.begin() + live_range_after(ranges, positions[0]); range != ranges.end(); ++range) {
+			range->first += inserted_in_front(positions, range->first);
+			range->last += inserted_in_front(positions, range->last);
+		}
+}
+void live_ranges_erase(LiveRanges& live_ranges, std::span<const int> positions) {
+	if (positions.empty()) return;
+	// the gaps above the erased instructions go, the others move up by the number of those above them
+	for (auto& ranges : live_ranges.ranges) {
+		int first_moved = live_range_after(ranges, positions[0]);
+		auto kept = ranges.begin() + first_moved;
+		auto p = positions.begin();
+		for (auto range = kept; range != ranges.end(); ++range) {
+			p = std::lower_bound(p, positions.end(), range->first);
+			int first = range->first - int(p - positions.begin());
+			int last = range->last - int(std::upper_bound(p, positions.end(), range->last) - positions.begin());
+			if (first <= last) *kept++ = { first, last };
+		}
+		ranges.erase(kept, ranges.end());
+		merge_live_ranges(ranges, std::max(first_moved - 1, 0), int(ranges.size()));
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <vector>
+#include "instructions.h"
+#include "instruction_buffer.h"
+#include "control_flow.h"
+
+#define USE_MASK unsigned long long
+#define USE_RAX (1ull << 0)
+#define USE_RBX (1ull << 1)
+#define USE_RCX (1ull << 2)
+#define USE_RDX (1ull << 3)
+#define USE_RSI (1ull << 4)
+#define USE_RDI (1ull << 5)
+#define USE_RSP (1ull << 6)
+#define USE_RBP (1ull << 7)
+#define USE_R8 (1ull << 8)
+#define USE_R9 (1ull << 9)
+#define USE_R10 (1ull << 10)
+#define USE_R11 (1ull << 11)
+#define USE_R12 (1ull << 12)
+#define USE_R13 (1ull << 13)
+#define USE_R14 (1ull << 14)
+#define USE_R15 (1ull << 15)
+
+#define USE_CF (1ull << 16)
+#define USE_PF (1ull << 17)
+#define USE_AF (1ull << 18)
+#define USE_ZF (1ull << 19)
+#define USE_SF (1ull << 20)
+#define USE_DF (1ull << 21)
+#define USE_OF (1ull << 22)
+
+#define USE_UNKNOWN (1ull << 23)
+
+// xmm0: 1ull << 32 ... xmm31: 1ull << 63
+
+// everything is assumed to be alive after the last instruction
+#define USE_MASK_END_OF_PROGRAM 0xffffffff00ffffffull
+
+USE_MASK get_use_mask_in(const Instruction instruction, const InstructionFootprint& footprint);
+USE_MASK get_use_mask_in_pointer(const Instruction instruction, const InstructionFootprint& footprint);
+USE_MASK get_use_mask_in_index(const Instruction instruction, const InstructionFootprint& footprint);
+USE_MASK get_use_mask_out(const Instruction instruction, const InstructionFootprint& footprint);
+USE_MASK get_use_mask_out_pointer(const Instruction instruction, const InstructionFootprint& footprint);
+USE_MASK get_use_mask_out_index(const Instruction instruction, const InstructionFootprint& footprint);
+
+// positions alive directly above <instruction>, given the ones alive directly below it
+USE_MASK use_mask_above(const Instruction instruction, const InstructionFootprint& footprint, USE_MASK below);
+
+// the bit of a RegisterSwap position (0x1r or 0x2s)
+#define USE_MASK_OF_POSITION(pos) (((pos) & 0x20ull) ? 1ull << (32 + ((pos) & 0x1f)) : 1ull << ((pos) & 0xf))
+// the PlaceMasks bits of the registers and flags of a use mask and back, memory and control flow have none
+unsigned long long places_of_use_mask(USE_MASK use_mask);
+USE_MASK use_mask_of_places(unsigned long long places);
+
+// transfer function of a basic block: above = gen | (below & ~kill)
+struct BlockLiveness {
+	USE_MASK gen;
+	USE_MASK kill;
+	USE_MASK live_in;
+	USE_MASK live_out;
+};
+// global liveness over the ControlFlowGraph, one entry per block. leaving the listing counts as the end of the program.
+// until the blocks are built again, changes keep their indices and edges and only move their bounds,
+// so the blocks whose instructions changed are the only ones the solution has to start from.
+struct LivenessSolution {
+	std::vector<BlockLiveness> blocks{};
+	int cfg_generation = -1; // ControlFlowGraph::generation of the blocks it was solved for
+	std::vector<int> invalid{}; // blocks whose gen and kill the next liveness_solve recomputes
+	// per block, all 0 between two liveness_solve
+	std::vector<char> flags{};
+	std::vector<USE_MASK> cleared{};
+};
+// re-solves after instructions [first, last] changed (first > last if none did). gen and kill are recomputed for the blocks
+// overlapping them and the invalidated ones, the rest keeps its old values. after the blocks were built again it starts over.
+// <changed> gets every block whose live_out or transfer function changed, the ones LiveRanges has to rewrite.
+void liveness_solve(LivenessSolution& solution, const ControlFlowGraph& cfg, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, int first, int last, std::vector<int>& changed);
+// the next liveness_solve recomputes gen and kill of the blocks overlapping [first, last], for several separate changes solved at once
+void liveness_invalidate(LivenessSolution& solution, const ControlFlowGraph& cfg, int first, int last);
+// the same for the blocks holding the instructions at sorted <positions>
+void liveness_invalidate(LivenessSolution& solution, const ControlFlowGraph& cfg, std::span<const int> positions);
+
+// gap g is the boundary directly above instruction g, gap instructions.size() is the end of the program.
+// a live range is a run of gaps [first, last] in which a position holds a value that is read later.
+struct LiveRange {
+	int first;
+	int last;
+};
+// for every bit of USE_MASK_END_OF_PROGRAM, its live ranges sorted and not touching each other,
+// so finding the range around a gap is a binary search.
+// the gap above the first instruction of a block holds the live_in of the block, the one below the last instruction
+// of the block before it is that block's live_out, which may differ if it ends in a jump.
+struct LiveRanges {
+	std::vector<LiveRange> ranges[64]{};
+};
+
+void live_ranges_build(LiveRanges& live_ranges, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const ControlFlowGraph& cfg, const LivenessSolution& solution);
+// use mask at gap <gap>
+USE_MASK live_ranges_at(const LiveRanges& live_ranges, int gap);
+// the same for only the bits of <positions>, each one a binary search
+USE_MASK live_ranges_at(const LiveRanges& live_ranges, int gap, USE_MASK positions);
+// positions alive in every gap of [first_gap, last_gap]
+USE_MASK live_ranges_alive_throughout(const LiveRanges& live_ranges, int first_gap, int last_gap);
+// the ones of <positions> alive in at least one gap of [first_gap, last_gap]
+USE_MASK live_ranges_alive_anywhere(const LiveRanges& live_ranges, int first_gap, int last_gap, USE_MASK positions);
+
+// rewrites the gaps of <blocks> (sorted), walking up from their live_out
+void live_ranges_update(LiveRanges& live_ranges, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, const ControlFlowGraph& cfg, const LivenessSolution& solution, const std::vector<int>& blocks);
+// shift the gaps for <count> instructions inserted or removed at <position>.
+// the gaps of the inserted instructions are only a guess until live_ranges_update covers them.
+void live_ranges_insert(LiveRanges& live_ranges, int position, int count);
+void live_ranges_erase(LiveRanges& live_ranges, int position, int count);
+// the same for single instructions at sorted <positions>, counted after inserting or before erasing, one pass per position
+void live_ranges_insert(LiveRanges& live_ranges, std::span<const int> positions);
+void live_ranges_erase(LiveRanges& live_ranges, std::span<const int> positions);
@@ -1,20 +1,187 @@
 #include "main_state.h"
+#include "mapped_file.h"
+#include "isa_cache.h"
+#include "move_elimination.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
 
 MainState init_example_main_state() {
 	MainState result{
-		.extensions = {
-			read_instruction_set_extension("inputs/builtins.txt"), // has to be first
-			read_instruction_set_extension("inputs/binary.txt"),
-			read_instruction_set_extension("inputs/bits.txt"),
-			read_instruction_set_extension("inputs/cmp.txt"),
-			read_instruction_set_extension("inputs/jmp.txt"),
-			read_instruction_set_extension("inputs/mov.txt"),
-		},
-		.instructions = { {} , {} },
-		.undo_redo_list = {},
-		.change_count = 0
+		.extensions = read_instruction_set_extensions({
+			"inputs/builtins.txt", // has to be first
+			"inputs/binary.txt",
+			"inputs/bits.txt",
+			"inputs/cmp.txt",
+			"inputs/jmp.txt",
+			"inputs/mov.txt",
+		}, "inputs/isa.cache"),
+		.instructions = {},
+		.change_log = {}
 	};
-	load_instruction("ADD32 RAX RBX", result.instructions[0], result.extensions);
-	load_instruction("MOV64 RCX RAX", result.instructions[1], result.extensions);
+	result.mnemonics = build_mnemonic_index(result.extensions);
+	std::vector<Instruction> instructions(2);
+	load_instruction("ADD32 RAX RBX", instructions[0], result.extensions, &result.mnemonics);
+	load_instruction("MOV64 RCX RAX", instructions[1], result.extensions, &result.mnemonics);
+	main_state_set_instructions(result, std::move(instructions));
 	return result;
-}
\ No newline at end of file
+}
+
+void main_state_apply_change(MainState& main_state, Change* change) {
+	if (change->type == MOVE_ELIMINATION) return apply_move_elimination(main_state, change->elimination);
+	apply_change(main_state.instructions, main_state.extensions, change);
+	place_masks_apply_change(main_state.places, main_state.instructions, main_state.extensions, *change);
+	def_use_apply_change(main_state.def_use, main_state.places, *change);
+	cfg_apply_change(main_state.cfg, main_state.instructions, main_state.extensions, main_state.places, *change);
+	liveness_apply_change(main_state.liveness, main_state.live_ranges, main_state.instructions, main_state.extensions, main_state.cfg, *change);
+}
+void main_state_undo_last_change(MainState& main_state, Change* change) {
+	if (change->type == MOVE_ELIMINATION) return undo_move_elimination(main_state, change->elimination);
+	undo_last_change(main_state.instructions, main_state.extensions, change);
+	place_masks_undo_change(main_state.places, main_state.instructions, main_state.extensions, *change);
+	def_use_undo_change(main_state.def_use, main_state.places, *change);
+	cfg_undo_change(main_state.cfg, main_state.instructions, main_state.extensions, *change);
+	liveness_undo_change(main_state.liveness, main_state.live_ranges, main_state.instructions, main_state.extensions, main_state.cfg, *change);
+}
+// everything that is built from the instructions
+void main_state_rebuild(MainState& main_state) {
+	place_masks_build(main_state.places, main_state.instructions, main_state.extensions);
+	def_use_build(main_state.def_use, main_state.places);
+	cfg_build(main_state.cfg, main_state.instructions, main_state.extensions, main_state.places);
+	std::vector<int> changed_blocks{};
+	main_state.liveness = {};
+	liveness_solve(main_state.liveness, main_state.cfg, main_state.instructions, main_state.extensions, 0, -1, changed_blocks);
+	live_ranges_build(main_state.live_ranges, main_state.instructions, main_state.extensions, main_state.cfg, main_state.liveness);
+}
+// replaces the instructions with <instructions>, which differ from them in <runs>. the indices are only updated for the runs,
+// from the front, so in front of a run they are already the new ones. the blocks are built again from the jumps and
+// if their edges stayed the same, only the blocks holding other instructions are solved again. when most of the
+// instructions differ, building everything again is faster
+void main_state_restore(MainState& main_state, const InstructionBuffer& instructions, std::span<const InstructionRun> runs) {
+	// the indices are patched in place, so every run has to lie inside both the old and the new instructions
+	size_t restored = 0, size = main_state.instructions.size(), end = 0;
+	for (auto& run : runs) {
+		if (run.first < end || run.first + run.old_count > size || run.first + run.new_count > instructions.size()) assert(false);
+		size += run.new_count - run.old_count;
+		end = run.first + run.new_count;
+		restored += run.new_count;
+	}
+	if (size != instructions.size()) assert(false);
+	main_state.instructions = instructions;
+	if (restored > main_state.instructions.size() / 2) return main_state_rebuild(main_state);
+	std::vector<Instruction> inserted{};
+	for (auto& run : runs) {
+		int first = int(run.first), common = int(std::min(run.old_count, run.new_count));
+		int rest = int(run.first + common), old_rest = int(run.old_count) - common, new_rest = int(run.new_count) - common;
+		if (common) {
+			place_masks_update(main_state.places, main_state.instructions, main_state.extensions, first, rest - 1);
+			def_use_update(main_state.def_use, main_state.places, first, rest - 1);
+		}
+		if (old_rest) {
+			place_masks_erase(main_state.places, rest, old_rest);
+			def_use_erase(main_state.def_use, rest, old_rest);
+			live_ranges_erase(main_state.live_ranges, rest, old_rest);
+		}
+		if (new_rest) {
+			inserted.clear();
+			for (int i = rest; i != rest + new_rest; i++) inserted.push_back(main_state.instructions[i]);
+			place_masks_insert(main_state.places, main_state.extensions, rest, inserted);
+			def_use_insert(main_state.def_use, main_state.places, rest, new_rest);
+			live_ranges_insert(main_state.live_ranges, rest, new_rest);
+		}
+		cfg_erase(main_state.cfg, first, int(run.old_count));
+		cfg_insert(main_state.cfg, main_state.places, first, int(run.new_count));
+	}
+	std::vector<int> changed_blocks{};
+	cfg_rebuild_blocks(main_state.cfg, main_state.instructions, main_state.extensions, runs, changed_blocks);
+	for (int b : changed_blocks) liveness_invalidate(main_state.liveness, main_state.cfg, main_state.cfg.blocks[b].first, main_state.cfg.blocks[b].first);
+	liveness_solve(main_state.liveness, main_state.cfg, main_state.instructions, main_state.extensions, 0, -1, changed_blocks);
+	live_ranges_update(main_state.live_ranges, main_state.instructions, main_state.extensions, main_state.cfg, main_state.liveness, changed_blocks);
+}
+
+void main_state_record_change(MainState& main_state, const Change& change) {
+	ChangeLog& log = main_state.change_log;
+	change_log_record(log, change, main_state.elimination_steps);
+	if (log.current.index % CHANGE_LOG_SNAPSHOT_INTERVAL == 0) {
+		change_log_add_snapshot(log, main_state.instructions);
+		change_log_trim(log);
+	}
+}
+bool main_state_undo(MainState& main_state) {
+	Change change;
+	if (!change_log_step_back(main_state.change_log, change, main_state.elimination_steps)) return false;
+	main_state_undo_last_change(main_state, &change);
+	return true;
+}
+bool main_state_redo(MainState& main_state) {
+	ChangeLog& log = main_state.change_log;
+	int branch = change_log_redo_branch(log);
+	if (branch < 0) return false;
+	if (branch != log.current.branch) change_log_enter_branch(log, branch);
+	Change change;
+	change_log_step_forward(log, change, main_state.elimination_steps);
+	main_state_apply_change(main_state, &change);
+	return true;
+}
+void main_state_checkout(MainState& main_state, int branch, int index) {
+	ChangeLog& log = main_state.change_log;
+	if (branch < 0 || branch >= int(log.branches.size()) || log.branches[branch].parent == CHANGE_BRANCH_DROPPED) return;
+	index = std::min(index, log.branches[branch].count);
+	// a point before the start of a branch is on the one it leaves
+	while (log.branches[branch].parent >= 0 && index <= log.branches[branch].start.index) branch = log.branches[branch].parent;
+	index = std::max(index, log.branches[branch].start.index);
+	std::vector<int> path = change_log_path(log, branch);
+
+	// undo back to where the path to current and the one to <index> part, then redo along the latter
+	int fork = log.current.index;
+	for (int b = log.current.branch; ; b = log.branches[b].parent) {
+		int on_path = change_log_path_index(log, path, index, b);
+		if (on_path >= 0) {
+			fork = std::min(fork, on_path);
+			break;
+		}
+		fork = log.branches[b].start.index;
+	}
+	const ChangeLogSnapshot* snapshot = change_log_snapshot_on_path(log, path, index);
+	std::vector<InstructionRun> runs{};
+	if (snapshot) {
+		instruction_buffer_runs(main_state.instructions, snapshot->instructions, runs);
+		size_t restored = 0;
+		for (auto& run : runs) restored += std::max(run.old_count, run.new_count);
+		long long restore_cost = CHANGE_LOG_RESTORE_COST + (long long)(restored / CHANGE_LOG_RESTORED_PER_CHANGE);
+		if (index - snapshot->position.index + restore_cost < log.current.index - fork + index - fork) {
+			main_state_restore(main_state, snapshot->instructions, runs);
+			log.current = snapshot->position;
+		}
+	}
+	while (log.current.index > change_log_path_index(log, path, index, log.current.branch)) main_state_undo(main_state);
+	Change change;
+	while (log.current.branch != branch || log.current.index != index) {
+		size_t next = std::find(path.begin(), path.end(), log.current.branch) - path.begin() + 1;
+		if (next != path.size() && log.branches[path[next]].start.index == log.current.index) change_log_enter_branch(log, path[next]);
+		change_log_step_forward(log, change, main_state.elimination_steps);
+		main_state_apply_change(main_state, &change);
+	}
+}
+
+void main_state_set_instructions(MainState& main_state, std::vector<Instruction>&& instructions) {
+	main_state.instructions = InstructionBuffer(instructions);
+	main_state_rebuild(main_state);
+	// the recorded changes refer to the old instructions
+	main_state.change_log = { .memory_budget = main_state.change_log.memory_budget };
+	change_log_add_snapshot(main_state.change_log, main_state.instructions);
+	main_state.temporary_change = { .type = 0 };
+}
+bool main_state_load_listing(MainState& main_state, const char* path, ListingError& error) {
+	MappedFile file;
+	if (!map_file(path, file)) {
+		error = { 0, 0, "could not open file" };
+		return false;
+	}
+	std::vector<Instruction> instructions{};
+	instructions.reserve(file.size / LISTING_BYTES_PER_LINE_ESTIMATE + 1);
+	bool ok = parse_listing_parallel(mapped_view(file), instructions, main_state.extensions, &main_state.mnemonics, error);
+	unmap_file(file);
+	if (ok) main_state_set_instructions(main_state, std::move(instructions));
+	return ok;
+}
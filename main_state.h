@@ -1,11 +1,36 @@
 #pragma once
 #include "changes.h"
+#include "change_log.h"
+#include "liveness.h"
+#include "listing_parser.h"
 
 struct MainState {
 	std::vector<InstructionSetExtension> extensions;
-	std::vector<Instruction> instructions;
-	std::vector<Change> undo_redo_list;
-	int change_count;
+	InstructionBuffer instructions;
+	ChangeLog change_log{};
+	std::vector<EliminationStep> elimination_steps{}; // of the MoveElimination being applied, the change log keeps the others
 	Change temporary_change{ .type = 0 };
+	LivenessSolution liveness{};
+	LiveRanges live_ranges{};
+	PlaceMasks places{}; // in parallel with instructions
+	DefUse def_use{}; // built from places
+	ControlFlowGraph cfg{};
+	MnemonicIndex mnemonics{};
 };
-MainState init_example_main_state();
\ No newline at end of file
+MainState init_example_main_state();
+
+// apply_change / undo_last_change, keeping the indices in MainState up to date
+void main_state_apply_change(MainState& main_state, Change* change);
+void main_state_undo_last_change(MainState& main_state, Change* change);
+// adds a change that was just applied to the change log, on a new branch if something was undone before
+void main_state_record_change(MainState& main_state, const Change& change);
+// false if there is nothing to undo/redo. redo continues on the branch visited last
+bool main_state_undo(MainState& main_state);
+bool main_state_redo(MainState& main_state);
+// undoes and redoes until change <index> on <branch> is the last one applied, restoring the deepest snapshot on
+// the way first if that is less work
+void main_state_checkout(MainState& main_state, int branch, int index);
+void main_state_set_instructions(MainState& main_state, std::vector<Instruction>&& instructions);
+// replaces the instructions with the listing in the file, the file is parsed in place on all hardware threads.
+// on failure nothing is changed.
+bool main_state_load_listing(MainState& main_state, const char* path, ListingError& error);
@@ -0,0 +1,65 @@
+#include "mapped_file.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+bool map_file(const char* path, MappedFile& result) {
+	result = { nullptr, 0, INVALID_HANDLE_VALUE, nullptr };
+	result.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (result.file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(result.file, &size)) {
+		unmap_file(result);
+		return false;
+	}
+	result.size = size_t(size.QuadPart);
+	if (result.size == 0) return true; // empty files can not be mapped
+	result.mapping = CreateFileMappingA(result.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (result.mapping) result.data = (const char*)MapViewOfFile(result.mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!result.data) {
+		unmap_file(result);
+		return false;
+	}
+	return true;
+}
+void unmap_file(MappedFile& mapped) {
+	if (mapped.data) UnmapViewOfFile(mapped.data);
+	if (mapped.mapping) CloseHandle(mapped.mapping);
+	if (mapped.file != INVALID_HANDLE_VALUE) CloseHandle(mapped.file);
+	mapped = { nullptr, 0, INVALID_HANDLE_VALUE, nullptr };
+}
+#else
+bool map_file(const char* path, MappedFile& result) {
+	result = { nullptr, 0, -1 };
+	result.file = open(path, O_RDONLY);
+	if (result.file < 0) return false;
+	struct stat info;
+	if (fstat(result.file, &info) != 0) {
+		unmap_file(result);
+		return false;
+	}
+	result.size = size_t(info.st_size);
+	if (result.size == 0) return true; // empty files can not be mapped
+	void* data = mmap(nullptr, result.size, PROT_READ, MAP_PRIVATE, result.file, 0);
+	if (data == MAP_FAILED) {
+		unmap_file(result);
+		return false;
+	}
+	madvise(data, result.size, MADV_SEQUENTIAL);
+	result.data = (const char*)data;
+	return true;
+}
+void unmap_file(MappedFile& mapped) {
+	if (mapped.data) munmap((void*)mapped.data, mapped.size);
+	if (mapped.file >= 0) close(mapped.file);
+	mapped = { nullptr, 0, -1 };
+}
+#endif
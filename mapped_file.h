@@ -0,0 +1,18 @@
+#pragma once
+#include <string_view>
+
+// read only view of a whole file, the memory stays valid until unmap_file
+struct MappedFile {
+	const char* data;
+	size_t size;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int file;
+#endif
+};
+// returns false if the file could not be opened or mapped
+bool map_file(const char* path, MappedFile& result);
+void unmap_file(MappedFile& mapped);
+inline std::string_view mapped_view(const MappedFile& mapped) { return { mapped.data, mapped.size }; }
@@ -0,0 +1,181 @@
+#include "move_elimination.h"
+#include <algorithm>
+
+// a MOV64/MOV256 between two registers, an XCHG64 of two registers or the SIMD swap through the stack at <position>.
+// returns its number of instructions, 0 if it is none of them
+int register_move_at(const InstructionBuffer& instructions, int position, unsigned long long& from, unsigned long long& to, bool& exchange) {
+	const Instruction& instruction = instructions[position];
+	if (instruction.extension != 0) return 0;
+	from = instruction.operands[0];
+	to = instruction.operands[1];
+	exchange = instruction.index == 2;
+	if (instruction.index == 0 || instruction.index == 2) return OP_IS_REGISTER(from) && OP_IS_REGISTER(to) ? 1 : 0;
+	if (instruction.index == 3) return OP_IS_SIMD_REGISTER(from) && OP_IS_SIMD_REGISTER(to) ? 1 : 0;
+	if (instruction.index != 8 || position + 5 > int(instructions.size())) return 0;
+	// SUB64 64 RSP, MOV256 pos1 -> *RSP, MOV256 pos2 -> pos1, MOV256 *RSP -> pos2, ADD64 64 RSP
+	from = instructions[position + 1].operands[0];
+	to = instructions[position + 2].operands[0];
+	if (!OP_IS_SIMD_REGISTER(from) || !OP_IS_SIMD_REGISTER(to)) return 0;
+	Instruction swap[MAX_INSERTED_INSTRUCTIONS];
+	int length = explicit_swap_instructions(3, from, to, swap);
+	for (int i = 0; i != length; i++) if (!same_instruction(instructions[position + i], swap[i])) return 0;
+	exchange = true;
+	return length;
+}
+
+Change build_move_elimination(MainState& main_state) {
+	const auto& instructions = main_state.instructions;
+	int size = int(instructions.size());
+	std::vector<int> targets{};
+	for (int jump : main_state.cfg.jumps) {
+		const Instruction& instruction = instructions[jump];
+		int target = jump_target(instruction, main_state.extensions[instruction.extension].instructions[instruction.index], jump, size);
+		if (target != CFG_EXIT) targets.push_back(target);
+	}
+	std::sort(targets.begin(), targets.end());
+	auto no_target = [&](int first, int count) {
+		auto target = std::lower_bound(targets.begin(), targets.end(), first);
+		return target == targets.end() || *target >= first + count;
+	};
+
+	auto& steps = main_state.elimination_steps;
+	Change result{};
+	result.elimination = { .type = MOVE_ELIMINATION, .first_step = int(steps.size()), .nr_steps = 0 };
+	int removed = 0; // by the steps so far, all of them above the instruction looked at
+	int removed_block = -1, removed_in_block = 0;
+	auto remove = [&](int first, int count) {
+		for (int i = 0; i != count; i++)
+			steps.push_back({ .kind = ELIMINATION_REMOVE, .first = first - removed, .last = first - removed, .pos1 = 0, .pos2 = 0, .removed = instructions[first + i] });
+		removed += count;
+		int block = cfg_block_of(main_state.cfg, first);
+		removed_in_block = (block == removed_block ? removed_in_block : 0) + count;
+		removed_block = block;
+	};
+	// every block keeps an instruction, so the removals only move the bounds of the blocks
+	auto block_keeps_one = [&](int first, int count) {
+		int block = cfg_block_of(main_state.cfg, first);
+		const BasicBlock& b = main_state.cfg.blocks[block];
+		return (block == removed_block ? removed_in_block : 0) + count < b.last - b.first + 1;
+	};
+	int block = 0;
+	for (int p = 0; p < size; p++) {
+		unsigned long long a, b;
+		bool exchange;
+		int length = register_move_at(instructions, p, a, b, exchange);
+		if (!length) continue;
+		USE_MASK written = USE_MASK_OF_POSITION(b) | (exchange ? USE_MASK_OF_POSITION(a) : 0);
+		if ((a == b || !live_ranges_at(main_state.live_ranges, p + length, written)) && no_target(p, length) && block_keeps_one(p, length)) {
+			remove(p, length);
+			p += length - 1;
+			continue;
+		}
+		// only the instructions using a or b matter, the block ends at the next jump or jump target
+		while (main_state.cfg.blocks[block].last < p) block++;
+		int last = std::min(main_state.cfg.blocks[block].last, p + MOVE_ELIMINATION_MAX_DISTANCE);
+		int next = p + length - 1; // the MOV256 inside a stack swap are not looked at on their own
+		bool rename = false;
+		for (int q = p + length - 1; (q = std::min(def_use_next(main_state.def_use, a, q + 1, size), def_use_next(main_state.def_use, b, q + 1, size))) <= last; ) {
+			unsigned long long c, d;
+			bool partner_exchange;
+			int partner_length = register_move_at(instructions, q, c, d, partner_exchange);
+			if (partner_length && q + partner_length - 1 <= last && partner_exchange == exchange && ((c == a && d == b) || (c == b && d == a))) {
+				if (!exchange) {
+					if (block_keeps_one(q, partner_length)) remove(q, partner_length); // b already holds what a holds
+				}
+				else if (no_target(p, length) && block_keeps_one(p, length + partner_length)) {
+					// swapping, renaming and swapping back is only renaming
+					if (rename) steps.push_back({ .kind = ELIMINATION_RENAME, .first = p + length - removed, .last = q - 1 - removed, .pos1 = a, .pos2 = b, .removed = {} });
+					remove(p, length);
+					remove(q, partner_length);
+				}
+				else break;
+				next = q + partner_length - 1;
+				break;
+			}
+			if (exchange ? !can_swap_registers(main_state.extensions, instructions[q], a, b)
+				: (main_state.places.written[q] & (PLACE_OF_POSITION(a) | PLACE_OF_POSITION(b))) != 0) break;
+			rename = true;
+		}
+		p = next;
+	}
+	result.elimination.nr_steps = int(steps.size()) - result.elimination.first_step;
+	if (!result.elimination.nr_steps) result.type = 0;
+	return result;
+}
+
+// the same updates main_state_apply_change makes for inserted instructions, for all removed ones at once.
+// positions are sorted and counted with them, the liveness is only solved again after all steps
+void elimination_erase(MainState& main_state, std::span<const int> positions) {
+	main_state.instructions.erase(positions);
+	place_masks_erase(main_state.places, positions);
+	def_use_erase(main_state.def_use, positions);
+	liveness_invalidate(main_state.liveness, main_state.cfg, positions);
+	cfg_erase(main_state.cfg, positions);
+	relocate_jumps(main_state.cfg, main_state.instructions, main_state.extensions, positions, false);
+	live_ranges_erase(main_state.live_ranges, positions);
+}
+void elimination_insert(MainState& main_state, std::span<const int> positions, std::span<const Instruction> instructions) {
+	main_state.instructions.insert(positions, instructions);
+	place_masks_insert(main_state.places, main_state.extensions, positions, instructions);
+	def_use_insert(main_state.def_use, main_state.places, positions);
+	cfg_insert(main_state.cfg, main_state.places, positions);
+	relocate_jumps(main_state.cfg, main_state.instructions, main_state.extensions, positions, true);
+	live_ranges_insert(main_state.live_ranges, positions);
+	liveness_invalidate(main_state.liveness, main_state.cfg, positions);
+}
+// its own inverse, [first, last] are the positions before any instruction is removed
+void elimination_rename(MainState& main_state, int first, int last, unsigned long long pos1, unsigned long long pos2) {
+	for (int i = first; i <= last; i++) swap_registers_at(main_state.instructions, i, pos1, pos2);
+	place_masks_update(main_state.places, main_state.instructions, main_state.extensions, first, last);
+	def_use_update(main_state.def_use, main_state.places, first, last);
+	liveness_invalidate(main_state.liveness, main_state.cfg, first, last);
+}
+void elimination_solve(MainState& main_state) {
+	std::vector<int> changed_blocks{};
+	liveness_solve(main_state.liveness, main_state.cfg, main_state.instructions, main_state.extensions, 0, -1, changed_blocks);
+	live_ranges_update(main_state.live_ranges, main_state.instructions, main_state.extensions, main_state.cfg, main_state.liveness, changed_blocks);
+}
+
+// no rename covers a removed instruction, so they are renamed first and then all removed in one pass.
+// the steps count positions with the removals before them, these are the positions before any of them
+void apply_move_elimination(MainState& main_state, const MoveElimination& change) {
+	std::vector<int> positions{};
+	for (int i = change.first_step; i != change.first_step + change.nr_steps; i++) {
+		const EliminationStep& step = main_state.elimination_steps[i];
+		int removed = int(positions.size());
+		if (step.kind == ELIMINATION_REMOVE) positions.push_back(step.first + removed);
+		else elimination_rename(main_state, step.first + removed, step.last + removed, step.pos1, step.pos2);
+	}
+	elimination_erase(main_state, positions);
+	elimination_solve(main_state);
+}
+void undo_move_elimination(MainState& main_state, const MoveElimination& change) {
+	std::vector<int> positions{};
+	std::vector<Instruction> removed{};
+	for (int i = change.first_step; i != change.first_step + change.nr_steps; i++) {
+		const EliminationStep& step = main_state.elimination_steps[i];
+		if (step.kind != ELIMINATION_REMOVE) continue;
+		positions.push_back(step.first + int(removed.size()));
+		removed.push_back(step.removed);
+	}
+	elimination_insert(main_state, positions, removed);
+	for (int i = change.first_step, removed_before = 0; i != change.first_step + change.nr_steps; i++) {
+		const EliminationStep& step = main_state.elimination_steps[i];
+		if (step.kind == ELIMINATION_REMOVE) removed_before++;
+		else elimination_rename(main_state, step.first + removed_before, step.last + removed_before, step.pos1, step.pos2);
+	}
+	elimination_solve(main_state);
+}
+
+int main_state_eliminate_moves(MainState& main_state) {
+	// the steps of earlier eliminations are in the change log
+	main_state.elimination_steps.clear();
+	Change change = build_move_elimination(main_state);
+	if (!change.type) return 0;
+	main_state_apply_change(main_state, &change);
+	main_state_record_change(main_state, change);
+	int result = 0;
+	for (int i = change.elimination.first_step; i != change.elimination.first_step + change.elimination.nr_steps; i++)
+		result += main_state.elimination_steps[i].kind == ELIMINATION_REMOVE;
+	return result;
+}
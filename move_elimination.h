@@ -0,0 +1,21 @@
+#pragma once
+#include "main_state.h"
+
+// cleans up the MOV/XCHG that register swaps leave behind:
+//	a move or swap between a register and itself, or whose written registers are dead below it, is removed
+//	a MOV b <- a followed by MOV a <- b or MOV b <- a in the same block, with neither written in between, loses the second one
+//	two swaps of the same registers in the same block cancel, the instructions in between get the registers renamed
+//	if can_swap_registers allows it for all of them
+// the SIMD swap through the stack that explicit_swap_instructions inserts counts as one swap.
+// jump targets are never removed, so undoing puts every jump back where it was.
+// the partner of a move or swap is searched at most this many instructions further down
+#define MOVE_ELIMINATION_MAX_DISTANCE 256
+
+// appends the steps to main_state.elimination_steps, type 0 if there is nothing to eliminate.
+// candidates never overlap, running it again can find the ones removing others made possible.
+Change build_move_elimination(MainState& main_state);
+// called by main_state_apply_change/main_state_undo_last_change, keeping all indices up to date after every step
+void apply_move_elimination(MainState& main_state, const MoveElimination& change);
+void undo_move_elimination(MainState& main_state, const MoveElimination& change);
+// builds it and pushes it onto the undo list like a change made by hand, returns the number of instructions removed
+int main_state_eliminate_moves(MainState& main_state);
@@ -0,0 +1,177 @@
+#include "optimizer.h"
+#include "simulator.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <random>
+#include <thread>
+
+long long optimizer_cost_instruction_count(const MainState& main_state) {
+	return (long long)main_state.instructions.size();
+}
+long long optimizer_cost_in_order_cycles(const MainState& main_state) {
+	// cycle in which each place gets its last value. every instruction reads the control flow bit,
+	// jumps are assumed to be predicted
+	long long ready[64]{};
+	long long cycle = 0, finished = 0;
+	int issued = 0; // in this cycle
+	for (size_t i = 0; i != main_state.places.read.size(); i++) {
+		unsigned long long read = main_state.places.read[i] & ~PLACE_CONTROL_FLOW;
+		long long start = cycle;
+		for (unsigned long long bits = read; bits; bits &= bits - 1) start = std::max(start, ready[std::countr_zero(bits)]);
+		if (start == cycle && issued == OPTIMIZER_ISSUE_WIDTH) start++;
+		if (start != cycle) {
+			cycle = start;
+			issued = 0;
+		}
+		issued++;
+		long long done = start + ((read & PLACE_MEMORY) ? OPTIMIZER_LOAD_LATENCY : 1);
+		for (unsigned long long bits = main_state.places.written[i] & ~PLACE_CONTROL_FLOW; bits; bits &= bits - 1) ready[std::countr_zero(bits)] = done;
+		finished = std::max(finished, done);
+	}
+	return finished * OPTIMIZER_CYCLE_COST + (long long)main_state.instructions.size();
+}
+long long optimizer_cost_out_of_order_cycles(const MainState& main_state) {
+	SimulationResult result{};
+	simulate(result, main_state.instructions, main_state.extensions, main_state.places, default_simulator_settings());
+	return result.cycles * OPTIMIZER_CYCLE_COST + (long long)main_state.instructions.size();
+}
+
+OptimizerSettings default_optimizer_settings() {
+	return {
+		.cost = optimizer_cost_in_order_cycles,
+		.iterations = 20000,
+		.start_temperature = OPTIMIZER_CYCLE_COST,
+		.end_temperature = 0.5,
+		.max_vertical_distance = 8,
+		.threads = 0,
+		.seed = 1
+	};
+}
+
+// type 0 if there is nothing to change
+Change random_change(MainState& state, std::mt19937& random, const OptimizerSettings& settings) {
+	int size = int(state.instructions.size());
+	if (random() % 2) {
+		// general purpose registers or xmm registers, never mixed
+		unsigned long long kind = random() % 4 ? 0x10 : 0x20;
+		unsigned long long pos1 = kind | (random() % 16), pos2 = kind | (random() % 16);
+		if (pos1 == pos2) return { .type = 0 };
+		return build_horizontal_change(state.instructions, state.extensions, state.def_use, state.live_ranges, state.cfg, random() % (size + 1), pos1, pos2);
+	}
+	int distance = int(random() % (2 * settings.max_vertical_distance + 1)) - settings.max_vertical_distance;
+	Change result = build_vertical_change(state.places, state.live_ranges, state.cfg, random() % size, distance);
+	if (!result.vertical.number_places_down) result.type = 0;
+	return result;
+}
+
+struct OptimizerThread {
+	std::vector<Change> accepted{};
+	size_t best_length = 0; // the best program is the start with accepted[0, best_length) applied
+	long long best_cost = 0;
+	long long tried = 0;
+};
+// without the history, its snapshots can be large
+MainState optimizer_state(const MainState& main_state) {
+	return {
+		.extensions = main_state.extensions,
+		.instructions = main_state.instructions,
+		.change_log = {},
+		.elimination_steps = {},
+		.temporary_change = { .type = 0 },
+		.liveness = main_state.liveness,
+		.live_ranges = main_state.live_ranges,
+		.places = main_state.places,
+		.def_use = main_state.def_use,
+		.cfg = main_state.cfg
+	};
+}
+void optimizer_thread(const MainState& main_state, const OptimizerSettings& settings, unsigned int seed, OptimizerProgress* progress, OptimizerThread& result) {
+	MainState state = optimizer_state(main_state);
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	long long cost = settings.cost(state);
+	result.best_cost = cost;
+	for (int i = 0; i != settings.iterations; i++) {
+		if (progress) {
+			if (progress->cancel) break;
+			progress->iterations.fetch_add(1, std::memory_order_relaxed);
+		}
+		Change change = random_change(state, random, settings);
+		if (!change.type) continue;
+		result.tried++;
+		main_state_apply_change(state, &change);
+		long long new_cost = settings.cost(state);
+		// geometric cooling from start_temperature to end_temperature
+		double temperature = settings.start_temperature * std::pow(settings.end_temperature / settings.start_temperature, double(i) / settings.iterations);
+		if (new_cost > cost && uniform(random) >= std::exp(double(cost - new_cost) / temperature)) {
+			main_state_undo_last_change(state, &change);
+			continue;
+		}
+		result.accepted.push_back(change);
+		cost = new_cost;
+		if (cost < result.best_cost) {
+			result.best_cost = cost;
+			result.best_length = result.accepted.size();
+		}
+	}
+}
+
+OptimizerResult optimize(const MainState& main_state, const OptimizerSettings& settings, OptimizerProgress* progress) {
+	OptimizerResult result{ .changes = {}, .start_cost = settings.cost(main_state), .cost = 0, .tried = 0, .accepted = 0 };
+	result.cost = result.start_cost;
+	if (main_state.instructions.empty()) return result;
+	int threads = settings.threads > 0 ? settings.threads : std::max(1, int(std::thread::hardware_concurrency()));
+	std::vector<OptimizerThread> results(threads);
+	std::vector<std::thread> workers{};
+	for (int i = 1; i < threads; i++) workers.emplace_back(optimizer_thread, std::cref(main_state), std::cref(settings), settings.seed + i, progress, std::ref(results[i]));
+	optimizer_thread(main_state, settings, settings.seed, progress, results[0]);
+	for (auto& worker : workers) worker.join();
+
+	for (auto& thread : results) {
+		result.tried += thread.tried;
+		result.accepted += (long long)thread.accepted.size();
+		if (thread.best_cost < result.cost) {
+			result.cost = thread.best_cost;
+			result.changes.assign(thread.accepted.begin(), thread.accepted.begin() + thread.best_length);
+		}
+	}
+	return result;
+}
+
+void main_state_apply_optimizer_result(MainState& main_state, const OptimizerResult& result) {
+	for (Change change : result.changes) {
+		main_state_apply_change(main_state, &change);
+		main_state_record_change(main_state, change);
+	}
+}
+
+void optimizer_run_start(OptimizerRun& run, const MainState& main_state, const OptimizerSettings& settings) {
+	run.state = optimizer_state(main_state);
+	run.settings = settings;
+	if (run.settings.threads <= 0) run.settings.threads = std::max(1, int(std::thread::hardware_concurrency()));
+	run.progress.iterations = 0;
+	run.progress.cancel = false;
+	run.done = false;
+	run.thread = std::thread([&run] {
+		run.result = optimize(run.state, run.settings, &run.progress);
+		run.done = true;
+	});
+}
+bool optimizer_run_running(const OptimizerRun& run) {
+	return run.thread.joinable();
+}
+float optimizer_run_progress(const OptimizerRun& run) {
+	return float(run.progress.iterations) / (float(run.settings.iterations) * float(run.settings.threads));
+}
+bool optimizer_run_finish(OptimizerRun& run, MainState& main_state, bool& applied) {
+	// while dragging the temporary change is applied, the result waits until it is committed or dropped
+	if (!run.thread.joinable() || !run.done || main_state.temporary_change.type) return false;
+	run.thread.join();
+	size_t first, end;
+	instruction_buffer_difference(run.state.instructions, main_state.instructions, first, end);
+	applied = run.state.instructions.size() == main_state.instructions.size() && first == main_state.instructions.size();
+	if (applied) main_state_apply_optimizer_result(main_state, run.result);
+	return true;
+}
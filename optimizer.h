@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <thread>
+#include "main_state.h"
+
+// cost of the instructions in a MainState, lower is better
+typedef long long (*OptimizerCost)(const MainState& main_state);
+// every instruction counts, so the MOV/XCHG a register swap inserts make it worse
+long long optimizer_cost_instruction_count(const MainState& main_state);
+// cycles on an in-order machine issuing up to OPTIMIZER_ISSUE_WIDTH instructions per cycle, each one waiting
+// for the values it reads. reading memory takes OPTIMIZER_LOAD_LATENCY cycles, everything else one.
+// each cycle costs OPTIMIZER_CYCLE_COST and each instruction 1, so moves that gain nothing are not kept
+#define OPTIMIZER_ISSUE_WIDTH 2
+#define OPTIMIZER_LOAD_LATENCY 4
+#define OPTIMIZER_CYCLE_COST 16
+long long optimizer_cost_in_order_cycles(const MainState& main_state);
+// the same with the cycles of simulate on the default_simulator_settings core
+long long optimizer_cost_out_of_order_cycles(const MainState& main_state);
+
+// simulated annealing over build_horizontal_change and build_vertical_change.
+// every thread works on its own copy of the MainState, applying a random change and undoing it again if it is rejected.
+struct OptimizerSettings {
+	OptimizerCost cost;
+	int iterations; // per thread
+	double start_temperature; // a change that is worse by this much is accepted with probability 1/e at the start
+	double end_temperature;
+	int max_vertical_distance; // instructions are moved at most this far
+	int threads; // 0 uses all hardware threads
+	unsigned int seed;
+};
+OptimizerSettings default_optimizer_settings();
+
+struct OptimizerResult {
+	std::vector<Change> changes; // the best program found is the starting program with these applied in order
+	long long start_cost;
+	long long cost;
+	long long tried; // changes applied, over all threads
+	long long accepted;
+};
+// shared with a running optimize, so another thread can follow it and stop it early
+struct OptimizerProgress {
+	std::atomic<long long> iterations{}; // done, over all threads
+	std::atomic<bool> cancel{}; // the threads stop at their next iteration and the best program found so far is the result
+};
+OptimizerResult optimize(const MainState& main_state, const OptimizerSettings& settings, OptimizerProgress* progress = nullptr);
+// applies the changes as if they were made by hand, so they can be undone
+void main_state_apply_optimizer_result(MainState& main_state, const OptimizerResult& result);
+
+// optimize on a thread of its own, so the editor keeps running. it works on a copy of the MainState without its history,
+// the instructions are kept to see whether they were changed in the meantime
+struct OptimizerRun {
+	std::thread thread{};
+	MainState state{};
+	OptimizerSettings settings{};
+	OptimizerProgress progress{};
+	OptimizerResult result{};
+	std::atomic<bool> done{};
+};
+void optimizer_run_start(OptimizerRun& run, const MainState& main_state, const OptimizerSettings& settings);
+bool optimizer_run_running(const OptimizerRun& run);
+// share of the iterations done, between 0 and 1
+float optimizer_run_progress(const OptimizerRun& run);
+// true once, after the run is done or cancelled. the changes found are applied if the instructions are still
+// the ones it started from, the run is left for the next optimizer_run_start
+bool optimizer_run_finish(OptimizerRun& run, MainState& main_state, bool& applied);
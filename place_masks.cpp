@@ -0,0 +1,104 @@
+#include "place_masks.h"
+#include <algorithm>
+
+unsigned long long read_places(const InstructionFootprint& footprint, const Instruction& instruction) {
+	unsigned long long result = footprint.always_read_flags | PLACE_CONTROL_FLOW | ((unsigned long long)(footprint.always_read_registers) << 16);
+	for (int i = 0; i != 4; i++) if (footprint.operands[i].head) {
+		unsigned char head = footprint.operands[i].head;
+		unsigned long long op = instruction.operands[i];
+		if ((head & OF_TYPE) == OF_DEREF) {
+			result |= PLACE_REGISTER(head & OF_PTR_REGISTER);
+			if ((head & OF_DEREF_TYPE) != OF_OUT_DEREF) result |= PLACE_MEMORY;
+		}
+		else if (OP_IS_MEMORY_LOCATION(op)) {
+			// the address is read even if the memory is only written
+			if (OP_MEMORY_BASE_REGISTER(op) < 16) result |= PLACE_REGISTER(OP_MEMORY_BASE_REGISTER(op));
+			if (OP_MEMORY_INDEX_REGISTER(op) < 16) result |= PLACE_REGISTER(OP_MEMORY_INDEX_REGISTER(op));
+			if ((head & OF_TYPE) != OF_OUT) result |= PLACE_MEMORY;
+		}
+		else if ((head & OF_TYPE) == OF_OUT) continue;
+		else if (OP_IS_REGISTER(op)) result |= PLACE_REGISTER(OP_REGISTER(op));
+		else if (OP_IS_HIGH_BYTE(op)) result |= PLACE_REGISTER(OP_HIGH_BYTE(op));
+		else if (OP_IS_SIMD_REGISTER(op)) result |= PLACE_SIMD_REGISTER(OP_SIMD_REGISTER(op));
+		else if (OP_IS_RIP_RELATIVE(op)) result |= PLACE_MEMORY;
+	}
+	return result;
+}
+unsigned long long written_places(const InstructionFootprint& footprint, const Instruction& instruction) {
+	unsigned long long result = footprint.always_written_flags | ((unsigned long long)(footprint.always_written_registers) << 16);
+	if (footprint.jump_type) result |= PLACE_CONTROL_FLOW;
+	for (int i = 0; i != 4; i++) if (footprint.operands[i].head && (footprint.operands[i].head & OF_TYPE) != OF_IN) {
+		unsigned char head = footprint.operands[i].head;
+		unsigned long long op = instruction.operands[i];
+		if ((head & OF_TYPE) == OF_DEREF) {
+			if ((head & OF_DEREF_TYPE) != OF_IN_DEREF) result |= PLACE_MEMORY;
+		}
+		else if (OP_IS_REGISTER(op)) result |= PLACE_REGISTER(OP_REGISTER(op));
+		else if (OP_IS_HIGH_BYTE(op)) result |= PLACE_REGISTER(OP_HIGH_BYTE(op));
+		else if (OP_IS_SIMD_REGISTER(op)) result |= PLACE_SIMD_REGISTER(OP_SIMD_REGISTER(op));
+		else if (OP_IS_RIP_RELATIVE(op) || OP_IS_MEMORY_LOCATION(op)) result |= PLACE_MEMORY;
+	}
+	return result;
+}
+
+void place_masks_build(PlaceMasks& masks, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions) {
+	masks.read.resize(instructions.size());
+	masks.written.resize(instructions.size());
+	place_masks_update(masks, instructions, extensions, 0, int(instructions.size()) - 1);
+}
+void place_masks_update(PlaceMasks& masks, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, int first, int last) {
+	for (int i = first; i <= last; i++) {
+		auto& instruction = instructions[i];
+		auto& footprint = extensions[instruction.extension].instructions[instruction.index];
+		masks.read[i] = read_places(footprint, instruction);
+		masks.written[i] = written_places(footprint, instruction);
+	}
+}
+void place_masks_insert(PlaceMasks& masks, const std::vector<InstructionSetExtension>& extensions, int position, std::span<const Instruction> instructions) {
+	masks.read.insert(masks.read.begin() + position, instructions.size(), 0);
+	masks.written.insert(masks.written.begin() + position, instructions.size(), 0);
+	for (size_t i = 0; i != instructions.size(); i++) {
+		auto& footprint = extensions[instructions[i].extension].instructions[instructions[i].index];
+		masks.read[position + i] = read_places(footprint, instructions[i]);
+		masks.written[position + i] = written_places(footprint, instructions[i]);
+	}
+}
+void place_masks_erase(PlaceMasks& masks, int position, int count) {
+	masks.read.erase(masks.read.begin() + position, masks.read.begin() + position + count);
+	masks.written.erase(masks.written.begin() + position, masks.written.begin() + position + count);
+}
+void place_masks_insert(PlaceMasks& masks, const std::vector<InstructionSetExtension>& extensions, std::span<const int> positions, std::span<const Instruction> instructions) {
+	size_t from = masks.read.size();
+	masks.read.resize(from + positions.size());
+	masks.written.resize(from + positions.size());
+	// from the back, so every mask moves once
+	for (size_t i = masks.read.size(), p = positions.size(); p; ) {
+		if (size_t(positions[p - 1]) == --i) {
+			auto& instruction = instructions[--p];
+			auto& footprint = extensions[instruction.extension].instructions[instruction.index];
+			masks.read[i] = read_places(footprint, instruction);
+			masks.written[i] = written_places(footprint, instruction);
+			continue;
+		}
+		masks.read[i] = masks.read[--from];
+		masks.written[i] = masks.written[from];
+	}
+}
+void place_masks_erase(PlaceMasks& masks, std::span<const int> positions) {
+	if (positions.empty()) return;
+	size_t kept = positions[0];
+	for (size_t i = kept, p = 0; i != masks.read.size(); i++) {
+		if (p != positions.size() && size_t(positions[p]) == i) {
+			p++;
+			continue;
+		}
+		masks.read[kept] = masks.read[i];
+		masks.written[kept++] = masks.written[i];
+	}
+	masks.read.resize(kept);
+	masks.written.resize(kept);
+}
+void place_masks_rotate(PlaceMasks& masks, int first, int middle, int last) {
+	std::rotate(masks.read.begin() + first, masks.read.begin() + middle, masks.read.begin() + last);
+	std::rotate(masks.written.begin() + first, masks.written.begin() + middle, masks.written.begin() + last);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include "instruction_buffer.h"
+
+// places an instruction reads or writes, one bit each:
+//	flags 0-7 (same bits as always_read_flags), memory 8, control flow 15,
+//	general purpose registers 16-31, SIMD registers 32-63
+// every instruction reads the control flow bit, jumps also write it, so nothing moves across a jump.
+#define PLACE_MEMORY (1ull << 8)
+#define PLACE_CONTROL_FLOW (1ull << 15)
+#define PLACE_REGISTER(r) (1ull << (16 + (r)))
+#define PLACE_SIMD_REGISTER(s) (1ull << (32 + (s)))
+// the bit of a RegisterSwap position (0x1r or 0x2s)
+#define PLACE_OF_POSITION(pos) (((pos) & 0x20ull) ? PLACE_SIMD_REGISTER((pos) & 0x1f) : PLACE_REGISTER((pos) & 0xf))
+
+unsigned long long read_places(const InstructionFootprint& footprint, const Instruction& instruction);
+unsigned long long written_places(const InstructionFootprint& footprint, const Instruction& instruction);
+
+// read_places/written_places of every instruction, kept in parallel with MainState::instructions.
+// two instructions can be swapped if neither writes what the other one reads or writes.
+struct PlaceMasks {
+	std::vector<unsigned long long> read{};
+	std::vector<unsigned long long> written{};
+};
+void place_masks_build(PlaceMasks& masks, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions);
+// recomputes [first, last] after the operands of these instructions changed
+void place_masks_update(PlaceMasks& masks, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions, int first, int last);
+void place_masks_insert(PlaceMasks& masks, const std::vector<InstructionSetExtension>& extensions, int position, std::span<const Instruction> instructions);
+void place_masks_erase(PlaceMasks& masks, int position, int count);
+// the same for single instructions at sorted <positions>, counted before erasing or after inserting, in one pass
+void place_masks_insert(PlaceMasks& masks, const std::vector<InstructionSetExtension>& extensions, std::span<const int> positions, std::span<const Instruction> instructions);
+void place_masks_erase(PlaceMasks& masks, std::span<const int> positions);
+void place_masks_rotate(PlaceMasks& masks, int first, int middle, int last);
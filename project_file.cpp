@@ -0,0 +1,225 @@
+#include "project_file.h"
+#include <cstring>
+#include <algorithm>
+
+static_assert(sizeof(ProjectHeader) % 8 == 0 && sizeof(ProjectExtension) % 8 == 0 && sizeof(ProjectBranch) % 8 == 0);
+
+unsigned long long align_project_offset(unsigned long long offset) { return (offset + 7) & ~7ull; }
+
+bool project_section_fits(const MappedFile& file, unsigned long long offset, unsigned long long count, unsigned long long element_size) {
+	return offset % 8 == 0 && offset <= file.size && count <= (file.size - offset) / element_size;
+}
+
+bool open_project_view(const MappedFile& file, ProjectView& result) {
+	if (file.size < sizeof(ProjectHeader)) return false;
+	auto header = (const ProjectHeader*)file.data;
+	if (memcmp(header->magic, PROJECT_MAGIC, sizeof(PROJECT_MAGIC))
+		|| header->version != PROJECT_VERSION
+		|| header->instruction_size != sizeof(Instruction)
+		|| header->footprint_size != sizeof(InstructionFootprint)
+		|| header->branch_size != sizeof(ProjectBranch)
+		|| header->extension_size != sizeof(ProjectExtension)
+		|| header->timing_size != sizeof(InstructionTiming)
+		|| header->encoding_size != sizeof(InstructionEncoding)) return false;
+	if (!project_section_fits(file, header->extensions_offset, header->nr_extensions, sizeof(ProjectExtension))
+		|| !project_section_fits(file, header->instructions_offset, header->nr_instructions, sizeof(Instruction))
+		|| !project_section_fits(file, header->branches_offset, header->nr_branches, sizeof(ProjectBranch))
+		|| header->nr_branches > 0x7fffffff || header->current_branch >= header->nr_branches || header->current_index > 0x7fffffff
+		|| header->current_base < -0x80000000ll || header->current_base > 0x7fffffff) return false;
+	auto extensions = (const ProjectExtension*)(file.data + header->extensions_offset);
+	for (unsigned int i = 0; i != header->nr_extensions; i++)
+		if (!project_section_fits(file, extensions[i].names_offset, extensions[i].names_size, 1)
+			|| !project_section_fits(file, extensions[i].footprints_offset, extensions[i].nr_footprints, sizeof(InstructionFootprint))
+			|| (extensions[i].names_size && file.data[extensions[i].names_offset + extensions[i].names_size - 1] != '\0')
+			|| !project_section_fits(file, extensions[i].profile_names_offset, extensions[i].profile_names_size, 1)
+			|| (extensions[i].profile_names_size && file.data[extensions[i].profile_names_offset + extensions[i].profile_names_size - 1] != '\0')
+			|| extensions[i].nr_profiles > extensions[i].profile_names_size
+			|| !project_section_fits(file, extensions[i].timings_offset, extensions[i].nr_profiles * extensions[i].nr_footprints, sizeof(InstructionTiming))
+			|| !project_section_fits(file, extensions[i].encodings_offset, extensions[i].nr_encodings, sizeof(InstructionEncoding)))
+			return false;
+	auto branches = (const ProjectBranch*)(file.data + header->branches_offset);
+	for (unsigned long long i = 0; i != header->nr_branches; i++)
+		if (!project_section_fits(file, branches[i].bytes_offset, branches[i].bytes_size, 1)
+			|| branches[i].parent < CHANGE_BRANCH_DROPPED || branches[i].parent >= (long long)i
+			|| branches[i].start_index > branches[i].count || branches[i].count > 0x7fffffff
+			|| branches[i].start_base < -0x80000000ll || branches[i].start_base > 0x7fffffff) return false;
+	result = {
+		.header = header,
+		.extensions = extensions,
+		.instructions = (const Instruction*)(file.data + header->instructions_offset),
+		.branches = branches
+	};
+	return true;
+}
+const char* project_view_names(const MappedFile& file, const ProjectView& view, int extension) {
+	return file.data + view.extensions[extension].names_offset;
+}
+const InstructionFootprint* project_view_footprints(const MappedFile& file, const ProjectView& view, int extension) {
+	return (const InstructionFootprint*)(file.data + view.extensions[extension].footprints_offset);
+}
+const char* project_view_profile_names(const MappedFile& file, const ProjectView& view, int extension) {
+	return file.data + view.extensions[extension].profile_names_offset;
+}
+const InstructionTiming* project_view_timings(const MappedFile& file, const ProjectView& view, int extension) {
+	return (const InstructionTiming*)(file.data + view.extensions[extension].timings_offset);
+}
+const InstructionEncoding* project_view_encodings(const MappedFile& file, const ProjectView& view, int extension) {
+	return (const InstructionEncoding*)(file.data + view.extensions[extension].encodings_offset);
+}
+
+bool save_project(const char* path, const MainState& main_state) {
+	ProjectHeader header{
+		.magic = PROJECT_MAGIC,
+		.version = PROJECT_VERSION,
+		.instruction_size = sizeof(Instruction),
+		.footprint_size = sizeof(InstructionFootprint),
+		.branch_size = sizeof(ProjectBranch),
+		.extension_size = sizeof(ProjectExtension),
+		.timing_size = sizeof(InstructionTiming),
+		.encoding_size = sizeof(InstructionEncoding),
+		.nr_extensions = (unsigned int)main_state.extensions.size(),
+		.extensions_offset = sizeof(ProjectHeader)
+	};
+	std::vector<ProjectExtension> extensions{};
+	unsigned long long offset = header.extensions_offset + main_state.extensions.size() * sizeof(ProjectExtension);
+	for (auto& extension : main_state.extensions) {
+		ProjectExtension entry{};
+		entry.names_offset = offset;
+		entry.names_size = extension.names.size();
+		entry.footprints_offset = align_project_offset(offset + entry.names_size);
+		entry.nr_footprints = extension.instructions.size();
+		entry.profile_names_offset = align_project_offset(entry.footprints_offset + entry.nr_footprints * sizeof(InstructionFootprint));
+		entry.profile_names_size = extension.profile_names.size();
+		entry.timings_offset = align_project_offset(entry.profile_names_offset + entry.profile_names_size);
+		entry.nr_profiles = extension.instructions.empty() ? 0 : extension.timings.size() / extension.instructions.size();
+		entry.encodings_offset = align_project_offset(entry.timings_offset + extension.timings.size() * sizeof(InstructionTiming));
+		entry.nr_encodings = extension.encodings.size();
+		offset = align_project_offset(entry.encodings_offset + entry.nr_encodings * sizeof(InstructionEncoding));
+		extensions.push_back(entry);
+	}
+	header.nr_instructions = main_state.instructions.size();
+	header.instructions_offset = offset;
+	const ChangeLog& log = main_state.change_log;
+	header.nr_branches = log.branches.size();
+	header.branches_offset = align_project_offset(offset + header.nr_instructions * sizeof(Instruction));
+	header.current_branch = log.current.branch;
+	header.current_index = log.current.index;
+	header.current_offset = log.current.offset;
+	header.current_base = log.current.base;
+	std::vector<ProjectBranch> branches{};
+	offset = header.branches_offset + log.branches.size() * sizeof(ProjectBranch);
+	for (auto& branch : log.branches) {
+		branches.push_back({
+			.parent = branch.parent,
+			.parent_offset = branch.parent_offset,
+			.start_index = (unsigned long long)branch.start.index,
+			.start_base = branch.start.base,
+			.count = (unsigned long long)branch.count,
+			.last_visit = branch.last_visit,
+			.bytes_offset = offset,
+			.bytes_size = branch.bytes.size()
+		});
+		offset = align_project_offset(offset + branch.bytes.size());
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file) return false;
+	unsigned long long written = 0;
+	auto write = [&](const void* data, unsigned long long size) {
+		file.write((const char*)data, size);
+		written += size;
+	};
+	auto pad = [&]() {
+		const char zeros[8] = {};
+		write(zeros, align_project_offset(written) - written);
+	};
+	write(&header, sizeof(header));
+	write(extensions.data(), extensions.size() * sizeof(ProjectExtension));
+	for (auto& extension : main_state.extensions) {
+		write(extension.names.data(), extension.names.size());
+		pad();
+		write(extension.instructions.data(), extension.instructions.size() * sizeof(InstructionFootprint));
+		pad();
+		write(extension.profile_names.data(), extension.profile_names.size());
+		pad();
+		write(extension.timings.data(), extension.timings.size() * sizeof(InstructionTiming));
+		pad();
+		write(extension.encodings.data(), extension.encodings.size() * sizeof(InstructionEncoding));
+		pad();
+	}
+	for (auto& chunk : main_state.instructions.chunks) write(chunk->data(), chunk->size() * sizeof(Instruction));
+	pad();
+	write(branches.data(), branches.size() * sizeof(ProjectBranch));
+	for (auto& branch : log.branches) {
+		write(branch.bytes.data(), branch.bytes.size());
+		pad();
+	}
+	return bool(file);
+}
+
+bool load_project(const char* path, MainState& main_state) {
+	MappedFile file;
+	if (!map_file(path, file)) return false;
+	ProjectView view;
+	if (!open_project_view(file, view)) {
+		unmap_file(file);
+		return false;
+	}
+	std::vector<InstructionSetExtension> extensions(view.header->nr_extensions);
+	for (unsigned int i = 0; i != view.header->nr_extensions; i++) {
+		const char* names = project_view_names(file, view, i);
+		const InstructionFootprint* footprints = project_view_footprints(file, view, i);
+		extensions[i].names.assign(names, names + view.extensions[i].names_size);
+		extensions[i].instructions.assign(footprints, footprints + view.extensions[i].nr_footprints);
+		const char* profile_names = project_view_profile_names(file, view, i);
+		const InstructionTiming* timings = project_view_timings(file, view, i);
+		extensions[i].profile_names.assign(profile_names, profile_names + view.extensions[i].profile_names_size);
+		extensions[i].timings.assign(timings, timings + view.extensions[i].nr_profiles * view.extensions[i].nr_footprints);
+		const InstructionEncoding* encodings = project_view_encodings(file, view, i);
+		extensions[i].encodings.assign(encodings, encodings + view.extensions[i].nr_encodings);
+	}
+	bool valid = true;
+	for (auto& extension : extensions)
+		for (auto& footprint : extension.instructions) valid &= footprint.name < extension.names.size();
+	for (auto& extension : extensions)
+		for (auto& timing : extension.timings) valid &= !timing.latency || timing.ports;
+	for (auto& extension : extensions)
+		for (size_t e = 0; e != extension.encodings.size(); e++)
+			valid &= extension.encodings[e].instruction < extension.instructions.size() && (!e || extension.encodings[e - 1].instruction <= extension.encodings[e].instruction);
+	for (unsigned long long i = 0; i != view.header->nr_instructions; i++)
+		valid &= view.instructions[i].extension < extensions.size() && view.instructions[i].index < extensions[view.instructions[i].extension].instructions.size();
+	ChangeLog log{ .branches = {}, .memory_budget = main_state.change_log.memory_budget };
+	for (unsigned long long i = 0; i != view.header->nr_branches; i++) {
+		const ProjectBranch& branch = view.branches[i];
+		const unsigned char* bytes = (const unsigned char*)(file.data + branch.bytes_offset);
+		log.branches.push_back({
+			.parent = int(branch.parent),
+			.parent_offset = size_t(branch.parent_offset),
+			.start = { .branch = int(i), .index = int(branch.start_index), .offset = 0, .base = int(branch.start_base) },
+			.count = int(branch.count),
+			.last_visit = branch.last_visit,
+			.bytes = std::vector<unsigned char>(bytes, bytes + branch.bytes_size)
+		});
+		log.visits = std::max(log.visits, branch.last_visit);
+	}
+	log.current = {
+		.branch = int(view.header->current_branch),
+		.index = int(view.header->current_index),
+		.offset = size_t(view.header->current_offset),
+		.base = int(view.header->current_base)
+	};
+	valid &= change_log_valid(log, extensions, size_t(view.header->nr_instructions));
+	if (!valid) {
+		unmap_file(file);
+		return false;
+	}
+	std::vector<Instruction> instructions(view.instructions, view.instructions + view.header->nr_instructions);
+	unmap_file(file);
+
+	main_state.extensions = std::move(extensions);
+	main_state.mnemonics = build_mnemonic_index(main_state.extensions);
+	main_state_set_instructions(main_state, std::move(instructions));
+	main_state.change_log = std::move(log);
+	change_log_add_snapshot(main_state.change_log, main_state.instructions);
+	return true;
+}
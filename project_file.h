@@ -0,0 +1,79 @@
+#pragma once
+#include "main_state.h"
+#include "mapped_file.h"
+
+// binary project file, all sections are raw arrays aligned to 8 bytes so a mapped file can be used in place:
+//	ProjectHeader
+//	ProjectExtension[nr_extensions]
+//	per extension: names (char[names_size]), footprints (InstructionFootprint[nr_footprints]),
+//		profile names (char[profile_names_size]), timings (InstructionTiming[nr_profiles * nr_footprints]),
+//		encodings (InstructionEncoding[nr_encodings])
+//	Instruction[nr_instructions]
+//	ProjectBranch[nr_branches], then the bytes of every branch (unsigned char[bytes_size])
+// current is the position in the ChangeLog the instructions are at.
+// offsets are counted from the start of the file. the struct sizes are stored so files from
+// builds with a different layout are rejected instead of misread. the snapshots of the ChangeLog are not stored.
+#define PROJECT_MAGIC "asmproj"
+#define PROJECT_VERSION 6
+struct ProjectHeader {
+	char magic[8]; // PROJECT_MAGIC
+	unsigned int version;
+	unsigned short instruction_size;
+	unsigned short footprint_size;
+	unsigned short branch_size;
+	unsigned short extension_size;
+	unsigned short timing_size;
+	unsigned short encoding_size;
+	unsigned int nr_extensions;
+	unsigned long long extensions_offset;
+	unsigned long long nr_instructions;
+	unsigned long long instructions_offset;
+	unsigned long long nr_branches;
+	unsigned long long branches_offset;
+	unsigned long long current_branch;
+	unsigned long long current_index;
+	unsigned long long current_offset;
+	long long current_base;
+};
+struct ProjectExtension {
+	unsigned long long names_offset;
+	unsigned long long names_size;
+	unsigned long long footprints_offset;
+	unsigned long long nr_footprints;
+	unsigned long long profile_names_offset;
+	unsigned long long profile_names_size;
+	unsigned long long timings_offset;
+	unsigned long long nr_profiles;
+	unsigned long long encodings_offset;
+	unsigned long long nr_encodings;
+};
+// a ChangeBranch, its start offset is 0 and its start branch is its own number
+struct ProjectBranch {
+	long long parent;
+	unsigned long long parent_offset;
+	unsigned long long start_index;
+	long long start_base;
+	unsigned long long count;
+	long long last_visit;
+	unsigned long long bytes_offset;
+	unsigned long long bytes_size;
+};
+
+// read only view into a mapped project file, valid as long as the mapping is
+struct ProjectView {
+	const ProjectHeader* header;
+	const ProjectExtension* extensions;
+	const Instruction* instructions;
+	const ProjectBranch* branches;
+};
+// checks the header and that every section lies inside the file
+bool open_project_view(const MappedFile& file, ProjectView& result);
+const char* project_view_names(const MappedFile& file, const ProjectView& view, int extension);
+const InstructionFootprint* project_view_footprints(const MappedFile& file, const ProjectView& view, int extension);
+const char* project_view_profile_names(const MappedFile& file, const ProjectView& view, int extension);
+const InstructionTiming* project_view_timings(const MappedFile& file, const ProjectView& view, int extension);
+const InstructionEncoding* project_view_encodings(const MappedFile& file, const ProjectView& view, int extension);
+
+bool save_project(const char* path, const MainState& main_state);
+// replaces extensions, instructions and undo history of main_state. on failure nothing is changed.
+bool load_project(const char* path, MainState& main_state);
@@ -0,0 +1,236 @@
+#include "simulator.h"
+#include <algorithm>
+#include <bit>
+
+SimulatorSettings default_simulator_settings() {
+	return {
+		.dispatch_width = 4,
+		.retire_width = 4,
+		.reorder_buffer_size = 224,
+		.nr_ports = 7,
+		.alu_ports = 0x0f,
+		.load_ports = 0x30,
+		.store_ports = 0x40,
+		.alu_latency = 1,
+		.load_latency = 5,
+		.store_latency = 1
+	};
+}
+
+SimulatorState start_simulator_state(const SimulatorSettings& settings) {
+	return {
+		.ready = {},
+		.dispatch_cycle = 0,
+		.dispatched = 0,
+		.retire_cycle = 0,
+		.retired = 0,
+		.retired_at = std::vector<long long>(std::max(settings.reorder_buffer_size, 1), -1),
+		.next_slot = 0,
+		.calendar_start = 0,
+		.calendar_head = 0,
+		.busy_ports = std::vector<unsigned int>(SIMULATOR_CALENDAR_CYCLES)
+	};
+}
+
+bool same_simulated_instruction(const Instruction& a, const Instruction& b) {
+	if (a.extension != b.extension || a.index != b.index) return false;
+	for (int i = 0; i != 4; i++) {
+		unsigned long long op = a.operands[i];
+		bool has_offset = OP_IS_IMMEDIATE(op) || OP_IS_RIP_RELATIVE(op) || OP_IS_MEMORY_LOCATION(op);
+		if ((has_offset ? op & ~0xffffffffull : op) != (has_offset ? b.operands[i] & ~0xffffffffull : b.operands[i])) return false;
+	}
+	return true;
+}
+
+// whether everything after <b> happens the same as after <a>, <shift> cycles later.
+// cycles before the dispatch cycle can't hold anything up anymore, so they only have to be before it in both
+bool same_simulator_future(const SimulatorState& a, const SimulatorState& b, long long shift) {
+	if (b.dispatch_cycle != a.dispatch_cycle + shift || b.dispatched != a.dispatched) return false;
+	for (int p = 0; p != 64; p++)
+		if (std::max(a.ready[p], a.dispatch_cycle) + shift != std::max(b.ready[p], b.dispatch_cycle)) return false;
+	bool a_retiring = a.retire_cycle > a.dispatch_cycle, b_retiring = b.retire_cycle > b.dispatch_cycle;
+	if (a_retiring != b_retiring || (a_retiring && (b.retire_cycle != a.retire_cycle + shift || b.retired != a.retired))) return false;
+	size_t slots = a.retired_at.size();
+	for (size_t k = 0; k != slots; k++)
+		if (std::max(a.retired_at[(a.next_slot + k) % slots], a.dispatch_cycle - 1) + shift
+			!= std::max(b.retired_at[(b.next_slot + k) % slots], b.dispatch_cycle - 1)) return false;
+	for (size_t k = 0; k != SIMULATOR_CALENDAR_CYCLES; k++)
+		if (a.busy_ports[(a.calendar_head + k) % SIMULATOR_CALENDAR_CYCLES] != b.busy_ports[(b.calendar_head + k) % SIMULATOR_CALENDAR_CYCLES]) return false;
+	return true;
+}
+void shift_simulator_state(SimulatorState& state, long long shift) {
+	for (long long& ready : state.ready) ready += shift;
+	state.dispatch_cycle += shift;
+	state.retire_cycle += shift;
+	for (long long& retired : state.retired_at) retired += shift;
+	state.calendar_start += shift;
+}
+
+// what the simulation needs besides the state, the same for every instruction
+struct SimulatorRun {
+	const InstructionBuffer& instructions;
+	const PlaceMasks& places;
+	const SimulatorSettings& settings;
+	unsigned int all_ports;
+	std::vector<const InstructionTiming*> timings; // of the profile in every extension, null if it has none
+};
+SimulatorRun start_simulator_run(const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions,
+	const PlaceMasks& places, const SimulatorSettings& settings) {
+	SimulatorRun run{
+		.instructions = instructions,
+		.places = places,
+		.settings = settings,
+		.all_ports = settings.nr_ports >= 32 ? ~0u : (1u << settings.nr_ports) - 1,
+		.timings = std::vector<const InstructionTiming*>(extensions.size())
+	};
+	for (size_t e = 0; e != extensions.size() && !settings.profile.empty(); e++) {
+		int profile = timing_profile_index(extensions[e], settings.profile);
+		if (profile >= 0 && (profile + 1) * extensions[e].instructions.size() <= extensions[e].timings.size())
+			run.timings[e] = &extensions[e].timings[profile * extensions[e].instructions.size()];
+	}
+	return run;
+}
+
+void simulate_instruction(const SimulatorRun& run, SimulatorState& state, size_t i, const Instruction& simulated, SimulatedInstruction& instruction) {
+	const SimulatorSettings& settings = run.settings;
+	unsigned long long read = run.places.read[i] & ~PLACE_CONTROL_FLOW, written = run.places.written[i] & ~PLACE_CONTROL_FLOW;
+	int latency = settings.alu_latency;
+	unsigned int ports = settings.alu_ports;
+	int occupancy = 1; // cycles the port stays busy
+	if (read & PLACE_MEMORY) {
+		latency = settings.load_latency;
+		ports = settings.load_ports;
+	}
+	else if (written & PLACE_MEMORY) {
+		latency = settings.store_latency;
+		ports = settings.store_ports;
+	}
+	ports &= run.all_ports;
+	if (run.timings[simulated.extension] && run.timings[simulated.extension][simulated.index].latency) {
+		const InstructionTiming& timing = run.timings[simulated.extension][simulated.index];
+		latency = timing.latency + (read & PLACE_MEMORY ? settings.load_latency : 0);
+		ports = timing.ports;
+		occupancy = std::clamp(int(timing.reciprocal_throughput * std::popcount(ports) + 0.5f), 1, SIMULATOR_CALENDAR_CYCLES);
+	}
+
+	long long& slot = state.retired_at[state.next_slot];
+	long long dispatch = std::max(state.dispatch_cycle + (state.dispatched == settings.dispatch_width), slot + 1);
+	if (dispatch != state.dispatch_cycle) {
+		state.dispatch_cycle = dispatch;
+		state.dispatched = 0;
+	}
+	state.dispatched++;
+	// the cycles before dispatch are never looked at again
+	if (dispatch - state.calendar_start >= SIMULATOR_CALENDAR_CYCLES) {
+		std::fill(state.busy_ports.begin(), state.busy_ports.end(), 0);
+		state.calendar_head = 0;
+	}
+	else for (long long c = state.calendar_start; c != dispatch; c++) {
+		state.busy_ports[state.calendar_head] = 0;
+		state.calendar_head = (state.calendar_head + 1) % SIMULATOR_CALENDAR_CYCLES;
+	}
+	state.calendar_start = dispatch;
+	auto busy = [&](long long cycle) -> unsigned int& { return state.busy_ports[(state.calendar_head + (cycle - dispatch)) % SIMULATOR_CALENDAR_CYCLES]; };
+
+	long long issue = dispatch;
+	for (unsigned long long bits = read; bits; bits &= bits - 1) issue = std::max(issue, state.ready[std::countr_zero(bits)]);
+	int port = -1;
+	// without a port to wait for, e.g. the ALU ports set to none, it issues as soon as its inputs are ready
+	for (; ports && port < 0 && issue + occupancy <= dispatch + SIMULATOR_CALENDAR_CYCLES; issue += port < 0) {
+		unsigned int free = ports;
+		for (int c = 0; c != occupancy; c++) free &= ~busy(issue + c);
+		if (free) {
+			port = std::countr_zero(free);
+			for (int c = 0; c != occupancy; c++) busy(issue + c) |= 1u << port;
+		}
+	}
+	long long complete = issue + latency;
+	for (unsigned long long bits = written; bits; bits &= bits - 1) state.ready[std::countr_zero(bits)] = complete;
+
+	long long retire = std::max(complete, state.retire_cycle + (state.retired == settings.retire_width));
+	if (retire != state.retire_cycle) {
+		state.retire_cycle = retire;
+		state.retired = 0;
+	}
+	state.retired++;
+	slot = retire;
+	state.next_slot = (state.next_slot + 1) % state.retired_at.size();
+	instruction = { .dispatch = dispatch, .issue = issue, .complete = complete, .retire = retire, .port = port };
+}
+
+// simulates from result.checkpoints.back() to the end, result.instructions already has the new size.
+// <old> are the checkpoints of the previous run behind that one, where instruction i + <inserted> was instruction i
+// if it is at <end> or behind it. the first one whose state is reached again ends the simulation
+size_t simulate_from_checkpoint(SimulationResult& result, const SimulatorRun& run, std::vector<SimulatorCheckpoint>&& old, long long old_cycles,
+	long long inserted, size_t end) {
+	size_t size = result.instructions.size();
+	size_t begin = result.checkpoints.back().instruction;
+	SimulatorState state = result.checkpoints.back().state;
+	auto next_old = old.begin();
+	size_t last_checkpoint = begin;
+	auto it = run.instructions.begin();
+	if (begin != size) {
+		size_t c = run.instructions.find_chunk(begin);
+		it = { &run.instructions, c, begin - run.instructions.chunk_starts[c] };
+	}
+	for (size_t i = begin; i != size; i++, ++it) {
+		while (next_old != old.end() && (long long)next_old->instruction + inserted < (long long)std::max(end, i)) next_old++;
+		if (i != begin && next_old != old.end() && (long long)next_old->instruction + inserted == (long long)i) {
+			long long shift = state.dispatch_cycle - next_old->state.dispatch_cycle;
+			if (same_simulator_future(next_old->state, state, shift)) {
+				// the rest is the same as before, later by shift cycles
+				if (shift) for (size_t j = i; j != size; j++) {
+					SimulatedInstruction& instruction = result.instructions[j];
+					instruction.dispatch += shift;
+					instruction.issue += shift;
+					instruction.complete += shift;
+					instruction.retire += shift;
+				}
+				for (; next_old != old.end(); next_old++) {
+					next_old->instruction += inserted;
+					shift_simulator_state(next_old->state, shift);
+					result.checkpoints.push_back(std::move(*next_old));
+				}
+				result.cycles = old_cycles + shift;
+				result.instructions_per_cycle = double(size) / result.cycles;
+				return i - begin;
+			}
+			result.checkpoints.push_back({ .instruction = i, .state = state });
+			last_checkpoint = i;
+		}
+		else if (i - last_checkpoint >= SIMULATOR_CHECKPOINT_INTERVAL) {
+			result.checkpoints.push_back({ .instruction = i, .state = state });
+			last_checkpoint = i;
+		}
+		simulate_instruction(run, state, i, *it, result.instructions[i]);
+	}
+	result.cycles = size ? state.retire_cycle + 1 : 0;
+	result.instructions_per_cycle = size ? double(size) / result.cycles : 0;
+	return size - begin;
+}
+
+void simulate(SimulationResult& result, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions,
+	const PlaceMasks& places, const SimulatorSettings& settings) {
+	result.instructions.resize(places.read.size());
+	result.checkpoints.clear();
+	result.checkpoints.push_back({ .instruction = 0, .state = start_simulator_state(settings) });
+	simulate_from_checkpoint(result, start_simulator_run(instructions, extensions, places, settings), {}, 0, 0, 0);
+}
+
+size_t simulate_update(SimulationResult& result, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions,
+	const PlaceMasks& places, const SimulatorSettings& settings, size_t first, size_t end) {
+	if (result.checkpoints.empty()) {
+		simulate(result, instructions, extensions, places, settings);
+		return places.read.size();
+	}
+	long long inserted = (long long)places.read.size() - (long long)result.instructions.size();
+	// the old results behind the change move to where their instructions are now
+	size_t old_end = size_t(end - inserted);
+	if (inserted > 0) result.instructions.insert(result.instructions.begin() + old_end, size_t(inserted), SimulatedInstruction{});
+	if (inserted < 0) result.instructions.erase(result.instructions.begin() + end, result.instructions.begin() + old_end);
+	auto resumed = std::upper_bound(result.checkpoints.begin(), result.checkpoints.end(), first,
+		[](size_t instruction, const SimulatorCheckpoint& checkpoint) { return instruction < checkpoint.instruction; }) - 1;
+	std::vector<SimulatorCheckpoint> old(std::make_move_iterator(resumed + 1), std::make_move_iterator(result.checkpoints.end()));
+	result.checkpoints.erase(resumed + 1, result.checkpoints.end());
+	return simulate_from_checkpoint(result, start_simulator_run(instructions, extensions, places, settings), std::move(old), result.cycles, inserted, end);
+}
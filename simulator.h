@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "place_masks.h"
+#include "instruction_buffer.h"
+
+// cycle-approximate out-of-order core, every instruction is one micro-op:
+//	it enters the reorder buffer in order, dispatch_width per cycle, once the one reorder_buffer_size before it retired,
+//	issues out of order to a free port as soon as the places it reads are ready,
+//	has its results ready latency cycles later and retires in order, retire_width per cycle.
+// registers are renamed, so only reading what an earlier instruction wrote is a dependency. memory is one place,
+// a load waits for every store before it. jumps are predicted, the listing runs once from top to bottom.
+// with a timing profile, an instruction the profile has a timing for takes its latency and ports from it and keeps
+// its port busy for reciprocal throughput * number of ports cycles, so a long running divide blocks its port.
+// timings are for the register form, reading memory adds load_latency. the ports are the profile's own, not nr_ports.
+#define SIMULATOR_MAX_PORTS 16
+// ports are only tracked this many cycles after the latest dispatch, an instruction issuing later takes no port
+#define SIMULATOR_CALENDAR_CYCLES 4096
+// the state is kept about every this many instructions, so after a change only the instructions from the one before it
+// are simulated again
+#define SIMULATOR_CHECKPOINT_INTERVAL 2048
+struct SimulatorSettings {
+	int dispatch_width;
+	int retire_width;
+	int reorder_buffer_size;
+	int nr_ports;
+	// the ports an instruction can issue to and its latency: loads read memory, stores only write it
+	unsigned int alu_ports;
+	unsigned int load_ports;
+	unsigned int store_ports;
+	int alu_latency;
+	int load_latency;
+	int store_latency;
+	std::string profile{}; // InstructionTiming profile to use where it has one, none if empty
+
+	bool operator==(const SimulatorSettings& other) const = default;
+};
+// roughly a current desktop core: 4 wide, 224 entries, 4 ALU ports, 2 load ports and a store port
+SimulatorSettings default_simulator_settings();
+
+// everything the next instruction depends on
+struct SimulatorState {
+	long long ready[64]; // cycle each place gets its last value
+	long long dispatch_cycle;
+	int dispatched; // in dispatch_cycle
+	long long retire_cycle;
+	int retired; // in retire_cycle
+	std::vector<long long> retired_at; // of the last reorder_buffer_size instructions, the oldest at next_slot
+	size_t next_slot;
+	long long calendar_start; // busy_ports[(calendar_head + c - calendar_start) % SIMULATOR_CALENDAR_CYCLES] is cycle c from here on
+	size_t calendar_head;
+	std::vector<unsigned int> busy_ports;
+};
+// the state before <instruction>
+struct SimulatorCheckpoint {
+	size_t instruction;
+	SimulatorState state;
+};
+
+struct SimulatedInstruction {
+	long long dispatch; // cycle it entered the reorder buffer
+	long long issue;
+	long long complete; // its results are ready
+	long long retire;
+	int port; // -1 if it issued past the calendar or had no port it could issue to
+};
+struct SimulationResult {
+	std::vector<SimulatedInstruction> instructions{}; // in parallel with MainState::instructions
+	long long cycles; // until the last instruction retired
+	double instructions_per_cycle;
+	std::vector<SimulatorCheckpoint> checkpoints{}; // by instruction
+};
+// same_instruction, but immediates and offsets may differ: they don't change the simulation, while the jump
+// displacements around an inserted instruction do change
+bool same_simulated_instruction(const Instruction& a, const Instruction& b);
+// runs <instructions>, <places> is built from them
+void simulate(SimulationResult& result, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions,
+	const PlaceMasks& places, const SimulatorSettings& settings);
+// the same as simulate when only [first, end) changed since the run <result> is from (see instruction_buffer_difference
+// with same_simulated_instruction) and the settings stayed the same. resumes from the last checkpoint before first and stops at the first checkpoint behind
+// the change where the state matches the old run, maybe later by some cycles: the rest of the old run is moved by those.
+// returns the number of instructions it simulated
+size_t simulate_update(SimulationResult& result, const InstructionBuffer& instructions, const std::vector<InstructionSetExtension>& extensions,
+	const PlaceMasks& places, const SimulatorSettings& settings, size_t first, size_t end);